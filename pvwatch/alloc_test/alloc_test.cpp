@@ -0,0 +1,240 @@
+/*
+	Headless allocation test of the PV core, without the App window or any GUI library.
+
+	Usage: alloc_test [--repeats n]
+
+	Every case first runs its --repeats calls (and at least once per snapshot slot) to reach its
+	steady state, then the same calls again while a global operator new hook (the aligned forms as well) counts the heap
+	allocations. Any allocation in the steady state fails the case: the curve solve (its warm
+	start seeds, previous curve and adaptive grid index), the snapshot publication, the lookups
+	and the simulator sweeps must all reuse their storage.
+	Returns 0 when every case passes.
+*/
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "../pv/include/pv.h"
+#include "../pv/include/pv_curve.h"
+
+namespace
+{
+	// Heap allocations of the whole process, from any thread
+	std::atomic<long long> allocations(0);
+
+	void* CountedAllocate(size_t size, size_t alignment)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		size = (size > 0) ? size : 1;
+#ifdef _WIN32
+		void* p = (alignment > 0) ? _aligned_malloc(size, alignment) : malloc(size);
+#else
+		// aligned_alloc wants a multiple of the alignment
+		void* p = (alignment > 0) ? aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : malloc(size);
+#endif
+		if (p == nullptr) throw std::bad_alloc();
+		return p;
+	}
+
+	void CountedFree(void* p, size_t alignment)
+	{
+#ifdef _WIN32
+		if (alignment > 0)
+		{
+			_aligned_free(p);
+			return;
+		}
+#endif
+		(void)alignment;
+		free(p);
+	}
+}
+
+void* operator new(size_t size) { return CountedAllocate(size, 0); }
+void* operator new[](size_t size) { return CountedAllocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return CountedAllocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return CountedAllocate(size, (size_t)alignment); }
+
+void operator delete(void* p) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+
+namespace
+{
+	struct AllocOptions
+	{
+		int repeats = 20;
+	};
+
+	int failures = 0;
+
+	/*
+		Warm up with the calls of the case until every snapshot slot of the published curves was
+		written once, then run them again counting the allocations
+	*/
+	void Check(const std::string& name, int repeats, const std::function<void(int)>& call)
+	{
+		for (int i = 1; i <= std::max(repeats, (int)PV::CurvePublisher::SNAPSHOT_SLOTS); i++) call(i);
+
+		long long start = allocations.load();
+		for (int i = 1; i <= repeats; i++) call(i);
+		long long count = allocations.load() - start;
+
+		printf("  %-48s %8lld allocs %s\n", name.c_str(), count, (count == 0) ? "ok" : "FAIL");
+		if (count != 0) failures++;
+	}
+
+	bool ParseArguments(int argc, char** argv, AllocOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) options.repeats = atoi(argv[++i]);
+			else
+			{
+				fprintf(stderr, "Usage: %s [--repeats n]\n", argv[0]);
+				return false;
+			}
+		}
+
+		return options.repeats > 0;
+	}
+
+	const char* SolverName(PV::SolverMethod method)
+	{
+		switch (method)
+		{
+		case PV::SolverMethod::FixedPoint: return "fixed_point";
+		case PV::SolverMethod::Newton: return "newton";
+		case PV::SolverMethod::LambertW: return "lambert_w";
+		}
+		return "unknown";
+	}
+
+	/*
+		Curve solve of consecutive conditions, every solver on both grids and interpolations
+	*/
+	void CheckCurveSolve(const PV::ModelParameters& params, const AllocOptions& options)
+	{
+		printf("Curve solve\n");
+
+		const PV::SolverMethod methods[] = { PV::SolverMethod::FixedPoint, PV::SolverMethod::Newton, PV::SolverMethod::LambertW };
+		for (PV::SolverMethod method : methods)
+		{
+			for (int adaptive = 0; adaptive < 2; adaptive++)
+			{
+				for (int pchip = 0; pchip < 2; pchip++)
+				{
+					PV::PVModule module;
+					module.solver_method = method;
+					module.grid_mode = adaptive ? PV::GridMode::Adaptive : PV::GridMode::Uniform;
+					module.interpolation_mode = pchip ? PV::InterpolationMode::Pchip : PV::InterpolationMode::Linear;
+
+					std::string name = std::string(SolverName(method)) + (adaptive ? " adaptive" : " uniform") + (pchip ? " pchip" : " linear");
+					Check(name, options.repeats, [&](int i)
+					{
+						// A changing condition, the warm start and the adaptive grid see new curves
+						module.CalculateIVPArrays(params, 200.0f + 40.0f * (i % 20), 25.0f + (i % 7), PV::STEPS_nominal, PV::ITERS_nominal);
+					});
+				}
+			}
+		}
+	}
+
+	/*
+		Snapshots and lookups of the published curves, on both grids
+	*/
+	void CheckLookup(const PV::ModelParameters& params, const AllocOptions& options)
+	{
+		printf("Lookup\n");
+
+		for (int adaptive = 0; adaptive < 2; adaptive++)
+		{
+			PV::PVModule module;
+			module.grid_mode = adaptive ? PV::GridMode::Adaptive : PV::GridMode::Uniform;
+			module.interpolation_mode = PV::InterpolationMode::Pchip;
+
+			std::vector<double> voltages(1024);
+			std::vector<double> currents(voltages.size());
+			for (size_t i = 0; i < voltages.size(); i++) voltages[i] = 40.0 * i / voltages.size();
+
+			PV::CurveTable<PV::HilScalar, PV::PchipInterpolation> table;
+
+			std::string grid = adaptive ? " adaptive" : " uniform";
+			Check("snapshot and lookups" + grid, options.repeats, [&](int i)
+			{
+				module.CalculateIVPArrays(params, 300.0f + 30.0f * (i % 20), 25.0f, PV::STEPS_nominal, PV::ITERS_nominal);
+				module.GetCurrentFromVoltage(voltages.data(), currents.data(), (int)voltages.size());
+
+				PV::CurvePublisher::Handle curve = module.AcquireSnapshot();
+				curve->GetCurrentFromVoltage(voltages.data(), currents.data(), (int)voltages.size());
+				table.Assign(*curve);
+			});
+		}
+	}
+
+	/*
+		Repeated sweeps of one simulator, their conditions and precomputed curves reuse the storage
+		of the first. The precomputed sweep runs on the calling thread only, a worker thread
+		allocates its own state.
+	*/
+	void CheckSweep(const PV::ModelParameters& params, const AllocOptions& options)
+	{
+		printf("Simulator sweep\n");
+
+		const PV::SimulationMode modes[] = { PV::SimulationMode::MaxSpeed, PV::SimulationMode::Precomputed };
+		for (PV::SimulationMode mode : modes)
+		{
+			for (int adaptive = 0; adaptive < 2; adaptive++)
+			{
+				PV::PVModule module;
+				module.grid_mode = adaptive ? PV::GridMode::Adaptive : PV::GridMode::Uniform;
+				module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, PV::STEPS_nominal, PV::ITERS_nominal);
+
+				PV::Simulator simulator(module);
+				simulator.mode = mode;
+				simulator.threads = 1;
+
+				std::string name = std::string((mode == PV::SimulationMode::MaxSpeed) ? "max_speed" : "precomputed") + (adaptive ? " adaptive" : " uniform");
+				Check(name, options.repeats, [&](int)
+				{
+					simulator.Simulation(100.0f, 1000.0f, 10.0f, 60.0f, 0.0f, 200);
+				});
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	AllocOptions options;
+	if (!ParseArguments(argc, argv, options)) return 1;
+
+	PV::ModelParameters params = PV::ExtractModelParameters(35.0f, 9.0f, 30.0f, 8.5f, PV::ITERS_nominal);
+
+	CheckCurveSolve(params, options);
+	CheckLookup(params, options);
+	CheckSweep(params, options);
+
+	if (failures > 0)
+	{
+		printf("%d case(s) allocate in their steady state\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
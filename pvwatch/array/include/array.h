@@ -0,0 +1,133 @@
+#pragma once
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "../../pv/include/pv.h"
+
+namespace PV
+{
+	struct ArrayOptions
+	{
+		int current_steps = 1024;		// Points of the module V(I) curves, from 0 to the largest Isc
+		int voltage_steps = 1024;		// Points of the array I(V) curve
+		bool bypass_diodes = true;		// One bypass diode across every module
+		double bypass_voltage = 0.5;	// Forward voltage of a bypass diode (V)
+		double tolerance = 1e-9;		// Voltage tolerance of the module curves (V)
+		double peak_threshold = 0.01;	// Local maxima below this fraction of the global one are ignored
+		int threads = 0;				// Threads for the module curves, 0 uses every core
+	};
+
+	/*
+		A local maximum of the array P-V curve
+	*/
+	struct ArrayPeak
+	{
+		double V;
+		double I;
+		double P;
+	};
+
+	/*
+		Work done by the last Calculate() call
+	*/
+	struct ArrayStats
+	{
+		int modules;
+		int distinct_curves;	// Module curves held, one per distinct (G, T)
+		int curves_computed;	// Module curves solved by the last call
+		int strings_composed;	// Strings summed again by the last call
+		double elapsed;			// s
+	};
+
+	/*
+		Array of identical modules: strings of modules in series, strings in parallel.
+
+		Series modules carry the same current, so every module is solved as a V(I) curve on
+		a current grid shared by the whole array and the string voltage is the sum of its
+		modules. A module pushed beyond its own short circuit current is clamped at the
+		bypass diode voltage, which gives the steps of the I-V curve (and the multiple P-V
+		peaks) of a partially shaded string. The strings are then resampled on a common
+		voltage grid and their currents added.
+
+		Modules at the same condition share one curve, and only the strings with a changed
+		module are summed again, so updating a few modules of a large array is cheap.
+	*/
+	class PVArray
+	{
+	public:
+		PVArray(const ModelParameters& params, int modules_per_string, int strings, const ArrayOptions& options = ArrayOptions());
+
+		int Strings(void) const { return this->strings; }
+		int ModulesPerString(void) const { return this->modules_per_string; }
+
+		/*
+			Set the condition of one module, G (W/m2) and T (C)
+		*/
+		void SetCondition(int string, int module, double g, double t_e);
+
+		/*
+			Set the condition of every module
+		*/
+		void SetCondition(double g, double t_e);
+
+		/*
+			Solve the changed module curves and compose the array curve
+		*/
+		void Calculate(void);
+
+		int Steps(void) const { return (int)this->voltage.size(); }
+		const double* Voltage(void) const { return this->voltage.data(); }
+		const double* Current(void) const { return this->current.data(); }
+		const double* Power(void) const { return this->power.data(); }
+
+		/*
+			Local maxima of the P-V curve by voltage, more than one under partial shading
+		*/
+		const std::vector<ArrayPeak>& Peaks(void) const { return this->peaks; }
+
+		/*
+			Global maximum power point, zeros before the first Calculate()
+		*/
+		ArrayPeak MaxPowerPoint(void) const;
+
+		ArrayStats GetStats(void) const { return this->stats; }
+
+	private:
+		typedef std::pair<float, float> Condition;
+
+		struct ModuleCurve
+		{
+			std::vector<double> voltage;	// V at every point of the current grid
+			int users;
+			bool solved;
+		};
+
+		ModelParameters params;
+		ArrayOptions options;
+		int modules_per_string;
+		int strings;
+
+		std::vector<Condition> conditions;	// Per module, string major
+		std::map<Condition, ModuleCurve> curves;
+		std::vector<bool> string_dirty;
+
+		// Current grid shared by every module, from 0 to current_max
+		double current_max;
+
+		// String V(I) curves on the current grid, one row per string
+		std::vector<double> string_voltage;
+
+		// Array curve
+		std::vector<double> voltage;
+		std::vector<double> current;
+		std::vector<double> power;
+		std::vector<ArrayPeak> peaks;
+
+		ArrayStats stats;
+
+		void SolveModuleCurve(const Condition& condition, ModuleCurve& curve) const;
+		void ComposeString(int string);
+		void ComposeArray(void);
+	};
+}
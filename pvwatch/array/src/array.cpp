@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <thread>
+
+#include "../include/array.h"
+
+// Headroom of the current grid above the largest photocurrent of the array
+#define ARRAY_CURRENT_HEADROOM 1.2
+
+// Fewer new module curves than this are solved on the calling thread
+#define ARRAY_PARALLEL_MIN_CURVES 8
+
+PV::PVArray::PVArray(const ModelParameters& params, int modules_per_string, int strings, const ArrayOptions& options)
+{
+	this->params = params;
+	this->options = options;
+	this->options.current_steps = std::max(this->options.current_steps, 2);
+	this->options.voltage_steps = std::max(this->options.voltage_steps, 2);
+	this->modules_per_string = std::max(modules_per_string, 1);
+	this->strings = std::max(strings, 1);
+	this->current_max = 0;
+	this->stats = {};
+
+	Condition nominal((float)G_nominal, (float)T_nominal);
+	this->conditions.assign(this->modules_per_string * this->strings, nominal);
+	this->string_dirty.assign(this->strings, true);
+
+	ModuleCurve& curve = this->curves[nominal];
+	curve.users = (int)this->conditions.size();
+	curve.solved = false;
+
+	this->string_voltage.resize((size_t)this->strings * this->options.current_steps);
+}
+
+void PV::PVArray::SetCondition(int string, int module, double g, double t_e)
+{
+	if (string < 0 || string >= this->strings || module < 0 || module >= this->modules_per_string) return;
+
+	Condition condition((float)g, (float)t_e);
+	Condition& current = this->conditions[(size_t)string * this->modules_per_string + module];
+	if (condition == current) return;
+
+	this->curves[current].users--;
+
+	ModuleCurve& curve = this->curves[condition];
+	if (curve.users++ == 0 && curve.voltage.empty()) curve.solved = false;
+
+	current = condition;
+	this->string_dirty[string] = true;
+}
+
+void PV::PVArray::SetCondition(double g, double t_e)
+{
+	for (int s = 0; s < this->strings; s++)
+	{
+		for (int m = 0; m < this->modules_per_string; m++) this->SetCondition(s, m, g, t_e);
+	}
+}
+
+PV::ArrayPeak PV::PVArray::MaxPowerPoint() const
+{
+	ArrayPeak best = {};
+	for (const ArrayPeak& peak : this->peaks)
+	{
+		if (peak.P > best.P) best = peak;
+	}
+	return best;
+}
+
+void PV::PVArray::Calculate()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	this->stats = {};
+	this->stats.modules = (int)this->conditions.size();
+
+	// Drop the curves no module uses any more
+	double photocurrent_max = 0;
+	for (auto it = this->curves.begin(); it != this->curves.end();)
+	{
+		if (it->second.users <= 0)
+		{
+			it = this->curves.erase(it);
+			continue;
+		}
+
+		photocurrent_max = std::max(photocurrent_max, DiodeAtCondition(this->params, it->first.first, it->first.second).Ipv);
+		++it;
+	}
+
+	// The current grid must reach beyond the short circuit current of every module, it only grows
+	if (photocurrent_max >= this->current_max)
+	{
+		this->current_max = ARRAY_CURRENT_HEADROOM * std::max(photocurrent_max, this->params.Ipv_nom);
+		for (auto& entry : this->curves) entry.second.solved = false;
+		std::fill(this->string_dirty.begin(), this->string_dirty.end(), true);
+	}
+
+	// Solve the new module curves
+	std::vector<std::pair<const Condition*, ModuleCurve*>> todo;
+	for (auto& entry : this->curves)
+	{
+		if (!entry.second.solved) todo.push_back(std::make_pair(&entry.first, &entry.second));
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		size_t i;
+		while ((i = next++) < todo.size()) this->SolveModuleCurve(*todo[i].first, *todo[i].second);
+	};
+
+	int thread_count = (this->options.threads > 0) ? this->options.threads : (int)std::thread::hardware_concurrency();
+	thread_count = (todo.size() >= ARRAY_PARALLEL_MIN_CURVES) ? std::min(std::max(thread_count, 1), (int)todo.size()) : 1;
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < thread_count; t++) threads.emplace_back(worker);
+	worker();
+	for (std::thread& thread : threads) thread.join();
+
+	this->stats.curves_computed = (int)todo.size();
+	this->stats.distinct_curves = (int)this->curves.size();
+
+	// A string with a new module curve is summed again
+	for (int s = 0; s < this->strings; s++)
+	{
+		if (!this->string_dirty[s])
+		{
+			for (int m = 0; m < this->modules_per_string && !this->string_dirty[s]; m++)
+			{
+				const Condition& condition = this->conditions[(size_t)s * this->modules_per_string + m];
+				for (const auto& item : todo)
+				{
+					if (*item.first == condition)
+					{
+						this->string_dirty[s] = true;
+						break;
+					}
+				}
+			}
+		}
+
+		if (this->string_dirty[s])
+		{
+			this->ComposeString(s);
+			this->string_dirty[s] = false;
+			this->stats.strings_composed++;
+		}
+	}
+
+	this->ComposeArray();
+
+	this->stats.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PV::PVArray::SolveModuleCurve(const Condition& condition, ModuleCurve& curve) const
+{
+	int steps = this->options.current_steps;
+	curve.voltage.resize(steps);
+
+	Simd::DiodeParameters d = DiodeAtCondition(this->params, condition.first, condition.second);
+	double n = d.a_vt;
+	double di = this->current_max / (steps - 1);
+	double v_clamp = -this->options.bypass_voltage;
+
+	// Newton on f(V) = Ipv - I0 * (exp((V + I*Rs) / n) - 1) - (V + I*Rs) / Rsh - I, decreasing and
+	// concave in V. The first point starts above the open circuit voltage (no shunt), every next
+	// one from the previous voltage which is above its solution, so it converges monotonically.
+	double v = n * log(d.Ipv / d.I0 + 1);
+
+	for (int c = 0; c < steps; c++)
+	{
+		double i = c * di;
+
+		// V(I) is decreasing, once the bypass diode conducts it does up to the end of the grid
+		if (this->options.bypass_diodes && v <= v_clamp)
+		{
+			curve.voltage[c] = v_clamp;
+			continue;
+		}
+
+		for (int j = 0; j < ITERS_nominal; j++)
+		{
+			double e = d.I0 * exp((v + i * d.Rs) / n);
+			double f = d.Ipv - (e - d.I0) - (v + i * d.Rs) / d.Rsh - i;
+			double df = -e / n - 1 / d.Rsh;
+
+			double delta = f / df;
+			v -= delta;
+			if (fabs(delta) <= this->options.tolerance) break;
+		}
+
+		curve.voltage[c] = (this->options.bypass_diodes && v < v_clamp) ? v_clamp : v;
+	}
+
+	curve.solved = true;
+}
+
+void PV::PVArray::ComposeString(int string)
+{
+	int steps = this->options.current_steps;
+	double* row = this->string_voltage.data() + (size_t)string * steps;
+	std::fill(row, row + steps, 0.0);
+
+	// Modules at the same condition are added once, scaled by their count
+	std::map<const ModuleCurve*, int> counts;
+	for (int m = 0; m < this->modules_per_string; m++)
+	{
+		counts[&this->curves.at(this->conditions[(size_t)string * this->modules_per_string + m])]++;
+	}
+
+	Simd::Isa isa = Simd::DetectIsa();
+	for (const auto& entry : counts)
+	{
+		Simd::AccumulateScaled(row, entry.first->voltage.data(), (double)entry.second, steps, isa);
+	}
+}
+
+void PV::PVArray::ComposeArray()
+{
+	int current_steps = this->options.current_steps;
+	int voltage_steps = this->options.voltage_steps;
+	double di = this->current_max / (current_steps - 1);
+
+	// The voltage grid ends at the highest string open circuit voltage
+	double v_max = 0;
+	for (int s = 0; s < this->strings; s++) v_max = std::max(v_max, this->string_voltage[(size_t)s * current_steps]);
+
+	this->voltage.resize(voltage_steps);
+	this->current.assign(voltage_steps, 0.0);
+	this->power.resize(voltage_steps);
+	this->peaks.clear();
+
+	double dv = v_max / (voltage_steps - 1);
+	for (int j = 0; j < voltage_steps; j++) this->voltage[j] = j * dv;
+
+	if (!(v_max > 0)) return;
+
+	// Resample every string on the voltage grid, both walk in one direction: V up, I down
+	std::vector<double> string_current(voltage_steps);
+	Simd::Isa isa = Simd::DetectIsa();
+
+	for (int s = 0; s < this->strings; s++)
+	{
+		const double* row = this->string_voltage.data() + (size_t)s * current_steps;
+		int c = current_steps - 1;
+
+		for (int j = 0; j < voltage_steps; j++)
+		{
+			double v = this->voltage[j];
+			if (v >= row[0])
+			{
+				std::fill(string_current.begin() + j, string_current.end(), 0.0);
+				break;
+			}
+			if (v < row[current_steps - 1])
+			{
+				string_current[j] = this->current_max;
+				continue;
+			}
+
+			while (c > 0 && row[c - 1] <= v) c--;
+
+			// row[c - 1] > v >= row[c]
+			double t = (row[c - 1] - v) / (row[c - 1] - row[c]);
+			string_current[j] = di * (c - 1 + t);
+		}
+
+		Simd::AccumulateScaled(this->current.data(), string_current.data(), 1.0, voltage_steps, isa);
+	}
+
+	double p_max = 0;
+	for (int j = 0; j < voltage_steps; j++)
+	{
+		this->power[j] = this->voltage[j] * this->current[j];
+		p_max = std::max(p_max, this->power[j]);
+	}
+
+	// Local maxima, refined with a parabola through the neighbouring points
+	for (int j = 1; j < voltage_steps - 1; j++)
+	{
+		const double* p = this->power.data();
+		if (!(p[j] >= p[j - 1] && p[j] > p[j + 1]) || p[j] < this->options.peak_threshold * p_max) continue;
+
+		double curvature = p[j - 1] - 2 * p[j] + p[j + 1];
+		double offset = (curvature < 0) ? 0.5 * (p[j - 1] - p[j + 1]) / curvature : 0;
+
+		ArrayPeak peak;
+		peak.V = this->voltage[j] + offset * dv;
+		peak.P = p[j] - 0.25 * (p[j - 1] - p[j + 1]) * offset;
+		peak.I = (peak.V > 0) ? peak.P / peak.V : 0;
+		this->peaks.push_back(peak);
+	}
+}
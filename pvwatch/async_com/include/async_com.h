@@ -1,4 +1,110 @@
 #pragma once
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../../ring_buffer/include/ring_buffer.h"
+
+namespace PV
+{
+	class PVModule;
+}
+
+class CaptureRecorder;
+
+/*
+	A received I-V pair
+*/
+struct IVSample
+{
+	double timestamp;	// Seconds
+	double voltage;
+	double current;
+	double power;
+};
+
+typedef SpscRing<IVSample> SampleRing;
+
+/*
+	Trailing history of received samples on the consumer (UI) side, stored as separate
+	V, I, P arrays that can be handed to ImPlot with the Offset() of the oldest sample
+*/
+class SampleHistory
+{
+public:
+	explicit SampleHistory(int depth);
+
+	/*
+		Change the history depth, keeps the newest samples
+	*/
+	void SetDepth(int depth);
+
+	/*
+		Move every pending sample of the ring into the history. Returns the number drained.
+	*/
+	int Drain(SampleRing& ring);
+
+	int Depth(void) const { return this->depth; }
+	int Size(void) const { return this->size; }
+
+	/*
+		Samples appended since the history was created, the newest has the sequence Appended() - 1
+	*/
+	uint64_t Appended(void) const { return this->appended; }
+
+	/*
+		Index of the oldest sample in the arrays
+	*/
+	int Offset(void) const { return (this->size < this->depth) ? 0 : this->next; }
+
+	const double* Voltage(void) const { return this->voltage.data(); }
+	const double* Current(void) const { return this->current.data(); }
+	const double* Power(void) const { return this->power.data(); }
+
+	/*
+		Newest sample, only valid when Size() > 0
+	*/
+	IVSample Latest(void) const { return this->latest; }
+
+private:
+	int depth;
+	int size;
+	int next;
+	uint64_t appended;
+
+	std::vector<double> voltage;
+	std::vector<double> current;
+	std::vector<double> power;
+	std::vector<IVSample> scratch;
+
+	IVSample latest;
+
+	void Append(const IVSample& sample);
+};
+
+/*
+	Shared state of a serial port ingestion thread, owned by the UI. The thread is the
+	only producer of its own sample ring, the UI is the consumer.
+*/
+struct ComStatus
+{
+	std::atomic<bool> stop{ false };		// Set to ask the reader thread to close the port
+	std::atomic<bool> running{ false };		// True while the reader thread is alive
+	std::atomic<bool> connected{ false };
+
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<uint64_t> frames{ 0 };		// Valid binary frames
+	std::atomic<uint64_t> text_lines{ 0 };	// Valid CSV lines
+	std::atomic<uint64_t> crc_errors{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };		// Samples lost because the UI ring was full
+
+	SampleRing samples{ 1 << 17 };
+
+	std::mutex error_mtx;
+	std::string error;
+};
 
 class AsyncCommunication
 {
@@ -6,13 +112,18 @@ public:
 	AsyncCommunication();
 	~AsyncCommunication();
 	/*
-		A method to test Async write
+		A method to test Async write, samples the curves of module into samples until stop is set.
+		The samples also go to recorder when it is recording the test generator (nullptr for none).
 	*/
-	void Test(void);
+	void Test(const PV::PVModule& module, SampleRing& samples, CaptureRecorder* recorder, const std::atomic<bool>& stop);
 
 	/*
-		Get data from a COM port, TODO
+		Get data from a COM port until status->stop is set. Opens the port in raw mode, reads
+		large chunks as they arrive, parses binary frames (or CSV text lines) in place and
+		pushes the samples to status->samples (and to recorder when it is recording the serial
+		port, nullptr for none).
+		Meant to run on its own thread.
 	*/
-	void GetDatafromCOMPort(void);
+	void GetDatafromCOMPort(std::string port, int baud_rate, ComStatus* status, CaptureRecorder* recorder);
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "async_com.h"
+
+/*
+	Binary I-V frame sent by the emulator boards (little endian, 16 bytes)
+
+	offset  size  field
+	0       2     sync word 0xA5 0x5A
+	2       4     timestamp, microseconds (u32, wraps)
+	6       4     voltage, volts as signed Q16.16 fixed point
+	10      4     current, amperes as signed Q16.16 fixed point
+	14      2     CRC-16/CCITT-FALSE of bytes 2..13
+*/
+#define FRAME_SYNC_0 0xA5
+#define FRAME_SYNC_1 0x5A
+#define FRAME_SIZE 16
+#define FRAME_FIXED_POINT_ONE 65536.0
+
+// Longest accepted text line of the CSV fallback
+#define FRAME_MAX_LINE 64
+
+/*
+	CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+*/
+uint16_t FrameCrc16(const uint8_t* data, size_t size);
+
+/*
+	Encode a sample into a binary frame (used by emulators and loopback tests)
+*/
+void EncodeFrame(const IVSample& sample, uint8_t frame[FRAME_SIZE]);
+
+/*
+	Incremental parser of the serial byte stream. Binary frames and CSV text lines
+	("timestamp,voltage,current" or "voltage,current") can be mixed, anything else is
+	skipped byte by byte until the stream is in sync again. Works in place on the
+	caller's buffer and never allocates.
+*/
+class FrameParser
+{
+public:
+	FrameParser();
+
+	/*
+		Parse the complete frames and lines at the start of data.
+		Inputs: data and its size, the output sample array and its size, the host time
+		(seconds) used for text lines without a timestamp
+		Output: the number of samples written, and the bytes consumed. Incomplete trailing
+		frames are left unconsumed for the next call.
+	*/
+	size_t Parse(const uint8_t* data, size_t size, IVSample* out, size_t max_out, size_t* consumed, double host_time);
+
+	uint64_t Frames(void) const { return this->frames; }
+	uint64_t TextLines(void) const { return this->text_lines; }
+	uint64_t CrcErrors(void) const { return this->crc_errors; }
+	uint64_t SkippedBytes(void) const { return this->skipped_bytes; }
+
+private:
+	uint64_t frames;
+	uint64_t text_lines;
+	uint64_t crc_errors;
+	uint64_t skipped_bytes;
+
+	// Unwrapping of the 32 bit microsecond timestamps
+	uint32_t last_raw_timestamp;
+	uint64_t timestamp_epoch;
+	bool has_timestamp;
+
+	double UnwrapTimestamp(uint32_t raw);
+	bool ParseLine(const char* line, size_t length, IVSample& sample, double host_time);
+};
+
+/*
+	Raw serial port, termios on POSIX and the COM API on Windows.
+	The port is opened in raw 8N1 mode without flow control.
+*/
+class SerialPort
+{
+public:
+	SerialPort();
+	~SerialPort();
+
+	SerialPort(const SerialPort&) = delete;
+	SerialPort& operator=(const SerialPort&) = delete;
+
+	/*
+		Open a port (e.g. /dev/ttyUSB0 or COM3) at a baud rate. Returns false on error, see Error().
+	*/
+	bool Open(const std::string& path, int baud_rate);
+
+	void Close(void);
+
+	bool IsOpen(void) const;
+
+	/*
+		Wait up to timeout_ms for data and read what is available (up to size bytes).
+		Returns the bytes read, 0 on timeout and -1 when the port failed or was disconnected.
+	*/
+	int Read(uint8_t* buffer, size_t size, int timeout_ms);
+
+	/*
+		Write all bytes. Returns false on error.
+	*/
+	bool Write(const uint8_t* data, size_t size);
+
+	const std::string& Error(void) const { return this->error; }
+
+private:
+#ifdef _WIN32
+	void* handle;
+#else
+	int fd;
+#endif
+	std::string error;
+};
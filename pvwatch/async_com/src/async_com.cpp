@@ -1,18 +1,75 @@
 #include "../include/async_com.h"
+#include "../include/serial_port.h"
 #include "../../pv/include/pv.h"
+#include "../../pv/include/pv_curve.h"
+#include "../../capture/include/capture.h"
+#include "../../profiler/include/profiler.h"
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <string.h>
 
-// extern std::mutex mtx;
+SampleHistory::SampleHistory(int depth)
+{
+	this->depth = 0;
+	this->size = 0;
+	this->next = 0;
+	this->appended = 0;
+	this->latest = {};
+	this->SetDepth(depth);
+}
+
+void SampleHistory::SetDepth(int depth)
+{
+	depth = (depth > 1) ? depth : 1;
+	if (depth == this->depth) return;
+
+	// Re-linearize the newest samples into the new arrays
+	int keep = (this->size < depth) ? this->size : depth;
+	std::vector<double> v(depth), i(depth), p(depth);
+	for (int n = 0; n < keep; n++)
+	{
+		int src = (this->Offset() + this->size - keep + n) % this->depth;
+		v[n] = this->voltage[src];
+		i[n] = this->current[src];
+		p[n] = this->power[src];
+	}
+
+	this->voltage.swap(v);
+	this->current.swap(i);
+	this->power.swap(p);
+	this->depth = depth;
+	this->size = keep;
+	this->next = keep % depth;
+}
+
+int SampleHistory::Drain(SampleRing& ring)
+{
+	if (this->scratch.size() < 4096) this->scratch.resize(4096);
+
+	int total = 0;
+	size_t n;
+	while ((n = ring.PopBatch(this->scratch.data(), this->scratch.size())) > 0)
+	{
+		for (size_t s = 0; s < n; s++) this->Append(this->scratch[s]);
+		total += (int)n;
+	}
+
+	return total;
+}
 
-extern double rt_v[1];
-extern double rt_i[1];
-extern double rt_p[1];
+void SampleHistory::Append(const IVSample& sample)
+{
+	this->voltage[this->next] = sample.voltage;
+	this->current[this->next] = sample.current;
+	this->power[this->next] = sample.power;
+	this->latest = sample;
+	this->appended++;
 
-// Test if we have acess to PV class
-extern PV::PVModule pvModule; // main PV module handle
+	this->next = (this->next + 1 == this->depth) ? 0 : this->next + 1;
+	if (this->size < this->depth) this->size++;
+}
 
 AsyncCommunication::AsyncCommunication()
 {
@@ -25,26 +82,126 @@ AsyncCommunication::~AsyncCommunication()
 }
 
 
-void AsyncCommunication::Test()
+void AsyncCommunication::Test(const PV::PVModule& module, SampleRing& samples, CaptureRecorder* recorder, const std::atomic<bool>& stop)
 {
-	while (true)
+	auto start = std::chrono::steady_clock::now();
+
+	// Lookup tables of the last published curve in the build precision, the interpolation
+	// policy follows the curve (PCHIP when it has slopes)
+	PV::CurveTable<PV::HilScalar, PV::LinearInterpolation> linear_table;
+	PV::CurveTable<PV::HilScalar, PV::PchipInterpolation> pchip_table;
+	uint64_t table_version = 0;
+	bool pchip = false;
+
+	while (!stop)
 	{
-		for (int i = 0; i < 35 * 4; i++)
+		for (int i = 0; i < 35 * 4 && !stop; i++)
 		{
-			// std::lock_guard<std::mutex> lock(mtx); // FIX MUTEX ISSUE LATER
-			
-			rt_v[0] = (double)i / 4.0;
-			
-			rt_i[0] = pvModule.GetCurrentFromVoltage(rt_v[0]);
+			IVSample sample;
+			sample.timestamp = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			sample.voltage = (double)i / 4.0;
+
+			// The curve may be recalculated by the simulation thread, the tables follow its
+			// pinned snapshots and are only rebuilt when a new one is published
+			{
+				PV::CurvePublisher::Handle curve = module.AcquireSnapshot();
+				if (curve && curve->version != table_version)
+				{
+					pchip = (curve->slope != nullptr);
+					if (pchip) pchip_table.Assign(*curve, 0, module.grid_tolerance);
+					else linear_table.Assign(*curve, 0, module.grid_tolerance);
+					table_version = curve->version;
+				}
+			}
 
-			rt_p[0] = rt_v[0] * rt_i[0];
+			PV::HilScalar voltage = (PV::HilScalar)sample.voltage;
+			if (table_version == 0) sample.current = 0;
+			else sample.current = pchip ? pchip_table.GetCurrentFromVoltage(voltage) : linear_table.GetCurrentFromVoltage(voltage);
+
+			sample.power = sample.voltage * sample.current;
+
+			// V, I and P travel together, the UI never sees a torn pair
+			samples.TryPush(sample);
+			if (recorder != nullptr) recorder->Append(CaptureSource::TestGenerator, &sample, 1);
 
 			std::this_thread::sleep_for(std::chrono::milliseconds(20));
 		}
 	}
 }
 
-void AsyncCommunication::GetDatafromCOMPort()
+void AsyncCommunication::GetDatafromCOMPort(std::string port, int baud_rate, ComStatus* status, CaptureRecorder* recorder)
 {
+	// Byte buffer the reads append to, the parser consumes it in place
+	const size_t buffer_size = 1 << 16;
+	const size_t batch_size = 1024;
+
+	status->running = true;
+
+	SerialPort serial;
+	if (!serial.Open(port, baud_rate))
+	{
+		std::lock_guard<std::mutex> lock(status->error_mtx);
+		status->error = serial.Error();
+		status->running = false;
+		return;
+	}
+
+	status->connected = true;
+
+	std::vector<uint8_t> buffer(buffer_size);
+	std::vector<IVSample> batch(batch_size);
+	size_t filled = 0;
+
+	FrameParser parser;
+	auto start = std::chrono::steady_clock::now();
+
+	while (!status->stop)
+	{
+		int n = serial.Read(buffer.data() + filled, buffer_size - filled, 100);
+		if (n < 0)
+		{
+			std::lock_guard<std::mutex> lock(status->error_mtx);
+			status->error = serial.Error();
+			break;
+		}
+		if (n == 0) continue;
+
+		filled += n;
+		status->bytes += n;
+
+		double host_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Parse everything complete, in batches of samples
+		size_t pos = 0;
+		while (true)
+		{
+			PVWATCH_PROFILE_SCOPE("com.parse_batch");
+
+			size_t consumed = 0;
+			size_t count = parser.Parse(buffer.data() + pos, filled - pos, batch.data(), batch_size, &consumed, host_time);
+			pos += consumed;
+
+			size_t pushed = status->samples.PushBatch(batch.data(), count);
+			status->dropped += count - pushed;
+
+			// The capture keeps every sample, even the ones the UI could not take
+			if (recorder != nullptr) recorder->Append(CaptureSource::SerialPort, batch.data(), count);
+
+			if (count < batch_size) break;
+		}
+
+		// Keep the incomplete tail at the start of the buffer
+		if (pos > 0)
+		{
+			memmove(buffer.data(), buffer.data() + pos, filled - pos);
+			filled -= pos;
+		}
+
+		status->frames = parser.Frames();
+		status->text_lines = parser.TextLines();
+		status->crc_errors = parser.CrcErrors();
+	}
 
+	status->connected = false;
+	status->running = false;
 }
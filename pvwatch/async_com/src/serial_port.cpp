@@ -0,0 +1,446 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "../include/serial_port.h"
+
+namespace
+{
+	inline uint32_t ReadU32(const uint8_t* p)
+	{
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	inline void WriteU32(uint8_t* p, uint32_t value)
+	{
+		p[0] = (uint8_t)value;
+		p[1] = (uint8_t)(value >> 8);
+		p[2] = (uint8_t)(value >> 16);
+		p[3] = (uint8_t)(value >> 24);
+	}
+
+	inline bool IsTextStart(uint8_t c)
+	{
+		return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+	}
+
+	int32_t ToFixedPoint(double value)
+	{
+		double scaled = value * FRAME_FIXED_POINT_ONE;
+		if (scaled > 2147483647.0) scaled = 2147483647.0;
+		if (scaled < -2147483648.0) scaled = -2147483648.0;
+		return (int32_t)((scaled < 0) ? scaled - 0.5 : scaled + 0.5);
+	}
+
+#ifndef _WIN32
+	speed_t BaudConstant(int baud_rate)
+	{
+		switch (baud_rate)
+		{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+#endif
+#ifdef B921600
+		case 921600: return B921600;
+#endif
+		default: return 0;
+		}
+	}
+#endif
+}
+
+uint16_t FrameCrc16(const uint8_t* data, size_t size)
+{
+	uint16_t crc = 0xFFFF;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+void EncodeFrame(const IVSample& sample, uint8_t frame[FRAME_SIZE])
+{
+	frame[0] = FRAME_SYNC_0;
+	frame[1] = FRAME_SYNC_1;
+	WriteU32(frame + 2, (uint32_t)(uint64_t)(sample.timestamp * 1e6 + 0.5));
+	WriteU32(frame + 6, (uint32_t)ToFixedPoint(sample.voltage));
+	WriteU32(frame + 10, (uint32_t)ToFixedPoint(sample.current));
+
+	uint16_t crc = FrameCrc16(frame + 2, 12);
+	frame[14] = (uint8_t)crc;
+	frame[15] = (uint8_t)(crc >> 8);
+}
+
+FrameParser::FrameParser()
+{
+	this->frames = 0;
+	this->text_lines = 0;
+	this->crc_errors = 0;
+	this->skipped_bytes = 0;
+
+	this->last_raw_timestamp = 0;
+	this->timestamp_epoch = 0;
+	this->has_timestamp = false;
+}
+
+size_t FrameParser::Parse(const uint8_t* data, size_t size, IVSample* out, size_t max_out, size_t* consumed, double host_time)
+{
+	size_t pos = 0;
+	size_t count = 0;
+
+	while (pos < size && count < max_out)
+	{
+		uint8_t c = data[pos];
+
+		if (c == FRAME_SYNC_0)
+		{
+			if (size - pos < 2) break;
+
+			if (data[pos + 1] == FRAME_SYNC_1)
+			{
+				if (size - pos < FRAME_SIZE) break;
+
+				const uint8_t* frame = data + pos;
+				uint16_t crc = (uint16_t)(frame[14] | (frame[15] << 8));
+
+				if (FrameCrc16(frame + 2, 12) == crc)
+				{
+					IVSample& sample = out[count++];
+					sample.timestamp = this->UnwrapTimestamp(ReadU32(frame + 2));
+					sample.voltage = (int32_t)ReadU32(frame + 6) / FRAME_FIXED_POINT_ONE;
+					sample.current = (int32_t)ReadU32(frame + 10) / FRAME_FIXED_POINT_ONE;
+					sample.power = sample.voltage * sample.current;
+
+					this->frames++;
+					pos += FRAME_SIZE;
+					continue;
+				}
+
+				// Corrupted frame or a false sync, resync from the next byte
+				this->crc_errors++;
+			}
+		}
+		else if (IsTextStart(c))
+		{
+			const uint8_t* end = (const uint8_t*)memchr(data + pos, '\n', size - pos);
+
+			if (end == nullptr)
+			{
+				// Wait for the rest of the line unless it can't be a valid one
+				if (size - pos < FRAME_MAX_LINE) break;
+			}
+			else
+			{
+				size_t length = end - (data + pos);
+				if (length < FRAME_MAX_LINE && this->ParseLine((const char*)data + pos, length, out[count], host_time))
+				{
+					count++;
+					this->text_lines++;
+					pos += length + 1;
+					continue;
+				}
+			}
+		}
+		else if (c == '\n' || c == '\r')
+		{
+			pos++;
+			continue;
+		}
+
+		this->skipped_bytes++;
+		pos++;
+	}
+
+	*consumed = pos;
+	return count;
+}
+
+double FrameParser::UnwrapTimestamp(uint32_t raw)
+{
+	if (this->has_timestamp && raw < this->last_raw_timestamp) this->timestamp_epoch++;
+
+	this->last_raw_timestamp = raw;
+	this->has_timestamp = true;
+
+	return (double)((this->timestamp_epoch << 32) | raw) * 1e-6;
+}
+
+bool FrameParser::ParseLine(const char* line, size_t length, IVSample& sample, double host_time)
+{
+	// Local null terminated copy for strtod, the line is short
+	char text[FRAME_MAX_LINE];
+	memcpy(text, line, length);
+	text[length] = '\0';
+
+	double values[3];
+	int fields = 0;
+	char* cursor = text;
+
+	while (fields < 3)
+	{
+		char* end;
+		values[fields] = strtod(cursor, &end);
+		if (end == cursor) return false;
+		fields++;
+
+		while (*end == ' ' || *end == '\t' || *end == '\r') end++;
+		if (*end == '\0') break;
+		if (*end != ',' && *end != ';') return false;
+		cursor = end + 1;
+	}
+
+	if (fields == 3)
+	{
+		sample.timestamp = values[0];
+		sample.voltage = values[1];
+		sample.current = values[2];
+	}
+	else if (fields == 2)
+	{
+		sample.timestamp = host_time;
+		sample.voltage = values[0];
+		sample.current = values[1];
+	}
+	else
+	{
+		return false;
+	}
+
+	sample.power = sample.voltage * sample.current;
+	return true;
+}
+
+#ifdef _WIN32
+
+SerialPort::SerialPort()
+{
+	this->handle = INVALID_HANDLE_VALUE;
+}
+
+SerialPort::~SerialPort()
+{
+	this->Close();
+}
+
+bool SerialPort::Open(const std::string& path, int baud_rate)
+{
+	this->Close();
+
+	// COM10 and above need the device namespace prefix
+	std::string device = (path.rfind("\\\\.\\", 0) == 0) ? path : "\\\\.\\" + path;
+	HANDLE h = CreateFileA(device.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (h == INVALID_HANDLE_VALUE)
+	{
+		this->error = "Cannot open " + path;
+		return false;
+	}
+
+	DCB dcb = {};
+	dcb.DCBlength = sizeof(dcb);
+	GetCommState(h, &dcb);
+	dcb.BaudRate = (DWORD)baud_rate;
+	dcb.ByteSize = 8;
+	dcb.Parity = NOPARITY;
+	dcb.StopBits = ONESTOPBIT;
+	dcb.fBinary = TRUE;
+	dcb.fOutxCtsFlow = FALSE;
+	dcb.fRtsControl = RTS_CONTROL_ENABLE;
+	dcb.fDtrControl = DTR_CONTROL_ENABLE;
+	dcb.fOutX = FALSE;
+	dcb.fInX = FALSE;
+
+	if (!SetCommState(h, &dcb))
+	{
+		CloseHandle(h);
+		this->error = "Unsupported settings for " + path;
+		return false;
+	}
+
+	SetupComm(h, 1 << 16, 1 << 12);
+	this->handle = h;
+	return true;
+}
+
+void SerialPort::Close()
+{
+	if (this->handle != INVALID_HANDLE_VALUE) CloseHandle((HANDLE)this->handle);
+	this->handle = INVALID_HANDLE_VALUE;
+}
+
+bool SerialPort::IsOpen() const
+{
+	return this->handle != INVALID_HANDLE_VALUE;
+}
+
+int SerialPort::Read(uint8_t* buffer, size_t size, int timeout_ms)
+{
+	if (!this->IsOpen()) return -1;
+
+	// Return as soon as any data arrived, or after the timeout
+	COMMTIMEOUTS timeouts = {};
+	timeouts.ReadIntervalTimeout = MAXDWORD;
+	timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+	timeouts.ReadTotalTimeoutConstant = (DWORD)timeout_ms;
+	SetCommTimeouts((HANDLE)this->handle, &timeouts);
+
+	DWORD read = 0;
+	if (!ReadFile((HANDLE)this->handle, buffer, (DWORD)size, &read, nullptr))
+	{
+		this->error = "Read failed";
+		return -1;
+	}
+
+	return (int)read;
+}
+
+bool SerialPort::Write(const uint8_t* data, size_t size)
+{
+	DWORD written = 0;
+	return this->IsOpen() && WriteFile((HANDLE)this->handle, data, (DWORD)size, &written, nullptr) && written == size;
+}
+
+#else
+
+SerialPort::SerialPort()
+{
+	this->fd = -1;
+}
+
+SerialPort::~SerialPort()
+{
+	this->Close();
+}
+
+bool SerialPort::Open(const std::string& path, int baud_rate)
+{
+	this->Close();
+
+	speed_t speed = BaudConstant(baud_rate);
+	if (speed == 0)
+	{
+		this->error = "Unsupported baud rate " + std::to_string(baud_rate);
+		return false;
+	}
+
+	int handle = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (handle < 0)
+	{
+		this->error = "Cannot open " + path + ": " + strerror(errno);
+		return false;
+	}
+
+	termios tty;
+	if (tcgetattr(handle, &tty) != 0)
+	{
+		this->error = path + " is not a serial port: " + strerror(errno);
+		close(handle);
+		return false;
+	}
+
+	// Raw 8N1, no flow control, reads return whatever is available
+	cfmakeraw(&tty);
+	tty.c_cflag |= CLOCAL | CREAD;
+	tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = 0;
+	cfsetispeed(&tty, speed);
+	cfsetospeed(&tty, speed);
+
+	if (tcsetattr(handle, TCSANOW, &tty) != 0)
+	{
+		this->error = "Cannot configure " + path + ": " + strerror(errno);
+		close(handle);
+		return false;
+	}
+
+	tcflush(handle, TCIFLUSH);
+	this->fd = handle;
+	return true;
+}
+
+void SerialPort::Close()
+{
+	if (this->fd >= 0) close(this->fd);
+	this->fd = -1;
+}
+
+bool SerialPort::IsOpen() const
+{
+	return this->fd >= 0;
+}
+
+int SerialPort::Read(uint8_t* buffer, size_t size, int timeout_ms)
+{
+	if (!this->IsOpen()) return -1;
+
+	pollfd pfd = { this->fd, POLLIN, 0 };
+	int ready = poll(&pfd, 1, timeout_ms);
+
+	if (ready < 0) return (errno == EINTR) ? 0 : -1;
+	if (ready == 0) return 0;
+
+	// Hang up without data left means the device went away
+	if ((pfd.revents & (POLLERR | POLLNVAL)) || ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN)))
+	{
+		this->error = "Device disconnected";
+		return -1;
+	}
+
+	ssize_t n = read(this->fd, buffer, size);
+	if (n < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR) return 0;
+		this->error = std::string("Read failed: ") + strerror(errno);
+		return -1;
+	}
+
+	return (int)n;
+}
+
+bool SerialPort::Write(const uint8_t* data, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size)
+	{
+		ssize_t n = write(this->fd, data + done, size - done);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+			{
+				pollfd pfd = { this->fd, POLLOUT, 0 };
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			return false;
+		}
+		done += (size_t)n;
+	}
+
+	return true;
+}
+
+#endif
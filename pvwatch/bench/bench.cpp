@@ -0,0 +1,883 @@
+/*
+	Headless benchmarks of the PV core, without the App window or any GUI library.
+
+	Usage: bench [--rate Hz] [--duration s] [--min-time s] [--json path]
+
+	Every case runs for at least --min-time after its warm up calls and reports the time per
+	call, per curve point and the heap allocations per call (every operator new of the process).
+	--json writes the same results in a machine readable form for comparing runs.
+*/
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "../pv/include/pv.h"
+#include "../pv/include/pv_curve.h"
+#include "../array/include/array.h"
+#include "../mppt/include/mppt.h"
+#include "../fit/include/fit.h"
+#include "../fleet/include/fleet.h"
+#include "../plot_lod/include/plot_lod.h"
+#include "../yield/include/yield.h"
+#include "../profiler/include/profiler.h"
+
+namespace
+{
+	// Heap allocations of the whole process, from any thread
+	std::atomic<long long> allocations(0);
+
+	void* CountedAllocate(size_t size, size_t alignment)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		size = (size > 0) ? size : 1;
+#ifdef _WIN32
+		void* p = (alignment > 0) ? _aligned_malloc(size, alignment) : malloc(size);
+#else
+		// aligned_alloc wants a multiple of the alignment
+		void* p = (alignment > 0) ? aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : malloc(size);
+#endif
+		if (p == nullptr) throw std::bad_alloc();
+		return p;
+	}
+
+	void CountedFree(void* p, size_t alignment)
+	{
+#ifdef _WIN32
+		if (alignment > 0)
+		{
+			_aligned_free(p);
+			return;
+		}
+#endif
+		(void)alignment;
+		free(p);
+	}
+}
+
+void* operator new(size_t size) { return CountedAllocate(size, 0); }
+void* operator new[](size_t size) { return CountedAllocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return CountedAllocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return CountedAllocate(size, (size_t)alignment); }
+
+void operator delete(void* p) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+
+namespace
+{
+	struct BenchOptions
+	{
+		double rate = 50e3;
+		double duration = 60;
+		double min_time = 0.25;
+		std::string json_path;
+	};
+
+	/*
+		Result of one benchmark case
+	*/
+	struct BenchResult
+	{
+		std::string group;
+		std::string name;
+		int steps;					// Curve points per calculation (0 when not applicable)
+		int iterations;				// Iteration limit of the solver (0 when not applicable)
+		long long calls;
+		long long points;			// Points solved or looked up over all calls
+		double seconds;
+		double ns_per_call;
+		double ns_per_point;
+		double allocations_per_call;
+	};
+
+	std::vector<BenchResult> results;
+
+	/*
+		Run the case once per snapshot slot to warm up (every slot holds a curve), then
+		repeatedly until min_time elapsed.
+		points_per_call is the work of a single call in curve points.
+	*/
+	BenchResult Measure(const std::string& group, const std::string& name, int steps, int iterations,
+		long long points_per_call, double min_time, const std::function<void(void)>& call)
+	{
+		for (int i = 0; i < PV::CurvePublisher::SNAPSHOT_SLOTS; i++) call();
+
+		long long start_allocations = allocations.load();
+		auto start = std::chrono::steady_clock::now();
+		double seconds = 0;
+		long long calls = 0;
+
+		// Batches of calls keep the clock reads out of the measurement
+		for (long long batch = 1; seconds < min_time; batch = (batch < (1 << 20)) ? 2 * batch : batch)
+		{
+			for (long long i = 0; i < batch; i++) call();
+			calls += batch;
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		// Before the result strings allocate
+		long long call_allocations = allocations.load() - start_allocations;
+
+		BenchResult result;
+		result.group = group;
+		result.name = name;
+		result.steps = steps;
+		result.iterations = iterations;
+		result.calls = calls;
+		result.points = calls * points_per_call;
+		result.seconds = seconds;
+		result.ns_per_call = 1e9 * seconds / calls;
+		result.ns_per_point = (points_per_call > 0) ? result.ns_per_call / points_per_call : 0;
+		result.allocations_per_call = (double)call_allocations / calls;
+
+		printf("  %-36s %12.1f ns/call %10.2f ns/point %8.3f allocs/call\n",
+			name.c_str(), result.ns_per_call, result.ns_per_point, result.allocations_per_call);
+
+		results.push_back(result);
+		return result;
+	}
+
+	bool ParseArguments(int argc, char** argv, BenchOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) options.rate = atof(argv[++i]);
+			else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) options.duration = atof(argv[++i]);
+			else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) options.min_time = atof(argv[++i]);
+			else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) options.json_path = argv[++i];
+			else
+			{
+				fprintf(stderr, "Usage: %s [--rate Hz] [--duration s] [--min-time s] [--json path]\n", argv[0]);
+				return false;
+			}
+		}
+
+		return options.rate > 0 && options.duration > 0 && options.min_time >= 0;
+	}
+
+	const char* SolverName(PV::SolverMethod method)
+	{
+		switch (method)
+		{
+		case PV::SolverMethod::FixedPoint: return "fixed_point";
+		case PV::SolverMethod::Newton: return "newton";
+		case PV::SolverMethod::LambertW: return "lambert_w";
+		}
+		return "unknown";
+	}
+
+	/*
+		CalculateIVPArrays at the nominal condition, per solver over step and iteration counts.
+		Every call is a cold solve, warm starts are measured by the sweeps.
+	*/
+	void BenchCurveSolve(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		const PV::SolverMethod methods[] = { PV::SolverMethod::FixedPoint, PV::SolverMethod::Newton, PV::SolverMethod::LambertW };
+		const int step_counts[] = { 50, 200, 1000, 5000 };
+		const int iteration_counts[] = { 10, 50 };
+
+		printf("Curve solve (CalculateIVPArrays)\n");
+		for (PV::SolverMethod method : methods)
+		{
+			for (int steps : step_counts)
+			{
+				for (int iterations : iteration_counts)
+				{
+					PV::PVModule module;
+					module.solver_method = method;
+					module.warm_start = false;
+
+					std::string name = std::string(SolverName(method)) + " steps=" + std::to_string(steps) + " iters=" + std::to_string(iterations);
+					Measure("curve_solve", name, steps, iterations, steps, bench.min_time, [&]()
+					{
+						module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, steps, iterations);
+					});
+				}
+			}
+		}
+
+		// Adaptive grids, the points follow the error bound (steps only caps them)
+		const double grid_tolerances[] = { 1e-4, 1e-6 };
+		for (PV::InterpolationMode mode : { PV::InterpolationMode::Linear, PV::InterpolationMode::Pchip })
+		{
+			for (double grid_tolerance : grid_tolerances)
+			{
+				PV::PVModule module;
+				module.interpolation_mode = mode;
+				module.grid_mode = PV::GridMode::Adaptive;
+				module.grid_tolerance = grid_tolerance;
+				module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, 100000, PV::ITERS_nominal);
+
+				char name[96];
+				snprintf(name, sizeof(name), "adaptive %s error=%.0e points=%d", (mode == PV::InterpolationMode::Pchip) ? "pchip" : "linear",
+					grid_tolerance, module.steps);
+				Measure("curve_solve", name, module.steps, PV::ITERS_nominal, module.steps, bench.min_time, [&]()
+				{
+					module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, 100000, PV::ITERS_nominal);
+				});
+			}
+		}
+	}
+
+	/*
+		Batch lookups of a module curve rounded into a float or double CurveTable
+	*/
+	template <typename Scalar, typename Interpolation>
+	void BenchCurveTable(PV::PVModule& module, const char* mode_name, const std::vector<double>& voltages, const BenchOptions& bench)
+	{
+		PV::CurveTable<Scalar, Interpolation> table;
+		table.Assign(module);
+
+		int batch = (int)voltages.size();
+		std::vector<Scalar> table_voltages(voltages.begin(), voltages.end());
+		std::vector<Scalar> table_currents(batch);
+
+		std::string name = std::string(mode_name) + (sizeof(Scalar) == sizeof(float) ? " float" : " double") +
+			" table steps=" + std::to_string(table.Steps()) + " " + std::to_string(table.Bytes()) + "B";
+		Measure("lookup_batch", name, table.Steps(), 0, batch, bench.min_time, [&]()
+		{
+			table.GetCurrentFromVoltage(table_voltages.data(), table_currents.data(), batch);
+		});
+	}
+
+	/*
+		Batch lookups of a CurveTable resampled from the snapshot of an adaptive curve (the HIL
+		lookup path), with its error against a dense uniform curve of the model
+	*/
+	template <typename Scalar, typename Interpolation>
+	void BenchAdaptiveTable(PV::PVModule& module, PV::PVModule& reference, const char* mode_name,
+		const std::vector<double>& voltages, const BenchOptions& bench)
+	{
+		PV::CurveTable<Scalar, Interpolation> table;
+		{
+			PV::CurvePublisher::Handle curve = module.AcquireSnapshot();
+			table.Assign(*curve, 0, module.grid_tolerance);
+		}
+
+		int batch = (int)voltages.size();
+		std::vector<Scalar> table_voltages(voltages.begin(), voltages.end());
+		std::vector<Scalar> table_currents(batch);
+
+		double error = 0;
+		table.GetCurrentFromVoltage(table_voltages.data(), table_currents.data(), batch);
+		for (int i = 0; i < batch; i++) error = std::max(error, fabs((double)table_currents[i] - reference.GetCurrentFromVoltage((double)table_voltages[i])));
+
+		char error_text[32];
+		snprintf(error_text, sizeof(error_text), " err=%.1e", error);
+
+		std::string name = std::string(mode_name) + " adaptive" + (sizeof(Scalar) == sizeof(float) ? " float" : " double") +
+			" table steps=" + std::to_string(table.Steps()) + " " + std::to_string(table.Bytes()) + "B" + error_text;
+		Measure("lookup_batch", name, table.Steps(), 0, batch, bench.min_time, [&]()
+		{
+			table.GetCurrentFromVoltage(table_voltages.data(), table_currents.data(), batch);
+		});
+	}
+
+	/*
+		GetCurrentFromVoltage on a solved curve, one voltage per call and in batches, and on CurveTable copies
+	*/
+	void BenchLookup(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		const PV::InterpolationMode modes[] = { PV::InterpolationMode::Linear, PV::InterpolationMode::Pchip };
+		const int step_counts[] = { 200, 5000 };
+		const int batch = 4096;
+
+		// Random voltages over the whole curve, the lookups don't run in grid order
+		std::vector<double> voltages(batch);
+		std::vector<double> currents(batch);
+		std::mt19937 generator(12345);
+		std::uniform_real_distribution<double> distribution(0.0, params.Voc_nom);
+		for (double& voltage : voltages) voltage = distribution(generator);
+
+		printf("Current lookup (GetCurrentFromVoltage)\n");
+		for (PV::InterpolationMode mode : modes)
+		{
+			const char* mode_name = (mode == PV::InterpolationMode::Pchip) ? "pchip" : "linear";
+
+			for (int steps : step_counts)
+			{
+				PV::PVModule module;
+				module.interpolation_mode = mode;
+				module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, steps, PV::ITERS_nominal);
+
+				size_t next = 0;
+				volatile double sink = 0;
+				Measure("lookup_single", std::string(mode_name) + " single steps=" + std::to_string(steps), steps, 0, 1, bench.min_time, [&]()
+				{
+					sink = sink + module.GetCurrentFromVoltage(voltages[next]);
+					next = (next + 1) % batch;
+				});
+
+				Measure("lookup_batch", std::string(mode_name) + " batch=" + std::to_string(batch) + " steps=" + std::to_string(steps), steps, 0, batch, bench.min_time, [&]()
+				{
+					module.GetCurrentFromVoltage(voltages.data(), currents.data(), batch);
+				});
+
+				if (mode == PV::InterpolationMode::Pchip)
+				{
+					BenchCurveTable<double, PV::PchipInterpolation>(module, mode_name, voltages, bench);
+					BenchCurveTable<float, PV::PchipInterpolation>(module, mode_name, voltages, bench);
+				}
+				else
+				{
+					BenchCurveTable<double, PV::LinearInterpolation>(module, mode_name, voltages, bench);
+					BenchCurveTable<float, PV::LinearInterpolation>(module, mode_name, voltages, bench);
+				}
+			}
+
+			// Adaptive grid of the same error as 1000 uniform points, binary searched
+			PV::PVModule module;
+			module.interpolation_mode = mode;
+			module.grid_mode = PV::GridMode::Adaptive;
+			module.grid_tolerance = (mode == PV::InterpolationMode::Pchip) ? 1e-6 : 1e-4;
+			module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, 100000, PV::ITERS_nominal);
+
+			Measure("lookup_batch", std::string(mode_name) + " adaptive batch=" + std::to_string(batch) + " points=" + std::to_string(module.steps),
+				module.steps, 0, batch, bench.min_time, [&]()
+			{
+				module.GetCurrentFromVoltage(voltages.data(), currents.data(), batch);
+			});
+
+			// Its HIL tables, against the model on a dense uniform grid
+			PV::PVModule reference;
+			reference.interpolation_mode = PV::InterpolationMode::Pchip;
+			reference.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, 100000, PV::ITERS_nominal);
+
+			if (mode == PV::InterpolationMode::Pchip)
+			{
+				BenchAdaptiveTable<double, PV::PchipInterpolation>(module, reference, mode_name, voltages, bench);
+				BenchAdaptiveTable<float, PV::PchipInterpolation>(module, reference, mode_name, voltages, bench);
+			}
+			else
+			{
+				BenchAdaptiveTable<double, PV::LinearInterpolation>(module, reference, mode_name, voltages, bench);
+				BenchAdaptiveTable<float, PV::LinearInterpolation>(module, reference, mode_name, voltages, bench);
+			}
+		}
+	}
+
+	/*
+		Full Simulator sweeps (800 -> 1000 W/m2, 25 -> 40 C) on a virtual clock, stepped as fast as
+		the curves are solved (MaxSpeed) or solved up front on all cores (Precomputed), with every
+		curve warm started from the previous steps and cold. Then the same sweep of several modules
+		at once, one simulator per module.
+	*/
+	void BenchSweep(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		const int sweep_steps = 1000;
+		const int curve_steps[] = { 200, 1000 };
+
+		printf("Simulator sweep, %d steps\n", sweep_steps);
+		for (int steps : curve_steps)
+		{
+			for (bool warm_start : { true, false })
+			{
+				// The simulator reads the model, the step count and the settings of its module
+				PV::VirtualClock clock(0);
+				PV::Simulator simulator;
+				simulator.SetClock(&clock);
+				simulator.Module().warm_start = warm_start;
+				simulator.Module().CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, steps, PV::ITERS_nominal);
+
+				std::string suffix = std::string(warm_start ? " warm" : " cold") + " steps=" + std::to_string(steps);
+
+				simulator.mode = PV::SimulationMode::MaxSpeed;
+				Measure("sweep", "max_speed" + suffix, steps, PV::ITERS_nominal, (long long)(sweep_steps + 1) * steps, bench.min_time, [&]()
+				{
+					simulator.Simulation(800, 1000, 25, 40, 10, sweep_steps);
+				});
+
+				// Newton iterations per point of the last step, about one correction when the warm start works
+				PV::SolverStats stats = simulator.Module().GetSolverStats();
+				printf("  %-36s %12.2f iterations/point\n", "", (double)stats.total_iterations / std::max(stats.points, 1));
+
+				// A zero duration plays the precomputed curves back without waiting
+				simulator.mode = PV::SimulationMode::Precomputed;
+				Measure("sweep", "precomputed" + suffix, steps, PV::ITERS_nominal, (long long)(sweep_steps + 1) * steps, bench.min_time, [&]()
+				{
+					simulator.Simulation(800, 1000, 25, 40, 0, sweep_steps);
+				});
+			}
+		}
+
+		// Modules of a comparison, the datasheet scaled by up to +-10 %, each swept on its own thread
+		const int modules = std::max(1, std::min((int)std::thread::hardware_concurrency(), 8));
+		std::vector<std::unique_ptr<PV::Simulator>> simulators;
+		for (int m = 0; m < modules; m++)
+		{
+			double scale = 0.9 + 0.2 * m / std::max(modules - 1, 1);
+			PV::Simulator* simulator = new PV::Simulator();
+			simulator->mode = PV::SimulationMode::MaxSpeed;
+			simulator->Module().CalculateIVPArrays((float)(scale * params.Voc_nom), (float)(scale * params.Isc_nom), (float)(scale * params.Vmp_nom),
+				(float)(scale * params.Imp_nom), PV::G_nominal, PV::T_nominal, 200, PV::ITERS_nominal);
+			simulators.emplace_back(simulator);
+		}
+
+		Measure("sweep", "concurrent modules=" + std::to_string(modules), 200, PV::ITERS_nominal, (long long)modules * (sweep_steps + 1) * 200, bench.min_time, [&]()
+		{
+			std::vector<std::thread> threads;
+			for (auto& simulator : simulators)
+			{
+				threads.emplace_back([&simulator, sweep_steps]() { simulator->Simulation(800, 1000, 25, 40, 10, sweep_steps); });
+			}
+			for (std::thread& thread : threads) thread.join();
+		});
+	}
+
+	std::string JsonEscape(const std::string& text)
+	{
+		std::string escaped;
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\') escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	bool WriteJson(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (file == nullptr) return false;
+
+		fprintf(file, "{\n  \"isa\": \"%s\",\n  \"results\": [\n", (PV::Simd::DetectIsa() == PV::Simd::Isa::AVX2) ? "avx2" : "scalar");
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchResult& result = results[i];
+			fprintf(file, "    {\"group\": \"%s\", \"name\": \"%s\", \"steps\": %d, \"iterations\": %d, \"calls\": %lld, \"points\": %lld, "
+				"\"seconds\": %.6f, \"ns_per_call\": %.3f, \"ns_per_point\": %.4f, \"allocations_per_call\": %.6f}%s\n",
+				JsonEscape(result.group).c_str(), JsonEscape(result.name).c_str(), result.steps, result.iterations, result.calls, result.points,
+				result.seconds, result.ns_per_call, result.ns_per_point, result.allocations_per_call, (i + 1 < results.size()) ? "," : "");
+		}
+		fprintf(file, "  ]\n}\n");
+
+		return fclose(file) == 0;
+	}
+
+	/*
+		A 25 x 40 array (25 modules per string, 40 strings): the full solve of a partially shaded
+		array, then a cloud edge moving over one module, which solves one module curve and sums
+		its string again. Returns false when the shaded string doesn't give several P-V peaks.
+	*/
+	bool BenchArray(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		const int modules_per_string = 25;
+		const int strings = 40;
+		const int shaded_modules = 8;
+		const int points = PV::ArrayOptions().voltage_steps;
+
+		// A third of the first string behind a shadow
+		auto shade = [&](PV::PVArray& array)
+		{
+			for (int m = 0; m < shaded_modules; m++) array.SetCondition(0, m, 300, 30);
+		};
+
+		printf("Array (PVArray), %d x %d modules\n", modules_per_string, strings);
+		Measure("array", "full solve shaded modules=" + std::to_string(modules_per_string * strings), points, 0, points, bench.min_time, [&]()
+		{
+			PV::PVArray array(params, modules_per_string, strings);
+			shade(array);
+			array.Calculate();
+		});
+
+		PV::PVArray array(params, modules_per_string, strings);
+		shade(array);
+		array.Calculate();
+
+		int update = 0;
+		Measure("array", "update one module", points, 0, points, bench.min_time, [&]()
+		{
+			// A new irradiance every call, the curve of the previous one is dropped
+			array.SetCondition(1, 0, 400 + (update++ % 500), 25);
+			array.Calculate();
+		});
+
+		PV::ArrayStats stats = array.GetStats();
+		PV::ArrayPeak mpp = array.MaxPowerPoint();
+		printf("  %-36s %d curves solved, %d strings summed, %d peaks, MPP %.0f W at %.1f V\n", "", stats.curves_computed,
+			stats.strings_composed, (int)array.Peaks().size(), mpp.P, mpp.V);
+
+		// Only the shaded string, its bypass diodes give a step in the I-V curve and two power peaks
+		PV::PVArray string(params, modules_per_string, 1);
+		shade(string);
+		string.Calculate();
+
+		bool peaks = string.Peaks().size() > 1;
+		printf("  %-36s %d peaks of the shaded string alone\n", "", (int)string.Peaks().size());
+		if (!peaks) fprintf(stderr, "The shaded string has %d P-V peak(s), expected more than one\n", (int)string.Peaks().size());
+		return peaks;
+	}
+
+	/*
+		Energy yield of a site-year of 1 minute records (clear sky days with passing clouds), from a
+		binary and a CSV weather file written next to the bench and removed afterwards
+	*/
+	void BenchYield(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		const int records = 365 * 24 * 60;
+		const std::string binary_path = "pvwatch_bench_weather.bin";
+		const std::string text_path = "pvwatch_bench_weather.csv";
+		const double pi = acos(-1.0);
+
+		PV::WeatherWriter writer;
+		FILE* text = fopen(text_path.c_str(), "w");
+		if (!writer.Open(binary_path) || text == nullptr)
+		{
+			fprintf(stderr, "Cannot write the weather files of the yield case\n");
+			if (text != nullptr) fclose(text);
+			return;
+		}
+
+		std::mt19937 generator(12345);
+		std::uniform_real_distribution<double> cloud(0.0, 1.0);
+		double clouds = 1;
+		for (int i = 0; i < records; i++)
+		{
+			PV::WeatherRecord record;
+			record.timestamp = 60.0 * i;
+
+			// Half a sine from 6 to 18 h, the clouds change every 10 minutes
+			double hour = fmod(record.timestamp / 3600.0, 24.0);
+			if (i % 10 == 0) clouds = (cloud(generator) < 0.3) ? 0.2 + 0.6 * cloud(generator) : 1;
+			record.G = (hour > 6 && hour < 18) ? 1000 * sin(pi * (hour - 6) / 12) * clouds : 0;
+			record.T = 15 + 0.025 * record.G;
+
+			writer.Write(&record, 1);
+			fprintf(text, "%.0f,%.1f,%.2f\n", record.timestamp, record.G, record.T);
+		}
+		writer.Close();
+		fclose(text);
+
+		printf("Energy yield, %d records (a site-year of 1 minute data)\n", records);
+		const std::pair<const char*, std::string> files[] = { { "binary", binary_path }, { "csv", text_path } };
+		for (const auto& file : files)
+		{
+			PV::YieldOptions options;
+			PV::YieldResult result = {};
+			Measure("yield", std::string("site-year ") + file.first, 0, 0, records, bench.min_time, [&]()
+			{
+				result = PV::RunYield(params, file.second, options);
+			});
+
+			printf("  %-36s %.1f kWh, %d daily bins, PR %.3f\n", "", result.energy / 1000, (int)result.bins.size(), result.performance_ratio);
+		}
+
+		remove(binary_path.c_str());
+		remove(text_path.c_str());
+	}
+
+	/*
+		Levenberg-Marquardt fits of a module to noisy samples of a degraded curve (Rs x1.5, Rsh x0.5,
+		Ipv x0.95), from the datasheet model and incrementally after 50 new samples
+	*/
+	void BenchFit(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		const int samples = 2000;
+		const int new_samples = 50;
+		const double g = 850;
+		const double t_e = 35;
+
+		PV::Simd::DiodeParameters truth = PV::DiodeAtCondition(params, g, t_e);
+		truth.Rs *= 1.5;
+		truth.Rsh *= 0.5;
+		truth.Ipv *= 0.95;
+
+		// Twice the samples, the incremental refits cycle through them
+		std::vector<double> voltages(2 * samples);
+		std::vector<double> currents(2 * samples);
+		std::mt19937 generator(12345);
+		std::uniform_real_distribution<double> voltage_distribution(0.0, truth.a_vt * log(truth.Ipv / truth.I0 + 1));
+		std::normal_distribution<double> noise(0.0, 0.005);
+		for (int i = 0; i < 2 * samples; i++)
+		{
+			voltages[i] = voltage_distribution(generator);
+			currents[i] = PV::SolveCurrent(truth, voltages[i], truth.Ipv) + noise(generator);
+		}
+
+		PV::FitOptions options;
+		options.max_samples = samples;
+
+		printf("Model fit (DiodeFitter), %d samples\n", samples);
+		Measure("fit", "datasheet start samples=" + std::to_string(samples), 0, 0, samples, bench.min_time, [&]()
+		{
+			PV::DiodeFitter fitter(params, g, t_e, options);
+			fitter.AddSamples(voltages.data(), currents.data(), samples);
+			fitter.Refit();
+		});
+
+		PV::DiodeFitter fitter(params, g, t_e, options);
+		fitter.AddSamples(voltages.data(), currents.data(), samples);
+		fitter.Refit();
+
+		int next = samples;
+		Measure("fit", "incremental +" + std::to_string(new_samples) + " samples=" + std::to_string(samples), 0, 0, samples, bench.min_time, [&]()
+		{
+			fitter.AddSamples(voltages.data() + next, currents.data() + next, new_samples);
+			fitter.Refit();
+			next = (next + 2 * new_samples <= 2 * samples) ? next + new_samples : 0;
+		});
+
+		PV::DegradationReport report = fitter.GetReport();
+		printf("  %-36s Rs x%.3f  Rsh x%.3f  Pmax x%.4f  rmse %.4f A  %d iterations\n", "", report.rs_ratio, report.rsh_ratio,
+			report.power_ratio, report.fit.rmse, report.fit.iterations);
+	}
+
+	/*
+		One evaluation tick of a fleet of 10k modules (three datasheets) reporting operating points
+		around their maximum power point, 1% of them losing a fifth of their current
+	*/
+	void BenchFleet(const BenchOptions& bench)
+	{
+		const int modules = 10000;
+
+		PV::ModelParameters datasheets[] = {
+			PV::ExtractModelParameters(35.0f, 9.0f, 30.0f, 8.5f, PV::ITERS_nominal),
+			PV::ExtractModelParameters(44.0f, 9.5f, 37.0f, 9.0f, PV::ITERS_nominal),
+			PV::ExtractModelParameters(21.6f, 5.6f, 17.6f, 5.1f, PV::ITERS_nominal)
+		};
+
+		PV::Fleet fleet;
+		fleet.Reserve(modules);
+
+		std::vector<double> voltages(modules), currents(modules), irradiances(modules), temperatures(modules);
+		std::mt19937 generator(12345);
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		std::normal_distribution<double> noise(0.0, 0.01);
+		for (int i = 0; i < modules; i++)
+		{
+			const PV::ModelParameters& params = datasheets[i % 3];
+			fleet.Add(params);
+
+			irradiances[i] = 600 + 400 * uniform(generator);
+			temperatures[i] = 20 + 30 * uniform(generator);
+			voltages[i] = params.Vmp_nom * (0.7 + 0.3 * uniform(generator));
+
+			PV::Simd::DiodeParameters diode = PV::DiodeAtCondition(params, irradiances[i], temperatures[i]);
+			double current = PV::SolveCurrent(diode, voltages[i], diode.Ipv);
+			currents[i] = ((i % 100 == 7) ? 0.8 * current : current) + noise(generator);
+		}
+
+		printf("Fleet (SoA), %d modules\n", modules);
+		for (int threads : { 1, 0 })
+		{
+			PV::FleetOptions options;
+			options.threads = threads;
+
+			Measure("fleet", "evaluate threads=" + std::string(threads ? std::to_string(threads) : "all"), 0, PV::ITERS_nominal, modules, bench.min_time, [&]()
+			{
+				fleet.SetOperatingPoints(voltages.data(), currents.data(), irradiances.data(), temperatures.data());
+				fleet.Evaluate(options);
+			});
+		}
+
+		const PV::FleetStats& stats = fleet.GetStats();
+		printf("  %-36s %d outliers of %d modules  %.2f iterations/module  residual scale %.4f\n", "", stats.outliers, stats.modules,
+			(double)stats.total_iterations / stats.modules, stats.residual_scale);
+	}
+
+	/*
+		Decimation of a 1M point curve and of a 4M sample history to a 1600 x 900 plot: a new curve,
+		an unchanged frame, a zoomed view, and a history receiving 5000 samples per frame
+	*/
+	void BenchPlotLod(const BenchOptions& bench)
+	{
+		const int curve_points = 1 << 20;
+		const int history = 1 << 22;
+		const int appended = 5000;
+		const PlotView view = { 0, 38.5, 0, 10, 1600, 900 };
+
+		std::vector<double> voltages(curve_points), currents(curve_points);
+		for (int i = 0; i < curve_points; i++)
+		{
+			voltages[i] = 35.0 * i / (curve_points - 1);
+			currents[i] = 9 * (1 - exp((voltages[i] - 35) / 1.5));
+		}
+
+		printf("Plot decimation, %d x %d pixels\n", view.width, view.height);
+		const DecimationMethod methods[] = { DecimationMethod::MinMax, DecimationMethod::Lttb };
+		for (DecimationMethod method : methods)
+		{
+			const char* name = (method == DecimationMethod::MinMax) ? "minmax" : "lttb";
+			LineLod lod(method);
+			uint64_t version = 0;
+
+			Measure("plot", std::string(name) + " new curve points=" + std::to_string(curve_points), curve_points, 0, curve_points, bench.min_time, [&]()
+			{
+				lod.Update(voltages.data(), currents.data(), curve_points, ++version, view);
+			});
+			// Views alternating by a fraction of a pixel, every call decimates the curve again
+			int frame = 0;
+			Measure("plot", std::string(name) + " zoom x10 points=" + std::to_string(curve_points), curve_points, 0, curve_points, bench.min_time, [&]()
+			{
+				PlotView zoom = { 10, 13.85, 0, 10, view.width, view.height };
+				zoom.x_min += 1e-9 * (frame++ & 1);
+				lod.Update(voltages.data(), currents.data(), curve_points, version, zoom);
+			});
+		}
+
+		LineLod cached;
+		Measure("plot", "minmax unchanged frame points=" + std::to_string(curve_points), curve_points, 0, curve_points, bench.min_time, [&]()
+		{
+			cached.Update(voltages.data(), currents.data(), curve_points, 1, view);
+		});
+
+		// Samples of the curve with noise, in a ring of the history depth
+		std::vector<double> history_voltages(history), history_currents(history);
+		std::mt19937 generator(12345);
+		std::uniform_real_distribution<double> uniform(0.0, 36.0);
+		std::normal_distribution<double> noise(0.0, 0.05);
+		for (int i = 0; i < history; i++)
+		{
+			history_voltages[i] = uniform(generator);
+			history_currents[i] = 9 * (1 - exp((history_voltages[i] - 35) / 1.5)) + noise(generator);
+		}
+
+		ScatterLod scatter;
+		uint64_t total = history;
+		int frame = 0;
+		Measure("plot", "scatter new view samples=" + std::to_string(history), 0, 0, history, bench.min_time, [&]()
+		{
+			PlotView zoom = view;
+			zoom.y_max += 1e-9 * (frame++ & 1);
+			scatter.Update(history_voltages.data(), history_currents.data(), history, 0, total, zoom);
+		});
+
+		scatter.Update(history_voltages.data(), history_currents.data(), history, (int)(total % history), total, view);
+		Measure("plot", "scatter +" + std::to_string(appended) + " samples=" + std::to_string(history), 0, 0, appended, bench.min_time, [&]()
+		{
+			total += appended;
+			scatter.Update(history_voltages.data(), history_currents.data(), history, (int)(total % history), total, view);
+		});
+		printf("  %-36s %d points of the curve, %d of the history drawn\n", "", cached.Size(), scatter.Size());
+	}
+
+	/*
+		Closed loop MPPT over the default simulation ramp (800 -> 1000 W/m2, 25 -> 40 C), then at
+		a constant STC condition where a controller that holds at the MPP has no oscillation loss
+	*/
+	void BenchMppt(const PV::ModelParameters& params, const BenchOptions& bench)
+	{
+		PV::PerturbObserve perturb_observe;
+		PV::IncrementalConductance incremental_conductance;
+		PV::MpptController* controllers[] = { &perturb_observe, &incremental_conductance };
+
+		PV::MpptOptions options;
+		options.rate = bench.rate;
+		options.duration = bench.duration;
+
+		struct Profile
+		{
+			const char* name;
+			PV::ConditionProfile profile;
+		};
+		Profile profiles[] = {
+			{ "ramp", PV::RampProfile(800, 1000, 25, 40, options.duration) },
+			{ "constant", PV::RampProfile(PV::G_nominal, PV::G_nominal, PV::T_nominal, PV::T_nominal, options.duration) }
+		};
+
+		for (const Profile& profile : profiles)
+		{
+			printf("MPPT, %.0f Hz over a %.0f s %s profile\n", options.rate, options.duration, profile.name);
+			for (PV::MpptController* controller : controllers)
+			{
+				PV::MpptMetrics metrics = PV::RunMppt(params, *controller, profile.profile, options);
+
+				printf("  %-24s %12.0f steps/s  efficiency %.5f  settling %.4f s  oscillation loss %.2e  ripple %.3f V\n",
+					controller->Name(), metrics.steps_per_second, metrics.efficiency, metrics.settling_time,
+					metrics.oscillation_fraction, metrics.ripple);
+
+				BenchResult result = {};
+				result.group = "mppt";
+				result.name = std::string(controller->Name()) + " " + profile.name;
+				result.calls = (long long)metrics.steps;
+				result.points = (long long)metrics.steps;
+				result.seconds = metrics.wall_time;
+				result.ns_per_call = (metrics.steps > 0) ? 1e9 * metrics.wall_time / metrics.steps : 0;
+				result.ns_per_point = result.ns_per_call;
+				results.push_back(result);
+			}
+		}
+	}
+
+	/*
+		Cost of the profiler timers on the hot paths, in batches of 1000 (ns per point is the cost
+		of one): the two clock reads of a scope alone, a whole scope and a recorded duration. The
+		scope minus the clock reads is the work of the counters.
+	*/
+	void BenchProfiler(const BenchOptions& bench)
+	{
+		const int batch = 1000;
+		static ProfileZone scope_zone("bench.scope");
+		static ProfileZone value_zone("bench.value");
+
+		printf("Profiler, %s\n", Profiler::Enabled() ? "enabled" : "timers compiled out, measured directly");
+		volatile uint64_t sink = 0;
+		Measure("profiler", "clock reads batch=" + std::to_string(batch), 0, 0, batch, bench.min_time, [&]()
+		{
+			for (int i = 0; i < batch; i++)
+			{
+				uint64_t start = Profiler::Ticks();
+				sink = sink + (Profiler::Ticks() - start);
+			}
+		});
+
+		Measure("profiler", "scope batch=" + std::to_string(batch), 0, 0, batch, bench.min_time, [&]()
+		{
+			for (int i = 0; i < batch; i++)
+			{
+				ProfileScope scope(scope_zone);
+			}
+		});
+
+		Measure("profiler", "record_seconds batch=" + std::to_string(batch), 0, 0, batch, bench.min_time, [&]()
+		{
+			for (int i = 0; i < batch; i++) Profiler::RecordSeconds(value_zone, 1e-6 * (i + 1));
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (!ParseArguments(argc, argv, options)) return 1;
+
+	PV::ModelParameters params = PV::ExtractModelParameters(35.0f, 9.0f, 30.0f, 8.5f, PV::ITERS_nominal);
+
+	BenchCurveSolve(params, options);
+	BenchLookup(params, options);
+	BenchSweep(params, options);
+	BenchFit(params, options);
+	BenchFleet(options);
+	BenchYield(params, options);
+	if (!BenchArray(params, options)) return 1;
+	BenchPlotLod(options);
+	BenchMppt(params, options);
+	BenchProfiler(options);
+
+	if (!options.json_path.empty() && !WriteJson(options.json_path))
+	{
+		fprintf(stderr, "Cannot write %s\n", options.json_path.c_str());
+		return 1;
+	}
+
+	return 0;
+}
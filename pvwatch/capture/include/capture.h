@@ -0,0 +1,253 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "../../async_com/include/async_com.h"
+
+/*
+	Capture file of received I-V samples.
+
+	The file is a header region followed by fixed size chunks, every region is a multiple
+	of the mapping granularity so each chunk can be memory mapped on its own:
+
+	[ CaptureHeader | padding to CAPTURE_HEADER_SIZE ]
+	[ CaptureChunkHeader | IVSample x CAPTURE_CHUNK_RECORDS ]  chunk 0
+	[ CaptureChunkHeader | IVSample x CAPTURE_CHUNK_RECORDS ]  chunk 1
+	...
+
+	The chunk headers hold the first and last timestamp of their records and act as the
+	index: seeking by timestamp is a binary search over them, without reading the records.
+	Samples are appended in timestamp order.
+*/
+#define CAPTURE_MAGIC "PVCAPT01"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE (64 * 1024)
+#define CAPTURE_CHUNK_SIZE (1024 * 1024)
+#define CAPTURE_CHUNK_HEADER_SIZE 64
+#define CAPTURE_CHUNK_RECORDS ((CAPTURE_CHUNK_SIZE - CAPTURE_CHUNK_HEADER_SIZE) / sizeof(IVSample))
+
+struct CaptureHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t chunk_records;
+	uint64_t chunk_count;
+	uint64_t record_count;
+	double first_timestamp;
+	double last_timestamp;
+};
+
+struct CaptureChunkHeader
+{
+	uint64_t record_count;
+	double first_timestamp;
+	double last_timestamp;
+};
+
+/*
+	A memory mapped view of part of a file (platform specific)
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path, bool writable, bool truncate);
+	void Close(void);
+	bool IsOpen(void) const;
+
+	uint64_t Size(void) const;
+
+	/*
+		Grow the file to size bytes (new bytes are zero)
+	*/
+	bool Resize(uint64_t size);
+
+	/*
+		Map size bytes at offset (a multiple of CAPTURE_HEADER_SIZE), nullptr on error
+	*/
+	void* Map(uint64_t offset, size_t size);
+	void Unmap(void* ptr, size_t size);
+
+	/*
+		Read bytes at an offset without mapping them
+	*/
+	bool ReadAt(uint64_t offset, void* buffer, size_t size) const;
+
+private:
+#ifdef _WIN32
+	void* handle;
+#else
+	int fd;
+#endif
+	bool writable;
+};
+
+/*
+	Acquisition sources of the samples, each with its own time base
+*/
+enum class CaptureSource
+{
+	TestGenerator,	// Host time since the generator started
+	SerialPort		// Device time of the frames, or host time of the CSV lines without one
+};
+
+/*
+	Append-only writer, not thread safe (see CaptureRecorder)
+*/
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	CaptureWriter(const CaptureWriter&) = delete;
+	CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+	/*
+		Create (or overwrite) a capture file. Returns false on error.
+	*/
+	bool Open(const std::string& path);
+
+	/*
+		Unmap and close the file, the header is always consistent so this is also crash safe
+	*/
+	void Close(void);
+
+	bool IsOpen(void) const { return this->header != nullptr; }
+
+	/*
+		Append samples, a new chunk is added and mapped whenever the current one is full.
+		Timestamps must never decrease (Seek and the replay pacing rely on it), a batch that
+		goes back in time is rejected whole. Returns false with Error() set on failure.
+	*/
+	bool Append(const IVSample* samples, size_t count);
+
+	const std::string& Error(void) const { return this->error; }
+
+	uint64_t RecordCount(void) const { return this->header ? this->header->record_count : 0; }
+
+private:
+	MappedFile file;
+	CaptureHeader* header;
+	uint8_t* chunk;		// Mapped current chunk
+	CaptureChunkHeader* chunk_header;
+	IVSample* chunk_records;
+
+	std::string error;
+
+	bool AddChunk(void);
+};
+
+/*
+	Reader of a capture file. Opening only validates the header, records are mapped
+	one chunk at a time when they are read, so files of any size open instantly.
+*/
+class CaptureReader
+{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	CaptureReader(const CaptureReader&) = delete;
+	CaptureReader& operator=(const CaptureReader&) = delete;
+
+	bool Open(const std::string& path);
+	void Close(void);
+
+	const std::string& Error(void) const { return this->error; }
+
+	uint64_t RecordCount(void) const { return this->header.record_count; }
+	double FirstTimestamp(void) const { return this->header.first_timestamp; }
+	double LastTimestamp(void) const { return this->header.last_timestamp; }
+
+	/*
+		Index of the first record with a timestamp >= timestamp (RecordCount() if none)
+	*/
+	uint64_t Seek(double timestamp);
+
+	/*
+		Copy up to max_count records starting at index. Returns the number copied.
+	*/
+	size_t Read(uint64_t index, IVSample* out, size_t max_count);
+
+private:
+	MappedFile file;
+	CaptureHeader header;
+	std::string error;
+
+	// Currently mapped chunk
+	int64_t mapped_index;
+	const uint8_t* mapped_chunk;
+
+	const IVSample* ChunkRecords(uint64_t chunk_index);
+	bool ReadChunkHeader(uint64_t chunk_index, CaptureChunkHeader& chunk_header) const;
+};
+
+/*
+	Thread safe recording switch for the acquisition threads
+*/
+class CaptureRecorder
+{
+public:
+	CaptureRecorder();
+
+	/*
+		Record the samples of one acquisition source to path, the sources have unrelated time bases
+	*/
+	bool Start(const std::string& path, CaptureSource source);
+	void Stop(void);
+
+	bool IsRecording(void) const { return this->recording.load(std::memory_order_relaxed); }
+
+	/*
+		Append samples of source when it is the one recorded, a no-op (one atomic load) otherwise.
+		A write error or timestamps going back stop the recording, see Error().
+	*/
+	void Append(CaptureSource source, const IVSample* samples, size_t count);
+
+	uint64_t RecordCount(void);
+
+	/*
+		Why the last recording stopped by itself, empty otherwise
+	*/
+	std::string Error(void);
+
+private:
+	std::mutex mtx;
+	std::atomic<bool> recording;
+	std::atomic<CaptureSource> source;
+	CaptureWriter writer;
+	std::string error;
+};
+
+/*
+	Shared state of a replay thread, owned by the UI. The replayed samples arrive through
+	the own ring of the replay, like any other acquisition source.
+*/
+struct ReplayStatus
+{
+	std::atomic<bool> stop{ false };
+	std::atomic<bool> running{ false };
+	std::atomic<double> progress{ 0 };	// 0 to 1
+	std::atomic<uint64_t> replayed{ 0 };
+
+	SampleRing samples{ 1 << 17 };
+
+	std::mutex error_mtx;
+	std::string error;
+};
+
+/*
+	Replay a capture file into status->samples. speed is the time scale (1 = real time,
+	N = N times faster), 0 replays as fast as the consumer drains the ring.
+	start_timestamp seeks before replaying. Meant to run on its own thread.
+*/
+void ReplayCapture(std::string path, double speed, double start_timestamp, ReplayStatus* status);
@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../include/capture.h"
+
+static_assert(sizeof(CaptureHeader) <= CAPTURE_HEADER_SIZE, "Capture header does not fit its region");
+static_assert(sizeof(CaptureChunkHeader) <= CAPTURE_CHUNK_HEADER_SIZE, "Chunk header does not fit its region");
+static_assert(CAPTURE_CHUNK_HEADER_SIZE % alignof(IVSample) == 0, "Records must stay aligned");
+
+#define REPLAY_BATCH 1024
+
+namespace
+{
+	uint64_t ChunkOffset(uint64_t chunk_index)
+	{
+		return CAPTURE_HEADER_SIZE + chunk_index * (uint64_t)CAPTURE_CHUNK_SIZE;
+	}
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+{
+	this->handle = INVALID_HANDLE_VALUE;
+	this->writable = false;
+}
+
+bool MappedFile::Open(const std::string& path, bool writable, bool truncate)
+{
+	this->Close();
+
+	DWORD access = GENERIC_READ | (writable ? GENERIC_WRITE : 0);
+	DWORD disposition = truncate ? CREATE_ALWAYS : OPEN_EXISTING;
+	this->handle = CreateFileA(path.c_str(), access, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+	this->writable = writable;
+
+	return this->handle != INVALID_HANDLE_VALUE;
+}
+
+void MappedFile::Close(void)
+{
+	if (this->handle != INVALID_HANDLE_VALUE) CloseHandle((HANDLE)this->handle);
+	this->handle = INVALID_HANDLE_VALUE;
+}
+
+bool MappedFile::IsOpen(void) const
+{
+	return this->handle != INVALID_HANDLE_VALUE;
+}
+
+uint64_t MappedFile::Size(void) const
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx((HANDLE)this->handle, &size)) return 0;
+	return (uint64_t)size.QuadPart;
+}
+
+bool MappedFile::Resize(uint64_t size)
+{
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG)size;
+	return SetFilePointerEx((HANDLE)this->handle, position, NULL, FILE_BEGIN) && SetEndOfFile((HANDLE)this->handle);
+}
+
+void* MappedFile::Map(uint64_t offset, size_t size)
+{
+	// The mapping object covers the current file size, the view keeps it alive
+	HANDLE mapping = CreateFileMappingA((HANDLE)this->handle, NULL, this->writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) return nullptr;
+
+	void* ptr = MapViewOfFile(mapping, this->writable ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, size);
+	CloseHandle(mapping);
+
+	return ptr;
+}
+
+void MappedFile::Unmap(void* ptr, size_t size)
+{
+	(void)size;
+	if (ptr != nullptr) UnmapViewOfFile(ptr);
+}
+
+bool MappedFile::ReadAt(uint64_t offset, void* buffer, size_t size) const
+{
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD read = 0;
+	return ReadFile((HANDLE)this->handle, buffer, (DWORD)size, &read, &overlapped) && read == size;
+}
+
+#else
+
+MappedFile::MappedFile()
+{
+	this->fd = -1;
+	this->writable = false;
+}
+
+bool MappedFile::Open(const std::string& path, bool writable, bool truncate)
+{
+	this->Close();
+
+	int flags = writable ? O_RDWR : O_RDONLY;
+	if (truncate) flags |= O_CREAT | O_TRUNC;
+	this->fd = open(path.c_str(), flags, 0644);
+	this->writable = writable;
+
+	return this->fd >= 0;
+}
+
+void MappedFile::Close(void)
+{
+	if (this->fd >= 0) close(this->fd);
+	this->fd = -1;
+}
+
+bool MappedFile::IsOpen(void) const
+{
+	return this->fd >= 0;
+}
+
+uint64_t MappedFile::Size(void) const
+{
+	struct stat st;
+	if (fstat(this->fd, &st) != 0) return 0;
+	return (uint64_t)st.st_size;
+}
+
+bool MappedFile::Resize(uint64_t size)
+{
+	return ftruncate(this->fd, (off_t)size) == 0;
+}
+
+void* MappedFile::Map(uint64_t offset, size_t size)
+{
+	int protection = PROT_READ | (this->writable ? PROT_WRITE : 0);
+	void* ptr = mmap(nullptr, size, protection, MAP_SHARED, this->fd, (off_t)offset);
+
+	return (ptr == MAP_FAILED) ? nullptr : ptr;
+}
+
+void MappedFile::Unmap(void* ptr, size_t size)
+{
+	if (ptr != nullptr) munmap(ptr, size);
+}
+
+bool MappedFile::ReadAt(uint64_t offset, void* buffer, size_t size) const
+{
+	uint8_t* dst = static_cast<uint8_t*>(buffer);
+	while (size > 0)
+	{
+		ssize_t n = pread(this->fd, dst, size, (off_t)offset);
+		if (n <= 0) return false;
+		dst += n;
+		offset += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	this->Close();
+}
+
+CaptureWriter::CaptureWriter()
+{
+	this->header = nullptr;
+	this->chunk = nullptr;
+	this->chunk_header = nullptr;
+	this->chunk_records = nullptr;
+}
+
+CaptureWriter::~CaptureWriter()
+{
+	this->Close();
+}
+
+bool CaptureWriter::Open(const std::string& path)
+{
+	this->Close();
+
+	if (!this->file.Open(path, true, true)) return false;
+
+	if (!this->file.Resize(CAPTURE_HEADER_SIZE) || (this->header = static_cast<CaptureHeader*>(this->file.Map(0, CAPTURE_HEADER_SIZE))) == nullptr)
+	{
+		this->file.Close();
+		return false;
+	}
+
+	memcpy(this->header->magic, CAPTURE_MAGIC, sizeof(this->header->magic));
+	this->header->version = CAPTURE_VERSION;
+	this->header->record_size = sizeof(IVSample);
+	this->header->chunk_records = CAPTURE_CHUNK_RECORDS;
+	this->header->chunk_count = 0;
+	this->header->record_count = 0;
+	this->header->first_timestamp = 0;
+	this->header->last_timestamp = 0;
+
+	return true;
+}
+
+void CaptureWriter::Close(void)
+{
+	this->file.Unmap(this->chunk, CAPTURE_CHUNK_SIZE);
+	this->file.Unmap(this->header, CAPTURE_HEADER_SIZE);
+	this->file.Close();
+
+	this->header = nullptr;
+	this->chunk = nullptr;
+	this->chunk_header = nullptr;
+	this->chunk_records = nullptr;
+}
+
+bool CaptureWriter::AddChunk(void)
+{
+	this->file.Unmap(this->chunk, CAPTURE_CHUNK_SIZE);
+	this->chunk = nullptr;
+	this->chunk_header = nullptr;
+	this->chunk_records = nullptr;
+
+	uint64_t index = this->header->chunk_count;
+	if (!this->file.Resize(ChunkOffset(index + 1))) return false;
+
+	this->chunk = static_cast<uint8_t*>(this->file.Map(ChunkOffset(index), CAPTURE_CHUNK_SIZE));
+	if (this->chunk == nullptr) return false;
+
+	this->chunk_header = reinterpret_cast<CaptureChunkHeader*>(this->chunk);
+	this->chunk_records = reinterpret_cast<IVSample*>(this->chunk + CAPTURE_CHUNK_HEADER_SIZE);
+	this->chunk_header->record_count = 0;
+	this->header->chunk_count = index + 1;
+
+	return true;
+}
+
+bool CaptureWriter::Append(const IVSample* samples, size_t count)
+{
+	if (this->header == nullptr) return false;
+
+	// Checked up front, a rejected batch leaves the file as it was
+	double last = (this->header->record_count > 0) ? this->header->last_timestamp : -INFINITY;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (samples[i].timestamp < last)
+		{
+			this->error = "Capture timestamps went back in time";
+			return false;
+		}
+		last = samples[i].timestamp;
+	}
+
+	while (count > 0)
+	{
+		if (this->chunk == nullptr || this->chunk_header->record_count == CAPTURE_CHUNK_RECORDS)
+		{
+			if (!this->AddChunk())
+			{
+				this->error = "Cannot grow the capture file";
+				return false;
+			}
+		}
+
+		uint64_t used = this->chunk_header->record_count;
+		size_t n = (size_t)std::min<uint64_t>(count, CAPTURE_CHUNK_RECORDS - used);
+		memcpy(this->chunk_records + used, samples, n * sizeof(IVSample));
+
+		// Records first, counts last: a crash never exposes unwritten records
+		if (used == 0) this->chunk_header->first_timestamp = samples[0].timestamp;
+		this->chunk_header->last_timestamp = samples[n - 1].timestamp;
+		this->chunk_header->record_count = used + n;
+
+		if (this->header->record_count == 0) this->header->first_timestamp = samples[0].timestamp;
+		this->header->last_timestamp = samples[n - 1].timestamp;
+		this->header->record_count += n;
+
+		samples += n;
+		count -= n;
+	}
+
+	return true;
+}
+
+CaptureReader::CaptureReader()
+{
+	memset(&this->header, 0, sizeof(this->header));
+	this->mapped_index = -1;
+	this->mapped_chunk = nullptr;
+}
+
+CaptureReader::~CaptureReader()
+{
+	this->Close();
+}
+
+bool CaptureReader::Open(const std::string& path)
+{
+	this->Close();
+
+	if (!this->file.Open(path, false, false))
+	{
+		this->error = "Cannot open " + path;
+		return false;
+	}
+
+	if (!this->file.ReadAt(0, &this->header, sizeof(this->header)) || memcmp(this->header.magic, CAPTURE_MAGIC, sizeof(this->header.magic)) != 0)
+	{
+		this->error = "Not a capture file: " + path;
+		this->Close();
+		return false;
+	}
+
+	if (this->header.version != CAPTURE_VERSION || this->header.record_size != sizeof(IVSample) || this->header.chunk_records != CAPTURE_CHUNK_RECORDS)
+	{
+		this->error = "Unsupported capture file version";
+		this->Close();
+		return false;
+	}
+
+	// A truncated file keeps its complete chunks
+	uint64_t chunks = (this->file.Size() > CAPTURE_HEADER_SIZE) ? (this->file.Size() - CAPTURE_HEADER_SIZE) / CAPTURE_CHUNK_SIZE : 0;
+	this->header.record_count = std::min<uint64_t>(this->header.record_count, chunks * CAPTURE_CHUNK_RECORDS);
+
+	this->error.clear();
+	return true;
+}
+
+void CaptureReader::Close(void)
+{
+	this->file.Unmap((void*)this->mapped_chunk, CAPTURE_CHUNK_SIZE);
+	this->file.Close();
+
+	memset(&this->header, 0, sizeof(this->header));
+	this->mapped_index = -1;
+	this->mapped_chunk = nullptr;
+}
+
+bool CaptureReader::ReadChunkHeader(uint64_t chunk_index, CaptureChunkHeader& chunk_header) const
+{
+	return this->file.ReadAt(ChunkOffset(chunk_index), &chunk_header, sizeof(chunk_header));
+}
+
+const IVSample* CaptureReader::ChunkRecords(uint64_t chunk_index)
+{
+	if ((int64_t)chunk_index != this->mapped_index)
+	{
+		this->file.Unmap((void*)this->mapped_chunk, CAPTURE_CHUNK_SIZE);
+		this->mapped_chunk = static_cast<const uint8_t*>(this->file.Map(ChunkOffset(chunk_index), CAPTURE_CHUNK_SIZE));
+		this->mapped_index = (this->mapped_chunk != nullptr) ? (int64_t)chunk_index : -1;
+	}
+
+	return (this->mapped_chunk != nullptr) ? reinterpret_cast<const IVSample*>(this->mapped_chunk + CAPTURE_CHUNK_HEADER_SIZE) : nullptr;
+}
+
+uint64_t CaptureReader::Seek(double timestamp)
+{
+	uint64_t records = this->header.record_count;
+	if (records == 0 || timestamp <= this->header.first_timestamp) return 0;
+	if (timestamp > this->header.last_timestamp) return records;
+
+	// Binary search over the chunk headers for the first chunk ending at or after timestamp
+	uint64_t low = 0;
+	uint64_t high = (records + CAPTURE_CHUNK_RECORDS - 1) / CAPTURE_CHUNK_RECORDS - 1;
+	while (low < high)
+	{
+		uint64_t mid = low + (high - low) / 2;
+		CaptureChunkHeader chunk_header;
+		if (!this->ReadChunkHeader(mid, chunk_header)) return records;
+
+		if (chunk_header.last_timestamp < timestamp) low = mid + 1;
+		else high = mid;
+	}
+
+	// Then over the records of that chunk
+	const IVSample* chunk_records = this->ChunkRecords(low);
+	if (chunk_records == nullptr) return records;
+
+	uint64_t first = low * CAPTURE_CHUNK_RECORDS;
+	size_t count = (size_t)std::min<uint64_t>(CAPTURE_CHUNK_RECORDS, records - first);
+	const IVSample* it = std::lower_bound(chunk_records, chunk_records + count, timestamp,
+		[](const IVSample& sample, double t) { return sample.timestamp < t; });
+
+	return first + (it - chunk_records);
+}
+
+size_t CaptureReader::Read(uint64_t index, IVSample* out, size_t max_count)
+{
+	size_t total = 0;
+	while (total < max_count && index < this->header.record_count)
+	{
+		uint64_t chunk_index = index / CAPTURE_CHUNK_RECORDS;
+		uint64_t in_chunk = index % CAPTURE_CHUNK_RECORDS;
+
+		const IVSample* chunk_records = this->ChunkRecords(chunk_index);
+		if (chunk_records == nullptr) break;
+
+		uint64_t available = std::min<uint64_t>(CAPTURE_CHUNK_RECORDS - in_chunk, this->header.record_count - index);
+		size_t n = (size_t)std::min<uint64_t>(available, max_count - total);
+		memcpy(out + total, chunk_records + in_chunk, n * sizeof(IVSample));
+
+		total += n;
+		index += n;
+	}
+
+	return total;
+}
+
+CaptureRecorder::CaptureRecorder()
+{
+	this->recording = false;
+	this->source = CaptureSource::TestGenerator;
+}
+
+bool CaptureRecorder::Start(const std::string& path, CaptureSource source)
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	this->recording = false;
+	this->error.clear();
+	if (!this->writer.Open(path))
+	{
+		this->error = "Cannot create " + path;
+		return false;
+	}
+
+	this->source = source;
+	this->recording = true;
+	return true;
+}
+
+void CaptureRecorder::Stop(void)
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	this->recording = false;
+	this->writer.Close();
+}
+
+void CaptureRecorder::Append(CaptureSource source, const IVSample* samples, size_t count)
+{
+	if (!this->IsRecording() || count == 0 || source != this->source.load(std::memory_order_relaxed)) return;
+
+	std::lock_guard<std::mutex> lock(this->mtx);
+	if (this->writer.IsOpen() && !this->writer.Append(samples, count))
+	{
+		// Disk full, the file vanished or the source restarted its clock, keep what was written
+		this->error = this->writer.Error();
+		this->recording = false;
+		this->writer.Close();
+	}
+}
+
+uint64_t CaptureRecorder::RecordCount(void)
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->writer.RecordCount();
+}
+
+std::string CaptureRecorder::Error(void)
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->error;
+}
+
+void ReplayCapture(std::string path, double speed, double start_timestamp, ReplayStatus* status)
+{
+	status->running = true;
+	status->replayed = 0;
+	status->progress = 0;
+
+	CaptureReader reader;
+	if (!reader.Open(path))
+	{
+		std::lock_guard<std::mutex> lock(status->error_mtx);
+		status->error = reader.Error();
+		status->running = false;
+		return;
+	}
+
+	std::vector<IVSample> batch(REPLAY_BATCH);
+	size_t pos = 0;
+	size_t count = 0;
+
+	uint64_t first = reader.Seek(start_timestamp);
+	uint64_t index = first;
+	uint64_t total = reader.RecordCount();
+
+	auto wall_start = std::chrono::steady_clock::now();
+	double capture_start = 0;
+	bool started = false;
+
+	while (!status->stop)
+	{
+		if (pos == count)
+		{
+			count = reader.Read(index, batch.data(), batch.size());
+			index += count;
+			pos = 0;
+			if (count == 0) break;
+		}
+
+		if (!started)
+		{
+			capture_start = batch[0].timestamp;
+			started = true;
+		}
+
+		// Release the records that are due at this point of the scaled capture time
+		size_t end = count;
+		if (speed > 0)
+		{
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+			double due = capture_start + elapsed * speed;
+
+			end = pos;
+			while (end < count && batch[end].timestamp <= due) end++;
+
+			if (end == pos)
+			{
+				double wait = (batch[pos].timestamp - due) / speed;
+				std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait, 0.01)));
+				continue;
+			}
+		}
+
+		// Replay never drops, it waits for the consumer and retries the rest instead
+		size_t pushed = status->samples.TryPushBatch(batch.data() + pos, end - pos);
+		if (pushed == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		pos += pushed;
+		status->replayed += pushed;
+		status->progress = (total > first) ? (double)(index - count + pos - first) / (double)(total - first) : 1.0;
+	}
+
+	status->running = false;
+}
@@ -0,0 +1,476 @@
+/*
+	Headless command line front end of the PV model, without the App window or any GUI library.
+	Solves every module of a job file at every operating condition on all cores and streams
+	the V / I / P curves (CSV or binary) and an MPP summary (CSV), in job order.
+
+	Usage: pvwatch_cli job_file [--output path|-] [--format csv|binary] [--summary path|-]
+	                            [--steps N] [--iterations N] [--solver newton|fixed-point|lambert-w]
+	                            [--threads N] [--grid uniform|adaptive] [--grid-error A]
+
+	Without --output and --summary the summary goes to the standard output. Adaptive grids place
+	at most --steps points where the interpolation error is the largest, until it is below --grid-error.
+
+	Job file, one directive per line ('#' starts a comment):
+		module <name> <Voc> <Isc> <Vmp> <Imp>
+		condition <G> <T>
+		grid <G start> <G stop> <G count> <T start> <T stop> <T count>
+*/
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "../pv/include/pv.h"
+
+#define CURVE_FILE_MAGIC "PVCURV01"
+
+// Curves solved (and formatted) per batch, one batch is written while the next one is solved
+#define CLI_BATCH_CURVES 512
+
+namespace
+{
+	/*
+		Binary curve file: the header, the module table, then every curve as its record
+		followed by steps doubles of V, steps of I and steps of P. Little endian.
+	*/
+	struct CurveFileHeader
+	{
+		char magic[8];
+		uint32_t module_count;
+		uint32_t condition_count;
+		uint32_t steps;
+		uint32_t reserved;
+	};
+
+	struct CurveFileModule
+	{
+		char name[48];
+		float v_oc;
+		float i_sc;
+		float v_mp;
+		float i_mp;
+	};
+
+	struct CurveFileRecord
+	{
+		uint32_t module;
+		uint32_t steps;
+		float g;
+		float t;
+		double v_mp;
+		double i_mp;
+		double p_mp;
+	};
+
+	static_assert(sizeof(CurveFileHeader) == 24, "Curve file header layout");
+	static_assert(sizeof(CurveFileModule) == 64, "Curve file module layout");
+	static_assert(sizeof(CurveFileRecord) == 40, "Curve file record layout");
+
+	struct JobModule
+	{
+		std::string name;
+		float v_oc;
+		float i_sc;
+		float v_mp;
+		float i_mp;
+		PV::ModelParameters params;
+	};
+
+	struct JobCondition
+	{
+		float g;
+		float t;
+	};
+
+	enum class CurveFormat
+	{
+		None,
+		Csv,
+		Binary
+	};
+
+	struct CliOptions
+	{
+		std::string job_path;
+		std::string output_path;
+		std::string summary_path;
+		CurveFormat format = CurveFormat::Csv;
+		int steps = PV::STEPS_nominal;
+		int iterations = PV::ITERS_nominal;
+		PV::SolverMethod solver = PV::SolverMethod::Newton;
+		int threads = 0;
+		PV::GridMode grid = PV::GridMode::Uniform;
+		double grid_tolerance = 1e-4;
+	};
+
+	/*
+		Output of one curve, formatted by the worker that solved it
+	*/
+	struct CurveOutput
+	{
+		std::string curve;
+		std::string summary;
+	};
+
+	void PrintUsage(const char* program)
+	{
+		fprintf(stderr,
+			"Usage: %s job_file [--output path|-] [--format csv|binary] [--summary path|-]\n"
+			"       [--steps N] [--iterations N] [--solver newton|fixed-point|lambert-w] [--threads N]\n"
+			"       [--grid uniform|adaptive] [--grid-error A]\n", program);
+	}
+
+	bool ParseArguments(int argc, char** argv, CliOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			bool has_value = i + 1 < argc;
+
+			if (strcmp(argv[i], "--output") == 0 && has_value) options.output_path = argv[++i];
+			else if (strcmp(argv[i], "--summary") == 0 && has_value) options.summary_path = argv[++i];
+			else if (strcmp(argv[i], "--steps") == 0 && has_value) options.steps = atoi(argv[++i]);
+			else if (strcmp(argv[i], "--iterations") == 0 && has_value) options.iterations = atoi(argv[++i]);
+			else if (strcmp(argv[i], "--threads") == 0 && has_value) options.threads = atoi(argv[++i]);
+			else if (strcmp(argv[i], "--grid-error") == 0 && has_value) options.grid_tolerance = atof(argv[++i]);
+			else if (strcmp(argv[i], "--grid") == 0 && has_value)
+			{
+				const char* grid = argv[++i];
+				if (strcmp(grid, "uniform") == 0) options.grid = PV::GridMode::Uniform;
+				else if (strcmp(grid, "adaptive") == 0) options.grid = PV::GridMode::Adaptive;
+				else return false;
+			}
+			else if (strcmp(argv[i], "--format") == 0 && has_value)
+			{
+				const char* format = argv[++i];
+				if (strcmp(format, "csv") == 0) options.format = CurveFormat::Csv;
+				else if (strcmp(format, "binary") == 0) options.format = CurveFormat::Binary;
+				else return false;
+			}
+			else if (strcmp(argv[i], "--solver") == 0 && has_value)
+			{
+				const char* solver = argv[++i];
+				if (strcmp(solver, "newton") == 0) options.solver = PV::SolverMethod::Newton;
+				else if (strcmp(solver, "fixed-point") == 0) options.solver = PV::SolverMethod::FixedPoint;
+				else if (strcmp(solver, "lambert-w") == 0) options.solver = PV::SolverMethod::LambertW;
+				else return false;
+			}
+			else if (argv[i][0] != '-' && options.job_path.empty()) options.job_path = argv[i];
+			else return false;
+		}
+
+		if (options.output_path.empty())
+		{
+			options.format = CurveFormat::None;
+			if (options.summary_path.empty()) options.summary_path = "-";
+		}
+
+		return !options.job_path.empty() && options.steps >= 2 && options.iterations >= 0;
+	}
+
+	bool ParseJob(const std::string& path, std::vector<JobModule>& modules, std::vector<JobCondition>& conditions)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			fprintf(stderr, "Cannot open %s\n", path.c_str());
+			return false;
+		}
+
+		std::string line;
+		for (int number = 1; std::getline(file, line); number++)
+		{
+			line = line.substr(0, line.find('#'));
+
+			std::istringstream stream(line);
+			std::string directive;
+			if (!(stream >> directive)) continue;
+
+			bool valid = false;
+			if (directive == "module")
+			{
+				JobModule module;
+				valid = (stream >> module.name >> module.v_oc >> module.i_sc >> module.v_mp >> module.i_mp) &&
+					module.v_oc > module.v_mp && module.v_mp > 0 && module.i_sc > module.i_mp && module.i_mp > 0;
+				if (valid) modules.push_back(module);
+			}
+			else if (directive == "condition")
+			{
+				JobCondition condition;
+				// The model has no curve without irradiance
+				valid = (stream >> condition.g >> condition.t) && condition.g > 0;
+				if (valid) conditions.push_back(condition);
+			}
+			else if (directive == "grid")
+			{
+				float g_start, g_stop, t_start, t_stop;
+				int g_count, t_count;
+				valid = (stream >> g_start >> g_stop >> g_count >> t_start >> t_stop >> t_count) && g_count > 0 && t_count > 0 &&
+					g_start > 0 && g_stop > 0;
+
+				for (int gi = 0; valid && gi < g_count; gi++)
+				{
+					for (int ti = 0; ti < t_count; ti++)
+					{
+						JobCondition condition;
+						condition.g = (g_count > 1) ? g_start + (g_stop - g_start) * gi / (g_count - 1) : g_start;
+						condition.t = (t_count > 1) ? t_start + (t_stop - t_start) * ti / (t_count - 1) : t_start;
+						conditions.push_back(condition);
+					}
+				}
+			}
+
+			if (!valid)
+			{
+				fprintf(stderr, "%s:%d: invalid %s directive\n", path.c_str(), number, directive.c_str());
+				return false;
+			}
+		}
+
+		if (modules.empty() || conditions.empty())
+		{
+			fprintf(stderr, "%s: the job needs at least one module and one condition\n", path.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	FILE* OpenOutput(const std::string& path, bool binary)
+	{
+		if (path == "-")
+		{
+#ifdef _WIN32
+			if (binary) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+			return stdout;
+		}
+
+		return fopen(path.c_str(), binary ? "wb" : "w");
+	}
+
+	/*
+		Solve one curve and format its outputs, module holds the reused curve storage of the worker
+	*/
+	void SolveCurve(PV::PVModule& module, const JobModule& job_module, int module_index, const JobCondition& condition,
+		const CliOptions& options, CurveOutput& output)
+	{
+		module.CalculateIVPArrays(job_module.params, condition.g, condition.t, options.steps, options.iterations);
+		PV::MaxPowerPoint mpp = PV::SolveMaxPowerPoint(job_module.params, condition.g, condition.t);
+
+		const double* voltage = module.GetVoltageArray();
+		const double* current = module.GetCurrentArray();
+		const double* power = module.GetPowerArray();
+		int steps = module.steps;
+
+		char line[256];
+		int length;
+
+		output.curve.clear();
+		if (options.format == CurveFormat::Csv)
+		{
+			// The shortest representation that reads back exactly, much faster than printf.
+			// The line buffer only holds numbers, the name can be of any length.
+			length = snprintf(line, sizeof(line), ",%g,%g,", condition.g, condition.t);
+			std::string prefix = job_module.name + std::string(line, std::min(std::max(length, 0), (int)sizeof(line) - 1));
+
+			for (int i = 0; i < steps; i++)
+			{
+				char* end = line + sizeof(line);
+				char* ptr = std::to_chars(line, end, voltage[i]).ptr;
+				*ptr++ = ',';
+				ptr = std::to_chars(ptr, end, current[i]).ptr;
+				*ptr++ = ',';
+				ptr = std::to_chars(ptr, end, power[i]).ptr;
+				*ptr++ = '\n';
+
+				output.curve += prefix;
+				output.curve.append(line, ptr - line);
+			}
+		}
+		else if (options.format == CurveFormat::Binary)
+		{
+			CurveFileRecord record = {};
+			record.module = (uint32_t)module_index;
+			record.steps = (uint32_t)steps;
+			record.g = condition.g;
+			record.t = condition.t;
+			record.v_mp = mpp.V;
+			record.i_mp = mpp.I;
+			record.p_mp = mpp.P;
+
+			output.curve.append(reinterpret_cast<const char*>(&record), sizeof(record));
+			output.curve.append(reinterpret_cast<const char*>(voltage), steps * sizeof(double));
+			output.curve.append(reinterpret_cast<const char*>(current), steps * sizeof(double));
+			output.curve.append(reinterpret_cast<const char*>(power), steps * sizeof(double));
+		}
+
+		output.summary.clear();
+		if (!options.summary_path.empty())
+		{
+			double v_oc = (steps > 0) ? voltage[steps - 1] : 0;
+			double i_sc = (steps > 0) ? current[0] : 0;
+
+			length = snprintf(line, sizeof(line), ",%g,%g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+				condition.g, condition.t, mpp.V, mpp.I, mpp.P, v_oc, i_sc);
+			output.summary += job_module.name;
+			output.summary.append(line, std::min(std::max(length, 0), (int)sizeof(line) - 1));
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	CliOptions options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::vector<JobModule> modules;
+	std::vector<JobCondition> conditions;
+	if (!ParseJob(options.job_path, modules, conditions)) return 1;
+
+	for (JobModule& module : modules)
+	{
+		module.params = PV::ParameterCache::Instance().Get(module.v_oc, module.i_sc, module.v_mp, module.i_mp, options.iterations);
+	}
+
+	FILE* curve_file = nullptr;
+	FILE* summary_file = nullptr;
+
+	if (options.format != CurveFormat::None && (curve_file = OpenOutput(options.output_path, options.format == CurveFormat::Binary)) == nullptr)
+	{
+		fprintf(stderr, "Cannot open %s\n", options.output_path.c_str());
+		return 1;
+	}
+
+	if (!options.summary_path.empty())
+	{
+		summary_file = (options.summary_path == options.output_path && curve_file != nullptr) ? curve_file : OpenOutput(options.summary_path, false);
+		if (summary_file == nullptr)
+		{
+			fprintf(stderr, "Cannot open %s\n", options.summary_path.c_str());
+			return 1;
+		}
+		fprintf(summary_file, "module,g,t,v_mp,i_mp,p_mp,v_oc,i_sc\n");
+	}
+
+	if (options.format == CurveFormat::Csv)
+	{
+		fprintf(curve_file, "module,g,t,v,i,p\n");
+	}
+	else if (options.format == CurveFormat::Binary)
+	{
+		CurveFileHeader header = {};
+		memcpy(header.magic, CURVE_FILE_MAGIC, sizeof(header.magic));
+		header.module_count = (uint32_t)modules.size();
+		header.condition_count = (uint32_t)conditions.size();
+		header.steps = (uint32_t)options.steps;
+		fwrite(&header, sizeof(header), 1, curve_file);
+
+		for (const JobModule& module : modules)
+		{
+			CurveFileModule entry = {};
+			strncpy(entry.name, module.name.c_str(), sizeof(entry.name) - 1);
+			entry.v_oc = module.v_oc;
+			entry.i_sc = module.i_sc;
+			entry.v_mp = module.v_mp;
+			entry.i_mp = module.i_mp;
+			fwrite(&entry, sizeof(entry), 1, curve_file);
+		}
+	}
+
+	int thread_count = (options.threads > 0) ? options.threads : (int)std::thread::hardware_concurrency();
+	thread_count = std::max(thread_count, 1);
+
+	// One module per worker keeps its curve storage from curve to curve
+	std::vector<PV::PVModule> workers(thread_count);
+	for (PV::PVModule& module : workers)
+	{
+		module.solver_method = options.solver;
+		module.grid_mode = options.grid;
+		module.grid_tolerance = options.grid_tolerance;
+
+		// The curves a worker gets depend on the thread timing, cold solves keep the output reproducible
+		module.warm_start = false;
+	}
+
+	size_t total = modules.size() * conditions.size();
+	std::vector<CurveOutput> batches[2] = { std::vector<CurveOutput>(CLI_BATCH_CURVES), std::vector<CurveOutput>(CLI_BATCH_CURVES) };
+
+	auto solve_batch = [&](std::vector<CurveOutput>& batch, size_t first, size_t count)
+	{
+		std::atomic<size_t> next(0);
+		auto worker = [&](int index)
+		{
+			size_t i;
+			while ((i = next++) < count)
+			{
+				size_t job = first + i;
+				size_t module_index = job / conditions.size();
+				SolveCurve(workers[index], modules[module_index], (int)module_index, conditions[job % conditions.size()], options, batch[i]);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (int t = 1; t < thread_count; t++) threads.emplace_back(worker, t);
+		worker(0);
+		for (std::thread& thread : threads) thread.join();
+	};
+
+	auto write_batch = [&](const std::vector<CurveOutput>& batch, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (curve_file != nullptr) fwrite(batch[i].curve.data(), 1, batch[i].curve.size(), curve_file);
+			if (summary_file != nullptr) fwrite(batch[i].summary.data(), 1, batch[i].summary.size(), summary_file);
+		}
+	};
+
+	// The previous batch is written while the next one is solved
+	size_t written_count = 0;
+	std::thread writer;
+	for (size_t first = 0, current = 0; first < total; first += CLI_BATCH_CURVES, current ^= 1)
+	{
+		size_t count = std::min((size_t)CLI_BATCH_CURVES, total - first);
+		solve_batch(batches[current], first, count);
+
+		if (writer.joinable()) writer.join();
+		writer = std::thread(write_batch, std::cref(batches[current]), count);
+		written_count += count;
+	}
+	if (writer.joinable()) writer.join();
+
+	bool failed = false;
+	if (curve_file != nullptr) failed |= ferror(curve_file) != 0 || (curve_file != stdout && fclose(curve_file) != 0);
+	if (summary_file != nullptr && summary_file != curve_file) failed |= ferror(summary_file) != 0 || (summary_file != stdout && fclose(summary_file) != 0);
+	if (curve_file == stdout || summary_file == stdout) failed |= fflush(stdout) != 0;
+
+	if (failed)
+	{
+		fprintf(stderr, "Writing the output failed\n");
+		return 1;
+	}
+
+	fprintf(stderr, "%zu curves (%zu modules x %zu conditions) on %d threads in %.3f s\n", written_count, modules.size(), conditions.size(),
+		thread_count, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	return 0;
+}
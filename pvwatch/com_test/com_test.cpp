@@ -0,0 +1,283 @@
+/*
+	Headless test of the serial port ingestion, without the App window or any GUI library.
+	Needs POSIX pseudo terminals (Linux, macOS), the Windows build only reports the test as skipped.
+
+	Usage: com_test
+
+	A pseudo terminal stands in for the emulator board: GetDatafromCOMPort opens its slave side
+	as the serial port while the test writes to the master side. The stream mixes good binary
+	frames, frames with a corrupted CRC, frames split across reads and CSV lines, then fills the
+	sample ring past its capacity and ends with a partial frame. The frames, text_lines,
+	crc_errors and dropped counters of the ComStatus and the received samples must match what
+	was sent. Returns 0 when every check passes.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "../async_com/include/async_com.h"
+#include "../async_com/include/serial_port.h"
+
+#ifndef _WIN32
+namespace
+{
+	// Q16.16 rounding of the frames, and the digits of the CSV lines
+	const double SAMPLE_TOLERANCE = 1e-4;
+
+	int failures = 0;
+
+	void Check(const std::string& name, bool ok)
+	{
+		printf("  %-48s %s\n", name.c_str(), ok ? "ok" : "FAIL");
+		if (!ok) failures++;
+	}
+
+	/*
+		Sample number i of the emulated board, timestamps 1 ms apart
+	*/
+	IVSample BoardSample(int i)
+	{
+		IVSample sample;
+		sample.timestamp = 1e-3 * i;
+		sample.voltage = 0.01 * (i % 4000);
+		sample.current = 9.0 - 0.002 * (i % 4000);
+		sample.power = sample.voltage * sample.current;
+		return sample;
+	}
+
+	void AppendFrame(std::vector<uint8_t>& stream, const IVSample& sample, bool corrupt)
+	{
+		uint8_t frame[FRAME_SIZE];
+		EncodeFrame(sample, frame);
+		if (corrupt) frame[14] ^= 0x01;
+		stream.insert(stream.end(), frame, frame + FRAME_SIZE);
+	}
+
+	void AppendLine(std::vector<uint8_t>& stream, const IVSample& sample, bool timestamp)
+	{
+		char line[FRAME_MAX_LINE];
+		int length = timestamp ? snprintf(line, sizeof(line), "%.3f,%.4f,%.4f\n", sample.timestamp, sample.voltage, sample.current)
+			: snprintf(line, sizeof(line), "%.4f;%.4f\r\n", sample.voltage, sample.current);
+		stream.insert(stream.end(), line, line + length);
+	}
+
+	/*
+		Open a pseudo terminal, returns the master descriptor (-1 on error) and the slave path
+	*/
+	int OpenPseudoTerminal(std::string& slave_path)
+	{
+		int master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0) return -1;
+
+		const char* name = (grantpt(master) == 0 && unlockpt(master) == 0) ? ptsname(master) : nullptr;
+		if (name == nullptr)
+		{
+			close(master);
+			return -1;
+		}
+
+		slave_path = name;
+		return master;
+	}
+
+	/*
+		Write the bytes in chunks of chunk_size with a pause after each, frames and lines end up
+		split across the reads of the port
+	*/
+	bool WriteStream(int master, const uint8_t* data, size_t size, size_t chunk_size, int pause_ms)
+	{
+		for (size_t pos = 0; pos < size;)
+		{
+			size_t end = std::min(size, pos + chunk_size);
+			while (pos < end)
+			{
+				ssize_t n = write(master, data + pos, end - pos);
+				if (n < 0 && errno != EINTR && errno != EAGAIN) return false;
+				if (n > 0) pos += n;
+			}
+			if (pause_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(pause_ms));
+		}
+
+		return true;
+	}
+
+	/*
+		Wait until done() or the timeout, returns done()
+	*/
+	bool WaitFor(const std::function<bool(void)>& done, double seconds)
+	{
+		auto start = std::chrono::steady_clock::now();
+		while (!done() && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		return done();
+	}
+
+	/*
+		Pop every pending sample and compare them with the expected ones, in order. Lines without
+		a timestamp get the host time, only their V and I are compared.
+	*/
+	bool CheckSamples(SampleRing& ring, const std::vector<IVSample>& expected, const std::vector<bool>& timed)
+	{
+		std::vector<IVSample> received(ring.Capacity());
+		size_t count = ring.PopBatch(received.data(), received.size());
+		if (count != expected.size()) return false;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (fabs(received[i].voltage - expected[i].voltage) > SAMPLE_TOLERANCE) return false;
+			if (fabs(received[i].current - expected[i].current) > SAMPLE_TOLERANCE) return false;
+			if (timed[i] && fabs(received[i].timestamp - expected[i].timestamp) > 1e-6) return false;
+		}
+
+		return true;
+	}
+}
+
+int main()
+{
+	std::string slave_path;
+	int master = OpenPseudoTerminal(slave_path);
+	if (master < 0)
+	{
+		fprintf(stderr, "Cannot open a pseudo terminal: %s\n", strerror(errno));
+		return 1;
+	}
+
+	ComStatus status;
+	AsyncCommunication communication;
+	std::atomic<bool> finished(false);
+	std::thread reader([&]()
+	{
+		communication.GetDatafromCOMPort(slave_path, 115200, &status, nullptr);
+		finished = true;
+	});
+
+	// The port flushes its input when it opens, nothing is sent before
+	if (!WaitFor([&]() { return status.connected || finished; }, 5) || !status.connected)
+	{
+		status.stop = true;
+		reader.join();
+		fprintf(stderr, "Cannot open %s: %s\n", slave_path.c_str(), status.error.c_str());
+		close(master);
+		return 1;
+	}
+
+	printf("Mixed stream on %s\n", slave_path.c_str());
+
+	// Good frames, every 20 samples one corrupted frame and two CSV lines (with and without timestamp)
+	const int mixed_samples = 400;
+	std::vector<uint8_t> stream;
+	std::vector<IVSample> expected;
+	std::vector<bool> timed;
+	uint64_t frames = 0, text_lines = 0, crc_errors = 0, bytes = 0;
+	for (int i = 0; i < mixed_samples; i++)
+	{
+		IVSample sample = BoardSample(i);
+		switch (i % 20)
+		{
+		case 7:
+			AppendFrame(stream, sample, true);
+			crc_errors++;
+			continue;
+		case 13:
+			AppendLine(stream, sample, true);
+			text_lines++;
+			break;
+		case 17:
+			AppendLine(stream, sample, false);
+			text_lines++;
+			break;
+		default:
+			AppendFrame(stream, sample, false);
+			frames++;
+			break;
+		}
+		expected.push_back(sample);
+		timed.push_back(i % 20 != 17);
+	}
+
+	// Odd chunks split frames and lines across the reads
+	bool written = WriteStream(master, stream.data(), stream.size(), 37, 1);
+	bytes += stream.size();
+	bool received = WaitFor([&]() { return status.frames == frames && status.text_lines == text_lines; }, 5);
+
+	Check("stream written", written);
+	Check("frames " + std::to_string(status.frames) + " of " + std::to_string(frames), received && status.frames == frames);
+	Check("text lines " + std::to_string(status.text_lines) + " of " + std::to_string(text_lines), status.text_lines == text_lines);
+	Check("crc errors " + std::to_string(status.crc_errors) + " of " + std::to_string(crc_errors), status.crc_errors == crc_errors);
+	Check("samples and their order", CheckSamples(status.samples, expected, timed));
+
+	printf("Ring overflow\n");
+
+	// More frames than the ring holds while the UI does not drain it
+	const int overflow = 1000;
+	int capacity = (int)status.samples.Capacity();
+	stream.clear();
+	for (int i = 0; i < capacity + overflow; i++) AppendFrame(stream, BoardSample(mixed_samples + i), false);
+	frames += capacity + overflow;
+
+	written = WriteStream(master, stream.data(), stream.size(), 1 << 16, 0);
+	bytes += stream.size();
+	received = WaitFor([&]() { return status.frames == frames; }, 10);
+
+	Check("stream written", written);
+	Check("frames " + std::to_string(status.frames) + " of " + std::to_string(frames), received);
+	Check("dropped " + std::to_string(status.dropped) + " of " + std::to_string(overflow), status.dropped == (uint64_t)overflow);
+	Check("ring full", status.samples.Size() == (size_t)capacity);
+
+	expected.clear();
+	timed.assign(capacity, true);
+	for (int i = 0; i < capacity; i++) expected.push_back(BoardSample(mixed_samples + i));
+	Check("oldest samples kept", CheckSamples(status.samples, expected, timed));
+
+	printf("Partial frame\n");
+
+	// The start of a frame waits for its end, the reader stops with it pending
+	stream.clear();
+	AppendFrame(stream, BoardSample(mixed_samples + capacity + overflow), false);
+	written = WriteStream(master, stream.data(), FRAME_SIZE / 2, FRAME_SIZE, 0);
+	bytes += FRAME_SIZE / 2;
+	received = WaitFor([&]() { return status.bytes == bytes; }, 5);
+
+	Check("stream written", written);
+	Check("bytes " + std::to_string(status.bytes) + " of " + std::to_string(bytes), received);
+	Check("half frame not parsed", status.frames == frames && status.crc_errors == crc_errors && status.samples.Size() == 0);
+
+	status.stop = true;
+	reader.join();
+	close(master);
+
+	Check("reader stopped", !status.running && !status.connected && status.error.empty());
+
+	if (failures > 0)
+	{
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int main()
+{
+	printf("com_test needs POSIX pseudo terminals, skipped\n");
+	return 0;
+}
+#endif
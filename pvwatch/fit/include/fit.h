@@ -0,0 +1,139 @@
+#pragma once
+#include <vector>
+
+#include "../../pv/include/pv.h"
+
+// Parameters of the fit: Ipv, ln(I0), Rs, 1 / Rsh and a*Vt
+#define FIT_PARAMETERS 5
+
+namespace PV
+{
+	struct FitOptions
+	{
+		int max_samples = 8192;			// Newest samples kept per module, older ones are dropped
+		int max_iterations = 100;		// Levenberg-Marquardt iterations per refit
+		double tolerance = 1e-6;		// Relative cost decrease (or parameter step) that ends a refit
+		double power_loss_limit = 0.05;	// A module losing more of its maximum power is reported degraded
+	};
+
+	/*
+		Single diode parameters fitted to the measured samples of a module
+	*/
+	struct FitResult
+	{
+		Simd::DiodeParameters diode;	// At the condition of the samples
+		int points;						// Samples fitted
+		int iterations;					// Levenberg-Marquardt iterations of the last refit
+		int evaluations;				// Residual (and Jacobian) evaluations of the last refit
+		bool converged;
+		double rmse;					// Root mean square current residual (A)
+	};
+
+	/*
+		Fitted model against the datasheet model at the same condition
+	*/
+	struct DegradationReport
+	{
+		FitResult fit;
+		Simd::DiodeParameters reference;
+		double rs_ratio;		// Fitted over datasheet series resistance
+		double rsh_ratio;		// Fitted over datasheet shunt resistance
+		double isc_ratio;		// Fitted over datasheet short circuit current
+		double power_ratio;		// Fitted over datasheet maximum power
+		bool degraded;			// power_ratio below 1 - FitOptions::power_loss_limit
+	};
+
+	/*
+		Levenberg-Marquardt fit of the single diode model of one module to measured (V, I) samples
+		taken at one operating condition (G, T).
+
+		The residuals are the model currents at the measured voltages minus the measured currents.
+		Every iteration solves the model currents of all samples in one vectorized batch (warm
+		started from the measurements) and accumulates the normal equations from the analytic
+		Jacobian, dI/dp = (df/dp) / (-df/dI) by implicit differentiation of the single diode
+		equation. The first fit starts from the datasheet model, every refit from the previous
+		fit, so a refit after a few new samples takes a few iterations.
+	*/
+	class DiodeFitter
+	{
+	public:
+		DiodeFitter(const ModelParameters& params, double g, double t_e, const FitOptions& options = FitOptions());
+
+		/*
+			Add measured samples, the oldest are dropped beyond FitOptions::max_samples
+		*/
+		void AddSamples(const double* voltage, const double* current, int count);
+
+		/*
+			Change the condition of the samples, drops them and the previous fit
+		*/
+		void SetCondition(double g, double t_e);
+
+		void Clear(void);
+
+		int Samples(void) const { return this->count; }
+
+		/*
+			Samples added since the last refit
+		*/
+		int PendingSamples(void) const { return this->pending; }
+
+		/*
+			Fit the model to the samples, warm started from the previous fit. Without new samples
+			the previous result is returned as is.
+		*/
+		const FitResult& Refit(void);
+
+		const FitResult& GetResult(void) const { return this->result; }
+
+		/*
+			Compare the last fit with the datasheet model at the condition of the samples
+		*/
+		DegradationReport GetReport(void) const;
+
+	private:
+		ModelParameters params;
+		FitOptions options;
+		double g;
+		double t_e;
+
+		// Ring of the newest samples, their order doesn't matter to the fit
+		std::vector<double> voltage;
+		std::vector<double> current;
+		int count;
+		int next;
+		int pending;
+
+		// Fitted parameters (Ipv, ln(I0), Rs, 1 / Rsh, a*Vt), from the datasheet model before the first fit
+		double x[FIT_PARAMETERS];
+		double lambda;	// Levenberg-Marquardt damping the next refit starts from
+		FitResult result;
+
+		// Scratch of the residual evaluations
+		std::vector<double> model_current;
+		std::vector<double> exponent;
+
+		void ResetParameters(void);
+
+		/*
+			Half the sum of the squared residuals at x, with the normal equations J'J (row major)
+			and J'r. Returns NaN when the model can't be evaluated there.
+		*/
+		double Evaluate(const double* x, double* jtj, double* jtr);
+	};
+
+	/*
+		Single diode parameters of a fit parameter vector
+	*/
+	Simd::DiodeParameters FitDiode(const double* x);
+
+	/*
+		Refit every module with pending samples, the modules are spread over threads (0 uses every core)
+	*/
+	void RefitFleet(std::vector<DiodeFitter>& fitters, int threads = 0);
+
+	/*
+		Refit the fleet and report every module
+	*/
+	std::vector<DegradationReport> FleetReport(std::vector<DiodeFitter>& fitters, int threads = 0);
+}
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+#include "../include/fit.h"
+#include "../../profiler/include/profiler.h"
+
+// Tolerance of the model currents at every evaluation (A), well below any measurement noise
+#define FIT_SOLVE_TOLERANCE 1e-10
+#define FIT_SOLVE_ITERATIONS 50
+
+// Range of the Levenberg-Marquardt damping, beyond the upper end no step decreases the cost
+#define FIT_LAMBDA_MIN 1e-12
+#define FIT_LAMBDA_MAX 1e12
+
+namespace
+{
+	/*
+		Solve the symmetric positive definite system a * x = b of FIT_PARAMETERS unknowns
+		with a Cholesky factorization (a is overwritten). Returns false when a isn't positive definite.
+	*/
+	bool SolveCholesky(double* a, const double* b, double* x)
+	{
+		const int n = FIT_PARAMETERS;
+
+		for (int j = 0; j < n; j++)
+		{
+			double d = a[j * n + j];
+			for (int c = 0; c < j; c++) d -= a[j * n + c] * a[j * n + c];
+			if (!(d > 0)) return false;
+
+			a[j * n + j] = sqrt(d);
+			for (int i = j + 1; i < n; i++)
+			{
+				double s = a[i * n + j];
+				for (int c = 0; c < j; c++) s -= a[i * n + c] * a[j * n + c];
+				a[i * n + j] = s / a[j * n + j];
+			}
+		}
+
+		// L y = b, then L' x = y
+		for (int i = 0; i < n; i++)
+		{
+			double s = b[i];
+			for (int c = 0; c < i; c++) s -= a[i * n + c] * x[c];
+			x[i] = s / a[i * n + i];
+		}
+		for (int i = n - 1; i >= 0; i--)
+		{
+			double s = x[i];
+			for (int c = i + 1; c < n; c++) s -= a[c * n + i] * x[c];
+			x[i] = s / a[i * n + i];
+		}
+
+		return true;
+	}
+
+	/*
+		Keep the parameters physical: no negative currents or resistances
+	*/
+	void Project(double* x)
+	{
+		x[0] = std::max(x[0], 0.0);
+		x[1] = std::min(std::max(x[1], -100.0), 5.0);
+		x[2] = std::max(x[2], 0.0);
+		x[3] = std::max(x[3], 0.0);
+		x[4] = std::max(x[4], 1e-3);
+	}
+
+	/*
+		Run fn(i) for every i below count on threads (0 uses every core)
+	*/
+	void ParallelFor(int count, int threads, const std::function<void(int)>& fn)
+	{
+		int thread_count = (threads > 0) ? threads : (int)std::thread::hardware_concurrency();
+		thread_count = std::max(1, std::min(thread_count, count));
+
+		std::atomic<int> next(0);
+		auto worker = [&]()
+		{
+			int i;
+			while ((i = next++) < count) fn(i);
+		};
+
+		std::vector<std::thread> pool;
+		for (int t = 1; t < thread_count; t++) pool.emplace_back(worker);
+		worker();
+		for (std::thread& thread : pool) thread.join();
+	}
+}
+
+PV::Simd::DiodeParameters PV::FitDiode(const double* x)
+{
+	Simd::DiodeParameters diode;
+	diode.Ipv = x[0];
+	diode.I0 = exp(x[1]);
+	diode.Rs = x[2];
+	diode.Rsh = (x[3] > 0) ? 1 / x[3] : INFINITY;
+	diode.a_vt = x[4];
+	return diode;
+}
+
+PV::DiodeFitter::DiodeFitter(const ModelParameters& params, double g, double t_e, const FitOptions& options)
+{
+	this->params = params;
+	this->options = options;
+	this->options.max_samples = std::max(this->options.max_samples, FIT_PARAMETERS);
+	this->g = g;
+	this->t_e = t_e;
+
+	this->voltage.resize(this->options.max_samples);
+	this->current.resize(this->options.max_samples);
+	this->Clear();
+}
+
+void PV::DiodeFitter::ResetParameters()
+{
+	Simd::DiodeParameters diode = DiodeAtCondition(this->params, this->g, this->t_e);
+	this->x[0] = diode.Ipv;
+	this->x[1] = log(diode.I0);
+	this->x[2] = diode.Rs;
+	this->x[3] = (diode.Rsh > 0) ? 1 / diode.Rsh : 0;
+	this->x[4] = diode.a_vt;
+	Project(this->x);
+
+	this->result = {};
+	this->result.diode = FitDiode(this->x);
+	this->lambda = 1e-3;
+}
+
+void PV::DiodeFitter::Clear()
+{
+	this->count = 0;
+	this->next = 0;
+	this->pending = 0;
+	this->ResetParameters();
+}
+
+void PV::DiodeFitter::SetCondition(double g, double t_e)
+{
+	this->g = g;
+	this->t_e = t_e;
+	this->Clear();
+}
+
+void PV::DiodeFitter::AddSamples(const double* voltage, const double* current, int count)
+{
+	int capacity = (int)this->voltage.size();
+
+	// Only the newest capacity samples can stay
+	if (count > capacity)
+	{
+		voltage += count - capacity;
+		current += count - capacity;
+		count = capacity;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		this->voltage[this->next] = voltage[i];
+		this->current[this->next] = current[i];
+		this->next = (this->next + 1 < capacity) ? this->next + 1 : 0;
+	}
+
+	this->count = std::min(this->count + count, capacity);
+	this->pending += count;
+}
+
+double PV::DiodeFitter::Evaluate(const double* x, double* jtj, double* jtr)
+{
+	const int n = FIT_PARAMETERS;
+	int points = this->count;
+	Simd::DiodeParameters d = FitDiode(x);
+	Simd::Isa isa = Simd::DetectIsa();
+
+	this->model_current.resize(points);
+	this->exponent.resize(points);
+
+	// Model currents of every sample, each warm started from its measurement
+	Simd::SolveCurrentNewton(d, this->voltage.data(), this->model_current.data(), points, d.Ipv, this->current.data(),
+		FIT_SOLVE_ITERATIONS, FIT_SOLVE_TOLERANCE, isa);
+
+	for (int i = 0; i < points; i++) this->exponent[i] = (this->voltage[i] + this->model_current[i] * d.Rs) / d.a_vt;
+	Simd::Exp(this->exponent.data(), this->exponent.data(), points, isa);
+
+	memset(jtj, 0, n * n * sizeof(double));
+	memset(jtr, 0, n * sizeof(double));
+	double cost = 0;
+	double gsh = x[3];
+
+	for (int i = 0; i < points; i++)
+	{
+		double v = this->voltage[i];
+		double c = this->model_current[i];
+		double e = d.I0 * this->exponent[i];
+		double vd = v + c * d.Rs;
+
+		// -df/dI, and dI/dp = (df/dp) / (-df/dI) for Ipv, ln(I0), Rs, 1 / Rsh and a*Vt
+		double inv_df = 1 / (1 + e * d.Rs / d.a_vt + d.Rs * gsh);
+		double jac[FIT_PARAMETERS] = {
+			inv_df,
+			-(e - d.I0) * inv_df,
+			-(e * c / d.a_vt + c * gsh) * inv_df,
+			-vd * inv_df,
+			e * vd / (d.a_vt * d.a_vt) * inv_df
+		};
+
+		double r = c - this->current[i];
+		cost += r * r;
+
+		for (int a = 0; a < n; a++)
+		{
+			jtr[a] += jac[a] * r;
+			for (int b = 0; b <= a; b++) jtj[a * n + b] += jac[a] * jac[b];
+		}
+	}
+
+	for (int a = 0; a < n; a++)
+	{
+		for (int b = a + 1; b < n; b++) jtj[a * n + b] = jtj[b * n + a];
+	}
+
+	return isfinite(cost) ? 0.5 * cost : NAN;
+}
+
+const PV::FitResult& PV::DiodeFitter::Refit()
+{
+	PVWATCH_PROFILE_SCOPE("fit.refit");
+
+	const int n = FIT_PARAMETERS;
+
+	if (this->pending == 0) return this->result;
+	this->pending = 0;
+
+	this->result.points = this->count;
+	this->result.iterations = 0;
+	this->result.evaluations = 0;
+	this->result.converged = false;
+	if (this->count < n) return this->result;
+
+	double jtj[n * n], jtr[n];
+	double cost = this->Evaluate(this->x, jtj, jtr);
+	this->result.evaluations++;
+
+	// A previous fit the new samples can't be evaluated at, start over from the datasheet
+	if (isnan(cost))
+	{
+		this->ResetParameters();
+		this->result.points = this->count;
+		this->result.evaluations = 1;
+		cost = this->Evaluate(this->x, jtj, jtr);
+		this->result.evaluations++;
+		if (isnan(cost)) return this->result;
+	}
+
+	// The damping of the previous fit suits a refit that starts next to its minimum
+	double lambda = this->lambda;
+	double trial[n], trial_jtj[n * n], trial_jtr[n];
+
+	for (int it = 0; it < this->options.max_iterations && !this->result.converged && cost > 0; it++)
+	{
+		this->result.iterations = it + 1;
+
+		// Damped normal equations, scaled by their diagonal (Marquardt)
+		double a[n * n];
+		double rhs[n];
+		double step[n];
+		memcpy(a, jtj, sizeof(a));
+		for (int i = 0; i < n; i++)
+		{
+			a[i * n + i] += lambda * std::max(jtj[i * n + i], 1e-30);
+			rhs[i] = -jtr[i];
+		}
+
+		if (!SolveCholesky(a, rhs, step))
+		{
+			lambda *= 10;
+			if (lambda > FIT_LAMBDA_MAX) break;
+			continue;
+		}
+
+		double relative_step = 0;
+		for (int i = 0; i < n; i++)
+		{
+			trial[i] = this->x[i] + step[i];
+			relative_step = std::max(relative_step, fabs(step[i]) / std::max(fabs(this->x[i]), 1e-12));
+		}
+		Project(trial);
+
+		double trial_cost = this->Evaluate(trial, trial_jtj, trial_jtr);
+		this->result.evaluations++;
+
+		if (trial_cost < cost)
+		{
+			double decrease = (cost - trial_cost) / cost;
+
+			memcpy(this->x, trial, sizeof(trial));
+			memcpy(jtj, trial_jtj, sizeof(jtj));
+			memcpy(jtr, trial_jtr, sizeof(jtr));
+			cost = trial_cost;
+			lambda = std::max(lambda / 10, FIT_LAMBDA_MIN);
+
+			this->result.converged = decrease < this->options.tolerance || relative_step < this->options.tolerance;
+		}
+		else
+		{
+			// No smaller step decreases the cost, the fit is at its minimum
+			lambda *= 10;
+			if (lambda > FIT_LAMBDA_MAX)
+			{
+				this->result.converged = true;
+				break;
+			}
+		}
+	}
+
+	if (cost == 0) this->result.converged = true;
+
+	this->lambda = std::min(std::max(lambda, FIT_LAMBDA_MIN), 1e-3);
+
+	this->result.diode = FitDiode(this->x);
+	this->result.rmse = sqrt(2 * cost / this->count);
+
+	return this->result;
+}
+
+PV::DegradationReport PV::DiodeFitter::GetReport() const
+{
+	DegradationReport report = {};
+	report.fit = this->result;
+	report.reference = DiodeAtCondition(this->params, this->g, this->t_e);
+
+	const Simd::DiodeParameters& fitted = report.fit.diode;
+	const Simd::DiodeParameters& reference = report.reference;
+
+	report.rs_ratio = (reference.Rs > 0) ? fitted.Rs / reference.Rs : 0;
+	report.rsh_ratio = (reference.Rsh > 0) ? fitted.Rsh / reference.Rsh : 0;
+
+	double isc_reference = SolveCurrent(reference, 0, reference.Ipv);
+	report.isc_ratio = (isc_reference > 0) ? SolveCurrent(fitted, 0, fitted.Ipv) / isc_reference : 0;
+
+	double p_reference = SolveMaxPowerPoint(reference).P;
+	report.power_ratio = (p_reference > 0) ? SolveMaxPowerPoint(fitted).P / p_reference : 0;
+
+	report.degraded = report.fit.points > 0 && report.power_ratio < 1 - this->options.power_loss_limit;
+
+	return report;
+}
+
+void PV::RefitFleet(std::vector<DiodeFitter>& fitters, int threads)
+{
+	ParallelFor((int)fitters.size(), threads, [&](int i)
+	{
+		fitters[i].Refit();
+	});
+}
+
+std::vector<PV::DegradationReport> PV::FleetReport(std::vector<DiodeFitter>& fitters, int threads)
+{
+	std::vector<DegradationReport> reports(fitters.size());
+
+	ParallelFor((int)fitters.size(), threads, [&](int i)
+	{
+		fitters[i].Refit();
+		reports[i] = fitters[i].GetReport();
+	});
+
+	return reports;
+}
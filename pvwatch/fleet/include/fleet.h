@@ -0,0 +1,124 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+#include "../../pv/include/pv.h"
+
+// Modules per task of a parallel evaluation, the columns of a block stay in the cache of one core
+#define FLEET_BLOCK 1024
+
+namespace PV
+{
+	struct FleetOptions
+	{
+		int threads = 0;				// 0 uses every core
+		double tolerance = 1e-6;		// Tolerance of the expected currents (A)
+		double outlier_sigma = 5;		// Robust z-score beyond which a residual is an outlier
+		double residual_floor = 0.02;	// Residuals within this fraction of Isc are never outliers
+	};
+
+	/*
+		Work and residual statistics of the last evaluation
+	*/
+	struct FleetStats
+	{
+		int modules;
+		int evaluated;			// Modules with a reported (finite) residual
+		int outliers;
+		int total_iterations;	// Newton iterations summed over the modules
+		int max_iterations;
+		double median_residual;	// Of the relative residuals, (I - I_expected) / Isc
+		double residual_scale;	// Robust standard deviation (1.4826 * MAD) of the relative residuals
+		double elapsed;			// s
+	};
+
+	/*
+		Thousands of monitored modules in contiguous columns (structure of arrays): the model
+		parameters of every module, its last reported operating point (V, I, G, T) and the
+		results of the last evaluation.
+
+		Evaluate() solves the expected current of every module at its reported V, G and T in
+		blocks of FLEET_BLOCK modules spread over threads, every block a single vectorized
+		Newton call with per module parameters warm started from the reported currents. A
+		residual is an outlier when it is more than outlier_sigma robust deviations away from
+		the fleet median, so a condition shared by the fleet (e.g. a biased irradiance sensor)
+		doesn't flag every module.
+	*/
+	class Fleet
+	{
+	public:
+		Fleet();
+
+		void Reserve(int count);
+		void Clear(void);
+
+		/*
+			Add a module, returns its index. Its operating point is unreported until set.
+		*/
+		int Add(const ModelParameters& params);
+
+		int Size(void) const { return (int)this->rs.size(); }
+
+		/*
+			Report the operating point of a module: V (V), I (A), G (W/m2), T (C)
+		*/
+		void SetOperatingPoint(int module, double voltage, double current, double g, double t_e);
+
+		/*
+			Report the operating points of every module, each array has Size() values
+		*/
+		void SetOperatingPoints(const double* voltage, const double* current, const double* g, const double* t_e);
+
+		/*
+			Expected current and power of every reported module, residuals and outliers
+		*/
+		const FleetStats& Evaluate(const FleetOptions& options = FleetOptions());
+
+		const FleetStats& GetStats(void) const { return this->stats; }
+
+		// Results of the last evaluation, unreported modules are 0
+		const double* ExpectedCurrent(void) const { return this->expected_current.data(); }
+		const double* ExpectedPower(void) const { return this->expected_power.data(); }
+		const double* Residual(void) const { return this->residual.data(); }	// Relative, (I - I_expected) / Isc
+		const uint8_t* Outliers(void) const { return this->outlier.data(); }
+
+		/*
+			Indices of the outliers of the last evaluation
+		*/
+		std::vector<int> OutlierModules(void) const;
+
+	private:
+		// Model parameters
+		std::vector<double> ipv_nom;
+		std::vector<double> g_nom;
+		std::vector<double> isc_nom;
+		std::vector<double> i0_num;
+		std::vector<double> voc_nom;
+		std::vector<double> rs;
+		std::vector<double> rsh;
+		std::vector<double> a;
+
+		// Reported operating points
+		std::vector<double> voltage;
+		std::vector<double> current;
+		std::vector<double> g;
+		std::vector<double> t_e;
+		std::vector<uint8_t> reported;
+
+		// Diode parameters at the reported conditions, scratch of Evaluate
+		std::vector<double> ipv;
+		std::vector<double> i0;
+		std::vector<double> a_vt;
+
+		// Results
+		std::vector<double> expected_current;
+		std::vector<double> expected_power;
+		std::vector<double> residual;
+		std::vector<uint8_t> outlier;
+		std::vector<double> sorted;	// Scratch of the residual statistics
+		FleetStats stats;
+
+		std::vector<std::vector<double>*> DoubleColumns(void);
+		void EvaluateBlock(int first, int count, double tolerance, int& total_iterations, int& max_iterations);
+	};
+}
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <thread>
+
+#include "../include/fleet.h"
+#include "../../profiler/include/profiler.h"
+
+// Standard deviations per median absolute deviation of a normal distribution
+#define FLEET_MAD_SCALE 1.4826
+
+PV::Fleet::Fleet()
+{
+	this->stats = {};
+}
+
+std::vector<std::vector<double>*> PV::Fleet::DoubleColumns()
+{
+	return { &this->ipv_nom, &this->g_nom, &this->isc_nom, &this->i0_num, &this->voc_nom, &this->rs, &this->rsh, &this->a,
+		&this->voltage, &this->current, &this->g, &this->t_e, &this->ipv, &this->i0, &this->a_vt,
+		&this->expected_current, &this->expected_power, &this->residual };
+}
+
+void PV::Fleet::Reserve(int count)
+{
+	for (std::vector<double>* column : this->DoubleColumns())
+	{
+		column->reserve(count);
+	}
+	this->reported.reserve(count);
+	this->outlier.reserve(count);
+}
+
+void PV::Fleet::Clear()
+{
+	for (std::vector<double>* column : this->DoubleColumns())
+	{
+		column->clear();
+	}
+	this->reported.clear();
+	this->outlier.clear();
+	this->stats = {};
+}
+
+int PV::Fleet::Add(const ModelParameters& params)
+{
+	this->ipv_nom.push_back(params.Ipv_nom);
+	this->g_nom.push_back(params.G_nom);
+	this->isc_nom.push_back(params.Isc_nom);
+	this->i0_num.push_back(params.I0_num);
+	this->voc_nom.push_back(params.Voc_nom);
+	this->rs.push_back(params.Rs);
+	this->rsh.push_back(params.Rsh);
+	this->a.push_back(params.a);
+
+	this->voltage.push_back(0);
+	this->current.push_back(0);
+	this->g.push_back(0);
+	this->t_e.push_back(params.T_nom);
+	this->reported.push_back(0);
+
+	this->ipv.push_back(0);
+	this->i0.push_back(0);
+	this->a_vt.push_back(0);
+
+	this->expected_current.push_back(0);
+	this->expected_power.push_back(0);
+	this->residual.push_back(0);
+	this->outlier.push_back(0);
+
+	return this->Size() - 1;
+}
+
+void PV::Fleet::SetOperatingPoint(int module, double voltage, double current, double g, double t_e)
+{
+	if (module < 0 || module >= this->Size()) return;
+
+	this->voltage[module] = voltage;
+	this->current[module] = current;
+	this->g[module] = g;
+	this->t_e[module] = t_e;
+	this->reported[module] = 1;
+}
+
+void PV::Fleet::SetOperatingPoints(const double* voltage, const double* current, const double* g, const double* t_e)
+{
+	int count = this->Size();
+	std::copy(voltage, voltage + count, this->voltage.begin());
+	std::copy(current, current + count, this->current.begin());
+	std::copy(g, g + count, this->g.begin());
+	std::copy(t_e, t_e + count, this->t_e.begin());
+	std::fill(this->reported.begin(), this->reported.end(), 1);
+}
+
+void PV::Fleet::EvaluateBlock(int first, int count, double tolerance, int& total_iterations, int& max_iterations)
+{
+	Simd::Isa isa = Simd::DetectIsa();
+
+	// DiodeAtCondition column by column, I0 from one vectorized exp of the block
+	for (int i = first; i < first + count; i++)
+	{
+		this->a_vt[i] = this->a[i] * k * (this->t_e[i] + 273.15) / q;
+		this->ipv[i] = (this->g[i] / this->g_nom[i]) * this->ipv_nom[i];
+		this->i0[i] = this->voc_nom[i] / this->a_vt[i];
+	}
+
+	Simd::Exp(this->i0.data() + first, this->i0.data() + first, count, isa);
+	for (int i = first; i < first + count; i++) this->i0[i] = this->i0_num[i] / (this->rsh[i] * this->i0[i]);
+
+	// Reported currents are next to the expected ones of a healthy module
+	Simd::DiodeColumns columns = { this->ipv.data() + first, this->i0.data() + first, this->rs.data() + first,
+		this->rsh.data() + first, this->a_vt.data() + first };
+	Simd::KernelReport report = Simd::SolveCurrentNewtonColumns(columns, this->voltage.data() + first, this->expected_current.data() + first,
+		count, this->current.data() + first, ITERS_nominal, tolerance, isa);
+
+	for (int i = first; i < first + count; i++)
+	{
+		if (!this->reported[i])
+		{
+			this->expected_current[i] = 0;
+			this->expected_power[i] = 0;
+			this->residual[i] = 0;
+			continue;
+		}
+
+		this->expected_power[i] = this->voltage[i] * this->expected_current[i];
+		this->residual[i] = (this->current[i] - this->expected_current[i]) / this->isc_nom[i];
+	}
+
+	total_iterations = report.total_iterations;
+	max_iterations = report.max_iterations;
+}
+
+const PV::FleetStats& PV::Fleet::Evaluate(const FleetOptions& options)
+{
+	PVWATCH_PROFILE_SCOPE("fleet.evaluate");
+
+	auto start = std::chrono::steady_clock::now();
+	int count = this->Size();
+	int blocks = (count + FLEET_BLOCK - 1) / FLEET_BLOCK;
+
+	std::vector<int> block_total(blocks, 0);
+	std::vector<int> block_max(blocks, 0);
+	std::atomic<int> next(0);
+	auto worker = [&]()
+	{
+		int block;
+		while ((block = next++) < blocks)
+		{
+			int first = block * FLEET_BLOCK;
+			this->EvaluateBlock(first, std::min(FLEET_BLOCK, count - first), options.tolerance, block_total[block], block_max[block]);
+		}
+	};
+
+	int thread_count = (options.threads > 0) ? options.threads : (int)std::thread::hardware_concurrency();
+	thread_count = std::max(1, std::min(thread_count, blocks));
+
+	std::vector<std::thread> pool;
+	for (int t = 1; t < thread_count; t++) pool.emplace_back(worker);
+	worker();
+	for (std::thread& thread : pool) thread.join();
+
+	this->stats = {};
+	this->stats.modules = count;
+	for (int block = 0; block < blocks; block++)
+	{
+		this->stats.total_iterations += block_total[block];
+		this->stats.max_iterations = std::max(this->stats.max_iterations, block_max[block]);
+	}
+
+	// Median and median absolute deviation of the reported residuals, O(n) with nth_element
+	this->sorted.clear();
+	for (int i = 0; i < count; i++)
+	{
+		if (this->reported[i] && isfinite(this->residual[i])) this->sorted.push_back(this->residual[i]);
+	}
+	this->stats.evaluated = (int)this->sorted.size();
+
+	if (!this->sorted.empty())
+	{
+		size_t middle = this->sorted.size() / 2;
+		std::nth_element(this->sorted.begin(), this->sorted.begin() + middle, this->sorted.end());
+		double median = this->sorted[middle];
+
+		for (double& value : this->sorted) value = fabs(value - median);
+		std::nth_element(this->sorted.begin(), this->sorted.begin() + middle, this->sorted.end());
+
+		this->stats.median_residual = median;
+		this->stats.residual_scale = FLEET_MAD_SCALE * this->sorted[middle];
+	}
+
+	double limit = std::max(options.outlier_sigma * this->stats.residual_scale, options.residual_floor);
+	for (int i = 0; i < count; i++)
+	{
+		// A residual that isn't a number (e.g. a NaN report) is an outlier as well
+		bool is_outlier = this->reported[i] && !(fabs(this->residual[i] - this->stats.median_residual) <= limit);
+		this->outlier[i] = is_outlier ? 1 : 0;
+		this->stats.outliers += is_outlier ? 1 : 0;
+	}
+
+	this->stats.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return this->stats;
+}
+
+std::vector<int> PV::Fleet::OutlierModules() const
+{
+	std::vector<int> modules;
+	for (int i = 0; i < this->Size(); i++)
+	{
+		if (this->outlier[i]) modules.push_back(i);
+	}
+	return modules;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	What a job sees of itself while it runs on a worker
+*/
+class JobContext
+{
+public:
+	/*
+		True once the job is cancelled or superseded, long jobs check it at safe points and return
+	*/
+	bool Cancelled(void) const { return this->cancel.load(std::memory_order_relaxed); }
+
+	/*
+		The cancellation flag, for code that polls a flag of its own (e.g. RunYield)
+	*/
+	const std::atomic<bool>& CancelFlag(void) const { return this->cancel; }
+
+	/*
+		Progress of the job from 0 to 1, shown by the UI
+	*/
+	void SetProgress(float progress) { this->progress.store(progress, std::memory_order_relaxed); }
+
+private:
+	friend class JobQueue;
+
+	std::atomic<bool> cancel{ false };
+	std::atomic<float> progress{ 0 };
+};
+
+typedef std::function<void(JobContext&)> JobWork;
+
+/*
+	Completion callback of a job, cancelled is true when it was cancelled (or superseded) before it finished
+*/
+typedef std::function<void(bool cancelled)> JobDone;
+
+/*
+	Pool of worker threads the UI submits its calculations to, the frame loop never waits for one.
+
+	Every job belongs to a channel (e.g. "module" for the displayed module), the jobs of a
+	channel run one at a time. Only the latest request of a channel matters: a new job replaces
+	the one still waiting on its channel, which never runs, and cancels the running one.
+	Cancellation is cooperative, a job returns at its next check of its context.
+	Completion callbacks run on the thread calling PollCompletions(), the UI thread, so they
+	may touch the UI state without locks.
+*/
+class JobQueue
+{
+public:
+	/*
+		threads workers (0 uses every core), at least one per channel that runs long jobs
+		so they never wait for each other
+	*/
+	explicit JobQueue(int threads = 0);
+
+	/*
+		Cancels every job and joins the workers, pending completion callbacks are dropped
+	*/
+	~JobQueue();
+
+	JobQueue(const JobQueue&) = delete;
+	JobQueue& operator=(const JobQueue&) = delete;
+
+	/*
+		Queue work on a channel, done (may be empty) runs on the next PollCompletions() after
+		it finished. With cancel_running false the running job of the channel is left to finish
+		before this one starts. Returns the id of the job.
+	*/
+	uint64_t Submit(const std::string& channel, JobWork work, JobDone done = nullptr, bool cancel_running = true);
+
+	/*
+		Cancel the running and the waiting job of a channel
+	*/
+	void Cancel(const std::string& channel);
+
+	void CancelAll(void);
+
+	/*
+		True while a job of the channel is waiting or running
+	*/
+	bool Busy(const std::string& channel) const;
+
+	/*
+		Progress of the running job of a channel, 0 when idle
+	*/
+	float Progress(const std::string& channel) const;
+
+	/*
+		Run the completion callbacks of the finished jobs, returns their number
+	*/
+	int PollCompletions(void);
+
+	int Threads(void) const { return (int)this->workers.size(); }
+
+private:
+	struct Job
+	{
+		uint64_t id;
+		std::string channel;
+		JobWork work;
+		JobDone done;
+		JobContext context;
+	};
+
+	struct Channel
+	{
+		std::shared_ptr<Job> running;
+		std::shared_ptr<Job> waiting;	// The latest request, it starts when running finishes
+		bool ready = false;				// Listed in ready
+	};
+
+	mutable std::mutex mtx;
+	std::condition_variable wake;
+	bool stopping;
+	uint64_t next_id;
+
+	std::map<std::string, Channel> channels;
+	std::deque<std::string> ready;	// Channels with a waiting job and none running
+
+	// Finished jobs and whether they were cancelled, for PollCompletions
+	std::vector<std::pair<std::shared_ptr<Job>, bool>> completed;
+
+	std::vector<std::thread> workers;
+
+	void Worker(void);
+
+	/*
+		List a channel to start its waiting job, mtx must be held
+	*/
+	void MakeReady(const std::string& name, Channel& channel);
+};
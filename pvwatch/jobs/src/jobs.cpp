@@ -0,0 +1,161 @@
+#include <algorithm>
+
+#include "../include/jobs.h"
+#include "../../profiler/include/profiler.h"
+
+JobQueue::JobQueue(int threads)
+{
+	this->stopping = false;
+	this->next_id = 1;
+
+	int thread_count = (threads > 0) ? threads : (int)std::thread::hardware_concurrency();
+	thread_count = std::max(thread_count, 1);
+
+	for (int t = 0; t < thread_count; t++) this->workers.emplace_back(&JobQueue::Worker, this);
+}
+
+JobQueue::~JobQueue()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->stopping = true;
+
+		for (auto& entry : this->channels)
+		{
+			if (entry.second.running) entry.second.running->context.cancel = true;
+			entry.second.waiting.reset();
+		}
+		this->ready.clear();
+	}
+	this->wake.notify_all();
+
+	for (std::thread& worker : this->workers) worker.join();
+}
+
+void JobQueue::MakeReady(const std::string& name, Channel& channel)
+{
+	if (channel.ready || channel.running || !channel.waiting) return;
+
+	channel.ready = true;
+	this->ready.push_back(name);
+	this->wake.notify_one();
+}
+
+uint64_t JobQueue::Submit(const std::string& channel_name, JobWork work, JobDone done, bool cancel_running)
+{
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->channel = channel_name;
+	job->work = std::move(work);
+	job->done = std::move(done);
+
+	std::lock_guard<std::mutex> lock(this->mtx);
+	job->id = this->next_id++;
+	if (this->stopping) return job->id;
+
+	Channel& channel = this->channels[channel_name];
+
+	// The waiting request is superseded, it completes as cancelled without running
+	if (channel.waiting) this->completed.emplace_back(channel.waiting, true);
+	channel.waiting = job;
+
+	if (cancel_running && channel.running) channel.running->context.cancel = true;
+
+	this->MakeReady(channel_name, channel);
+	return job->id;
+}
+
+void JobQueue::Cancel(const std::string& channel_name)
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	auto entry = this->channels.find(channel_name);
+	if (entry == this->channels.end()) return;
+
+	Channel& channel = entry->second;
+	if (channel.running) channel.running->context.cancel = true;
+	if (channel.waiting)
+	{
+		// A listed channel without a waiting job is skipped by the workers
+		this->completed.emplace_back(channel.waiting, true);
+		channel.waiting.reset();
+	}
+}
+
+void JobQueue::CancelAll()
+{
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		for (auto& entry : this->channels) names.push_back(entry.first);
+	}
+
+	for (const std::string& name : names) this->Cancel(name);
+}
+
+bool JobQueue::Busy(const std::string& channel_name) const
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	auto entry = this->channels.find(channel_name);
+	return entry != this->channels.end() && (entry->second.running || entry->second.waiting);
+}
+
+float JobQueue::Progress(const std::string& channel_name) const
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	auto entry = this->channels.find(channel_name);
+	if (entry == this->channels.end() || !entry->second.running) return 0;
+	return entry->second.running->context.progress.load(std::memory_order_relaxed);
+}
+
+int JobQueue::PollCompletions()
+{
+	std::vector<std::pair<std::shared_ptr<Job>, bool>> finished;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		finished.swap(this->completed);
+	}
+
+	// Outside the lock, a callback may submit the next job
+	for (auto& entry : finished)
+	{
+		if (entry.first->done) entry.first->done(entry.second);
+	}
+
+	return (int)finished.size();
+}
+
+void JobQueue::Worker()
+{
+	std::unique_lock<std::mutex> lock(this->mtx);
+
+	while (true)
+	{
+		this->wake.wait(lock, [this]() { return this->stopping || !this->ready.empty(); });
+		if (this->stopping) return;
+
+		std::string name = this->ready.front();
+		this->ready.pop_front();
+
+		Channel& channel = this->channels[name];
+		channel.ready = false;
+		if (!channel.waiting || channel.running) continue;
+
+		std::shared_ptr<Job> job = channel.waiting;
+		channel.waiting.reset();
+		channel.running = job;
+
+		lock.unlock();
+		{
+			PVWATCH_PROFILE_SCOPE("jobs.run");
+			job->work(job->context);
+		}
+		lock.lock();
+
+		// std::map references stay valid, the channel is never erased
+		channel.running.reset();
+		this->completed.emplace_back(job, job->context.Cancelled());
+		this->MakeReady(name, channel);
+	}
+}
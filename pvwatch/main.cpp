@@ -1,35 +1,102 @@
 #include "app_design/include/app_design.h"
 
 #include <iostream>
-#include <thread>
 #include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "pv/include/pv.h"
+#include "pv/include/pv_simd.h"
 #include "async_com/include/async_com.h"
+#include "capture/include/capture.h"
+#include "yield/include/yield.h"
+#include "mppt/include/mppt.h"
+#include "array/include/array.h"
+#include "fit/include/fit.h"
+#include "plot_lod/include/plot_lod.h"
+#include "jobs/include/jobs.h"
+#include "profiler/include/profiler.h"
 
 
-// PV modules
-PV::PVModule pvModule;
-PV::PVModule pvModuleNominal;
-
-// Real time rendering value pair and Async Communication
-double rt_v[1];
-double rt_i[1];
-double rt_p[1];
+// Real time samples from the Async Communication test thread to the UI
+SampleRing rt_samples(1 << 17);
 
-// Simulation Progress
-float sim_progress = 0;
+// Recording of the acquired samples
+CaptureRecorder rt_recorder;
 
 
 class PVWatchApp : public App
 {
 public:
-    PVWatchApp() = default;
-    ~PVWatchApp() = default;
+    PVWatchApp()
+    {
+        // The module of the input window
+        AddSimulation();
+    }
+
+    ~PVWatchApp()
+    {
+        // The I/O and batch jobs poll flags of their own, the queue joins them once they return
+        com_status.stop = true;
+        replay_status.stop = true;
+        mppt_status.cancel = true;
+        yield_status.cancel = true;
+    }
+
+    /*
+        Curve settings of a Plot click, copied so the job never reads the UI state
+    */
+    struct CurveRequest
+    {
+        float v_oc, i_sc, v_mp, i_mp, g, t_e;
+        int steps, iterations;
+        PV::SolverMethod solver_method;
+        double tolerance;
+        bool use_simd;
+        bool warm_start;
+        PV::InterpolationMode interpolation_mode;
+        PV::GridMode grid_mode;
+        double grid_tolerance;
+    };
+
+    /*
+        A module with its own simulator, the modules are swept side by side to compare them.
+        Its Plot, Clear and sweep jobs run on its own channel, the channels run in parallel.
+    */
+    struct ModuleSimulation
+    {
+        int id;                         // Names the channel and the plotted series
+        CurveRequest request;           // Settings of the last Plot, shown when selected
+        PV::SolverStats solver_stats;   // Convergence report of the last Plot
+        bool plotted = false;           // A Plot finished, the module has a model to sweep
+        PV::Simulator simulator;
+
+        // Plotted curves decimated to the pixels of their plot
+        LineLod iv_lod;
+        LineLod pv_lod;
+
+        std::string Channel() const { return "simulation " + std::to_string(id); }
+        std::string Name() const { return "Module " + std::to_string(id); }
+    };
+
+    static const int max_simulations = 8;
 
     // Application state
     bool show_real_time_pairs = true;
     bool show_nominal_curves = false;
+    int history_depth = 256;
+    int decimation_method = (int)DecimationMethod::MinMax;
+
+    // Trailing history of the received real time pairs
+    SampleHistory rt_history = SampleHistory(256);
+
+    // Plotted series decimated to the pixels of their plot, one cache per series and plot
+    LineLod iv_nominal_lod;
+    LineLod pv_nominal_lod;
+    ScatterLod iv_history_lod;
+    ScatterLod pv_history_lod;
 
     // PV initial parameters
     float v_oc = 35.0;
@@ -41,8 +108,22 @@ public:
     float t_e = PV::T_nominal;
 
     int voltage_steps = 0; // WARNING: This must be always zero as an initial value
-    int prev_voltage_steps = 0;
     int iterrations = 50;
+    int solver_method = (int)PV::SolverMethod::Newton;
+    double tolerance = PV::TOLERANCE_nominal;
+    bool use_simd = true;
+    bool warm_start = true;
+    int interpolation_mode = (int)PV::InterpolationMode::Linear;
+    int grid_mode = (int)PV::GridMode::Uniform;
+    double grid_tolerance = 1e-4;
+
+    // Modules of the comparison, the first one is never removed and feeds the test generator
+    std::vector<std::unique_ptr<ModuleSimulation>> simulations;
+    int selected_simulation = 0;
+    int next_simulation_id = 1;
+
+    // Datasheet curves of the input window at nominal conditions
+    PV::PVModule module_nominal;
 
     // Simulation initial parameters
     float sim_g_start = 800;
@@ -51,19 +132,66 @@ public:
     float sim_t_stop = 40;
     float sim_time_s = 10;
     int sim_steps = 70;
-
-    // Init Simulation Class
-    PV::Simulator simulator;
+    int sim_mode = (int)PV::SimulationMode::RealTime;
+
+    // Energy yield over a weather file
+    char weather_path[256] = "weather.csv";
+    bool weather_ambient = false;
+    PV::YieldStatus yield_status;
+
+    // MPPT emulation over the simulation ramp
+    int mppt_controller = 0;
+    double mppt_rate = 20e3;
+    PV::MpptStatus mppt_status;
+
+    // Series / parallel array with a shaded group of modules
+    int array_modules = 20;
+    int array_strings = 4;
+    int array_shaded = 3;
+    float array_shade_g = 300;
+    std::unique_ptr<PV::PVArray> pv_array;
+
+    // Model fitted to the received real time pairs
+    PV::DegradationReport fit_report = {};
+
+    // Serial port ingestion
+#ifdef _WIN32
+    char com_port[64] = "COM3";
+#else
+    char com_port[64] = "/dev/ttyUSB0";
+#endif
+    int com_baud_rate = 921600;
+    ComStatus com_status;
+
+    // Capture recording and replay
+    char capture_path[256] = "capture.pvc";
+    int capture_source = (int)CaptureSource::TestGenerator;
+    int replay_speed = 0;
+    double replay_start = 0;
+    ReplayStatus replay_status;
+
+    // Profiler overlay
+    char profile_path[256] = "profile.txt";
+    int profile_zone = 0;
+
+    // Background calculations, one worker per channel: nominal, mppt, yield, com, replay, test and
+    // one per module simulation. Declared last, so its workers are joined before the state they use is destroyed.
+    JobQueue jobs = JobQueue(6 + max_simulations);
 
     virtual void StartUp() final
     {
         // Startup Async Communication Thread
-        std::thread t(&AsyncCommunication::Test, AsyncCommunication());
-        t.detach();
+        const PV::PVModule* module = &simulations[0]->simulator.Module();
+        jobs.Submit("test", [module](JobContext& job) { AsyncCommunication().Test(*module, rt_samples, &rt_recorder, job.CancelFlag()); });
     }
 
     virtual void Update() final
     {
+        PVWATCH_PROFILE_SCOPE("app.update");
+
+        // Completion callbacks of the finished jobs run here, on the UI thread
+        jobs.PollCompletions();
+
         if (show_demo_windows)
         {
             ImGui::ShowDemoWindow(&show_demo_windows);
@@ -80,30 +208,155 @@ public:
             ImGui::InputScalar("T Stop", ImGuiDataType_Float, &sim_t_stop, NULL);
             ImGui::InputScalar("Total time", ImGuiDataType_Float, &sim_time_s, NULL);
             ImGui::InputScalar("Steps", ImGuiDataType_S32, &sim_steps, NULL);
+            ImGui::Combo("Mode", &sim_mode, "Real time\0Max speed\0Precomputed\0");
 
             ImGui::Separator();
 
-            if (ImGui::Button("Start"))
+            ModuleSimulation& selected = *simulations[selected_simulation];
+            if (ImGui::Button("Start")) StartSimulation(selected);
+            ImGui::SameLine();
+            if (ImGui::Button("Stop")) jobs.Cancel(selected.Channel());
+            ImGui::SameLine();
+            if (ImGui::Button("Start all"))
             {
-                if (!simulator.thread_active)
+                // Every plotted module under the same sweep, each on its own worker
+                for (auto& simulation : simulations) StartSimulation(*simulation);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Stop all"))
+            {
+                for (auto& simulation : simulations) jobs.Cancel(simulation->Channel());
+            }
+
+            for (auto& simulation : simulations)
+            {
+                ImGui::ProgressBar(simulation->simulator.Progress(), ImVec2(0.0f, 0.0f));
+                ImGui::SameLine();
+                ImGui::Text("%s", simulation->Name().c_str());
+            }
+
+            PV::SimulationTiming timing = selected.simulator.GetTiming();
+            ImGui::Text("Step lateness: mean %.2f ms, max %.2f ms, duration error %.2f ms",
+                1000 * timing.mean_lateness, 1000 * timing.max_lateness, 1000 * timing.duration_error);
+            if (timing.precompute_time > 0) ImGui::Text("Precomputed in %.1f ms", 1000 * timing.precompute_time);
+
+            ImGui::SeparatorText("MPPT Emulation");
+            ImGui::Combo("Controller", &mppt_controller, "Perturb & Observe\0Incremental Conductance\0");
+            ImGui::InputDouble("Controller rate (Hz)", &mppt_rate, 0.0, 0.0, "%.0f");
+            if (!mppt_status.running)
+            {
+                if (ImGui::Button("Run MPPT"))
                 {
-                    std::thread sim_t(
-                        &PV::Simulator::Simulation,
-                        &simulator,
-                        sim_g_start,
-                        sim_g_stop,
-                        sim_t_start,
-                        sim_t_stop,
-                        sim_time_s,
-                        sim_steps
-                    );
-                    sim_t.detach();
+                    PV::MpptOptions options;
+                    options.rate = mppt_rate;
+                    options.duration = sim_time_s;
+                    mppt_status.cancel = false;
+                    mppt_status.running = true;
+
+                    jobs.Submit("mppt", [this, params = PV::ParameterCache::Instance().Get(v_oc, i_sc, v_mp, i_mp, iterrations), controller = mppt_controller,
+                        g_start = sim_g_start, g_stop = sim_g_stop, t_start = sim_t_start, t_stop = sim_t_stop, options](JobContext&)
+                    {
+                        PV::RunMpptJob(params, controller, g_start, g_stop, t_start, t_stop, options, &mppt_status);
+                    });
+                }
+            }
+            else if (ImGui::Button("Cancel MPPT"))
+            {
+                mppt_status.cancel = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mppt_status.result_mtx);
+                const PV::MpptMetrics& result = mppt_status.result;
+                if (result.steps > 0)
+                {
+                    ImGui::Text("%s: efficiency %.3f %%, settling %.2f ms, oscillation loss %.3f %%, ripple %.3f V",
+                        mppt_status.controller.c_str(), 100 * result.efficiency, 1000 * result.settling_time,
+                        100 * result.oscillation_fraction, result.ripple);
+                    ImGui::Text("%llu steps in %.2f s (%.1f M steps/s)", (unsigned long long)result.steps, result.wall_time, result.steps_per_second / 1e6);
+                }
+            }
+
+            ImGui::SeparatorText("Array");
+            ImGui::InputScalar("Modules per string", ImGuiDataType_S32, &array_modules, NULL);
+            ImGui::InputScalar("Strings", ImGuiDataType_S32, &array_strings, NULL);
+            ImGui::InputScalar("Shaded modules", ImGuiDataType_S32, &array_shaded, NULL);
+            ImGui::InputScalar("Shaded G", ImGuiDataType_Float, &array_shade_g, NULL);
+            if (ImGui::Button("Calculate array"))
+            {
+                if (!pv_array || pv_array->ModulesPerString() != array_modules || pv_array->Strings() != array_strings)
+                {
+                    pv_array.reset(new PV::PVArray(PV::ParameterCache::Instance().Get(v_oc, i_sc, v_mp, i_mp, iterrations), array_modules, array_strings));
                 }
+
+                // The first modules of the first string are shaded, the rest at the simulation start
+                pv_array->SetCondition(sim_g_start, sim_t_start);
+                for (int m = 0; m < array_shaded && m < array_modules; m++) pv_array->SetCondition(0, m, array_shade_g, sim_t_start);
+                pv_array->Calculate();
+            }
+            if (pv_array && !pv_array->Peaks().empty())
+            {
+                PV::ArrayPeak mpp = pv_array->MaxPowerPoint();
+                PV::ArrayStats stats = pv_array->GetStats();
+                ImGui::Text("MPP %.1f W at %.1f V, %.2f A (%d local peaks)", mpp.P, mpp.V, mpp.I, (int)pv_array->Peaks().size());
+                ImGui::Text("%d modules, %d curves solved, %d strings summed in %.3f ms",
+                    stats.modules, stats.curves_computed, stats.strings_composed, 1000 * stats.elapsed);
             }
 
+            ImGui::SeparatorText("Model Fit");
+            if (ImGui::Button("Fit received pairs"))
+            {
+                // The pairs are taken as measured at the environmental parameters of the input window
+                PV::DiodeFitter fitter(PV::ParameterCache::Instance().Get(v_oc, i_sc, v_mp, i_mp, iterrations), g, t_e);
+                fitter.AddSamples(rt_history.Voltage(), rt_history.Current(), rt_history.Size());
+                fitter.Refit();
+                fit_report = fitter.GetReport();
+            }
+            if (fit_report.fit.points > 0)
+            {
+                const PV::Simd::DiodeParameters& fitted = fit_report.fit.diode;
+                ImGui::Text("Rs %.3f Ohm (x%.2f), Rsh %.1f Ohm (x%.2f), I0 %.2e A, a*Vt %.3f V",
+                    fitted.Rs, fit_report.rs_ratio, fitted.Rsh, fit_report.rsh_ratio, fitted.I0, fitted.a_vt);
+                ImGui::Text("Pmax x%.3f, Isc x%.3f, rmse %.4f A over %d pairs (%d iterations)%s",
+                    fit_report.power_ratio, fit_report.isc_ratio, fit_report.fit.rmse, fit_report.fit.points,
+                    fit_report.fit.iterations, fit_report.degraded ? ", degraded" : "");
+            }
+
+            ImGui::SeparatorText("Energy Yield");
+            ImGui::InputText("Weather file", weather_path, sizeof(weather_path));
+            ImGui::Checkbox("Ambient temperature (NOCT)", &weather_ambient);
+            if (!yield_status.running)
+            {
+                if (ImGui::Button("Run yield"))
+                {
+                    PV::YieldOptions options;
+                    options.temperature = weather_ambient ? PV::TemperatureInput::Ambient : PV::TemperatureInput::Cell;
+                    yield_status.cancel = false;
+                    yield_status.running = true;
+
+                    jobs.Submit("yield", [this, params = PV::ParameterCache::Instance().Get(v_oc, i_sc, v_mp, i_mp, iterrations),
+                        path = std::string(weather_path), options](JobContext&)
+                    {
+                        PV::RunYieldJob(params, path, options, &yield_status);
+                    });
+                }
+            }
+            else if (ImGui::Button("Cancel"))
+            {
+                yield_status.cancel = true;
+            }
             ImGui::SameLine();
-            if (ImGui::Button("Stop")) simulator.enable_simulation = false;
-            ImGui::ProgressBar(sim_progress, ImVec2(0.0f, 0.0f));
+            ImGui::ProgressBar(yield_status.progress, ImVec2(0.0f, 0.0f));
+            {
+                std::lock_guard<std::mutex> lock(yield_status.result_mtx);
+                const PV::YieldResult& result = yield_status.result;
+                if (!yield_status.error.empty()) ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", yield_status.error.c_str());
+                else if (result.records > 0)
+                {
+                    ImGui::Text("%.1f kWh over %.1f days, %.1f kWh/m2, PR %.3f (%llu records in %.2f s)",
+                        result.energy / 1000, result.duration / 86400, result.insolation / 1000, result.performance_ratio,
+                        (unsigned long long)result.records, result.elapsed);
+                }
+            }
             ImGui::End();
         }
 
@@ -111,6 +364,36 @@ public:
         {
             ImGui::Begin("Input Parameters");
 
+            ImGui::SeparatorText("Module");
+            if (ImGui::BeginCombo("Simulation", simulations[selected_simulation]->Name().c_str()))
+            {
+                for (int s = 0; s < (int)simulations.size(); s++)
+                {
+                    if (ImGui::Selectable(simulations[s]->Name().c_str(), s == selected_simulation) && s != selected_simulation)
+                    {
+                        selected_simulation = s;
+                        SetCurveRequest(simulations[s]->request);
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            if ((int)simulations.size() < max_simulations)
+            {
+                ImGui::SameLine();
+                if (ImGui::Button("Add")) AddSimulation();
+            }
+            // A module is removed once no job of it is left to run
+            if (selected_simulation > 0 && !jobs.Busy(simulations[selected_simulation]->Channel()))
+            {
+                ImGui::SameLine();
+                if (ImGui::Button("Remove"))
+                {
+                    simulations.erase(simulations.begin() + selected_simulation);
+                    selected_simulation--;
+                    SetCurveRequest(simulations[selected_simulation]->request);
+                }
+            }
+
             ImGui::SeparatorText("PV Static IV Params");
             ImGui::InputScalar("Voltage (OC) (V)", ImGuiDataType_Float, &v_oc, NULL);
             ImGui::InputScalar("Current (SC) (A)", ImGuiDataType_Float, &i_sc, NULL);
@@ -124,47 +407,269 @@ public:
             ImGui::SeparatorText("Method Params");
             ImGui::InputScalar("Voltage Steps", ImGuiDataType_S32, &voltage_steps, NULL);
             ImGui::InputScalar("Iterrations / Step", ImGuiDataType_S32, &iterrations, NULL);
+            ImGui::Combo("Solver", &solver_method, "Fixed point\0Newton\0Lambert W\0");
+            ImGui::InputDouble("Tolerance (A)", &tolerance, 0.0, 0.0, "%.1e");
+            ImGui::Checkbox("SIMD kernel", &use_simd);
+            ImGui::SameLine();
+            ImGui::TextDisabled("(%s)", PV::Simd::IsaName(PV::Simd::DetectIsa()));
+            ImGui::Checkbox("Warm start", &warm_start);
+            ImGui::Combo("Interpolation", &interpolation_mode, "Linear\0PCHIP\0");
+            ImGui::Combo("Voltage grid", &grid_mode, "Uniform\0Adaptive\0");
+            if (grid_mode == (int)PV::GridMode::Adaptive) ImGui::InputDouble("Grid error (A)", &grid_tolerance, 0.0, 0.0, "%.1e");
 
             ImGui::Separator();
             ImGui::AlignTextToFramePadding();
+            ModuleSimulation& selected = *simulations[selected_simulation];
             if (ImGui::Button("Plot"))
             {
-                pvModule.CalculateIVPArrays(v_oc, i_sc, v_mp, i_mp, g, t_e, voltage_steps, iterrations);
-                prev_voltage_steps = voltage_steps;
+                // The settings of this click are copied, only the latest click is calculated.
+                // A Plot supersedes a running sweep of the module.
+                CurveRequest request = GetCurveRequest();
+                selected.request = request;
+
+                PV::PVModule* module = &selected.simulator.Module();
+                std::shared_ptr<PV::SolverStats> stats = std::make_shared<PV::SolverStats>();
+                jobs.Submit(selected.Channel(), [module, request, stats](JobContext&)
+                {
+                    module->solver_method = request.solver_method;
+                    module->tolerance = request.tolerance;
+                    module->use_simd = request.use_simd;
+                    module->warm_start = request.warm_start;
+                    module->interpolation_mode = request.interpolation_mode;
+                    module->grid_mode = request.grid_mode;
+                    module->grid_tolerance = request.grid_tolerance;
+                    module->CalculateIVPArrays(request.v_oc, request.i_sc, request.v_mp, request.i_mp, request.g, request.t_e,
+                        request.steps, request.iterations);
+                    *stats = module->GetSolverStats();
+                }, [this, id = selected.id, stats](bool cancelled)
+                {
+                    // The module may be removed by now
+                    ModuleSimulation* simulation = FindSimulation(id);
+                    if (!cancelled && simulation != nullptr)
+                    {
+                        simulation->solver_stats = *stats;
+                        simulation->plotted = true;
+                    }
+                });
             }
 
             ImGui::SameLine();
             if (ImGui::Button("Clear"))
             {
                 voltage_steps = 0;
-                prev_voltage_steps = 0;
-                pvModule.ClearCurrentArray();
+                selected.request.steps = 0;
+                PV::PVModule* module = &selected.simulator.Module();
+                jobs.Submit(selected.Channel(), [module](JobContext&) { module->ClearCurrentArray(); });
             }
 
             ImGui::SameLine();
             ImGui::Button("EXPORT plot");
 
+            if (jobs.Busy(selected.Channel()))
+            {
+                ImGui::SameLine();
+                ImGui::TextDisabled("(calculating)");
+            }
+
+            const PV::SolverStats& solver_stats = selected.solver_stats;
+            ImGui::Text("Solver: %d points, %d iters (max %d / point), %d unconverged, residual %.2e A",
+                solver_stats.points, solver_stats.total_iterations, solver_stats.max_iterations, solver_stats.unconverged_points, solver_stats.max_residual);
+
+            PV::MaxPowerPoint mpp = PV::SolveMaxPowerPoint(PV::ParameterCache::Instance().Get(v_oc, i_sc, v_mp, i_mp, iterrations), g, t_e);
+            ImGui::Text("MPP: %.3f V, %.3f A, %.2f W", mpp.V, mpp.I, mpp.P);
+
+            ImGui::SeparatorText("Serial Port");
+            ImGui::InputText("Port", com_port, sizeof(com_port));
+            ImGui::InputScalar("Baud rate", ImGuiDataType_S32, &com_baud_rate, NULL);
+            if (!com_status.running)
+            {
+                if (ImGui::Button("Connect"))
+                {
+                    com_status.stop = false;
+                    com_status.running = true;
+                    {
+                        std::lock_guard<std::mutex> lock(com_status.error_mtx);
+                        com_status.error.clear();
+                    }
+
+                    jobs.Submit("com", [this, port = std::string(com_port), baud_rate = com_baud_rate](JobContext&)
+                    {
+                        AsyncCommunication().GetDatafromCOMPort(port, baud_rate, &com_status, &rt_recorder);
+                    });
+                }
+            }
+            else if (ImGui::Button("Disconnect"))
+            {
+                com_status.stop = true;
+            }
+            ImGui::SameLine();
+            ImGui::Text("%s, %llu frames, %llu lines, %llu CRC errors, %llu dropped",
+                com_status.connected ? "Connected" : "Closed",
+                (unsigned long long)com_status.frames, (unsigned long long)com_status.text_lines,
+                (unsigned long long)com_status.crc_errors, (unsigned long long)com_status.dropped);
+            {
+                std::lock_guard<std::mutex> lock(com_status.error_mtx);
+                if (!com_status.error.empty()) ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", com_status.error.c_str());
+            }
+
+            ImGui::SeparatorText("Capture");
+            ImGui::InputText("Capture file", capture_path, sizeof(capture_path));
+            // One source per recording, the test generator and the device have their own clocks
+            ImGui::Combo("Record source", &capture_source, "Test generator\0Serial port\0");
+            if (!rt_recorder.IsRecording())
+            {
+                if (ImGui::Button("Record")) rt_recorder.Start(capture_path, (CaptureSource)capture_source);
+            }
+            else if (ImGui::Button("Stop recording"))
+            {
+                rt_recorder.Stop();
+            }
+            ImGui::SameLine();
+            ImGui::Text("%llu samples recorded", (unsigned long long)rt_recorder.RecordCount());
+            {
+                std::string capture_error = rt_recorder.Error();
+                if (!capture_error.empty()) ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", capture_error.c_str());
+            }
+
+            ImGui::Combo("Replay speed", &replay_speed, "1x\0" "10x\0" "100x\0" "Max\0");
+            ImGui::InputDouble("Replay from (s)", &replay_start);
+            if (!replay_status.running)
+            {
+                if (ImGui::Button("Replay"))
+                {
+                    const double speeds[] = { 1.0, 10.0, 100.0, 0.0 };
+                    replay_status.stop = false;
+                    replay_status.running = true;
+                    {
+                        std::lock_guard<std::mutex> lock(replay_status.error_mtx);
+                        replay_status.error.clear();
+                    }
+
+                    jobs.Submit("replay", [this, path = std::string(capture_path), speed = speeds[replay_speed], start = replay_start](JobContext&)
+                    {
+                        ReplayCapture(path, speed, start, &replay_status);
+                    });
+                }
+            }
+            else if (ImGui::Button("Stop replay"))
+            {
+                replay_status.stop = true;
+            }
+            ImGui::SameLine();
+            ImGui::ProgressBar((float)replay_status.progress, ImVec2(0.0f, 0.0f));
+            {
+                std::lock_guard<std::mutex> lock(replay_status.error_mtx);
+                if (!replay_status.error.empty()) ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", replay_status.error.c_str());
+            }
+
             ImGui::SeparatorText("GUI Settings");
             ImGui::Checkbox("Show real-time pairs", &show_real_time_pairs);
+            if (ImGui::InputScalar("History depth", ImGuiDataType_S32, &history_depth, NULL)) rt_history.SetDepth(history_depth);
+            if (ImGui::Combo("Curve decimation", &decimation_method, "Min-max\0LTTB\0"))
+            {
+                for (LineLod* lod : { &iv_nominal_lod, &pv_nominal_lod }) lod->SetMethod((DecimationMethod)decimation_method);
+                for (auto& simulation : simulations)
+                {
+                    simulation->iv_lod.SetMethod((DecimationMethod)decimation_method);
+                    simulation->pv_lod.SetMethod((DecimationMethod)decimation_method);
+                }
+            }
             if (ImGui::Checkbox("Show Nominal Curves", &show_nominal_curves))
             {
                 // Create the nominal curves
-                pvModuleNominal.CalculateIVPArrays(
-                    v_oc,
-                    i_sc,
-                    v_mp,
-                    i_mp,
-                    PV::G_nominal,
-                    PV::T_nominal,
-                    PV::STEPS_nominal,
-                    PV::ITERS_nominal
-                );
-            }
-
-            // ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+                jobs.Submit("nominal", [this, v_oc = v_oc, i_sc = i_sc, v_mp = v_mp, i_mp = i_mp](JobContext&)
+                {
+                    module_nominal.CalculateIVPArrays(
+                        v_oc,
+                        i_sc,
+                        v_mp,
+                        i_mp,
+                        PV::G_nominal,
+                        PV::T_nominal,
+                        PV::STEPS_nominal,
+                        PV::ITERS_nominal
+                    );
+                });
+            }
+
+            ImGuiIO& io = ImGui::GetIO();
+            ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+            ImGui::Checkbox("Show profiler", &show_profiler_window);
             ImGui::End();
         }
 
+        if (show_profiler_window)
+        {
+            ImGui::Begin("Profiler", &show_profiler_window);
+
+            if (!Profiler::Enabled())
+            {
+                ImGui::TextWrapped("Profiling is compiled out, build with PVWATCH_PROFILE defined to enable the timers.");
+            }
+            else
+            {
+                std::vector<ProfileZoneStats> zones = Profiler::Snapshot();
+
+                if (ImGui::Button("Reset")) Profiler::Reset();
+                ImGui::SameLine();
+                if (ImGui::Button("Dump")) Profiler::Dump(profile_path);
+                ImGui::SameLine();
+                ImGui::InputText("##profile_path", profile_path, sizeof(profile_path));
+
+                if (ImGui::BeginTable("Zones", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+                {
+                    const char* headers[] = { "Zone", "Count", "Total (ms)", "Mean (us)", "p50 (us)", "p99 (us)", "Max (us)" };
+                    for (const char* header : headers) ImGui::TableSetupColumn(header);
+                    ImGui::TableHeadersRow();
+
+                    for (int z = 0; z < (int)zones.size(); z++)
+                    {
+                        const ProfileZoneStats& zone = zones[z];
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        if (ImGui::Selectable(zone.name.c_str(), profile_zone == z, ImGuiSelectableFlags_SpanAllColumns)) profile_zone = z;
+                        ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)zone.count);
+                        ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e3 * zone.total);
+                        ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e6 * zone.mean);
+                        ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e6 * zone.p50);
+                        ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e6 * zone.p99);
+                        ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e6 * zone.max);
+                    }
+                    ImGui::EndTable();
+                }
+
+                // Duration histogram of the selected zone, log2 buckets (the first one starts at 0)
+                if (profile_zone < (int)zones.size() && ImPlot::BeginPlot("Durations", ImVec2(-1, -1)))
+                {
+                    const ProfileZoneStats& zone = zones[profile_zone];
+                    double bucket_us[PROFILER_BUCKETS];
+                    double counts[PROFILER_BUCKETS];
+                    for (int b = 0; b < PROFILER_BUCKETS; b++)
+                    {
+                        bucket_us[b] = 1e6 * Profiler::BucketSeconds(b);
+                        counts[b] = (double)zone.histogram[b];
+                    }
+
+                    ImPlot::SetupAxes("Duration (us)", "Count", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+                    ImPlot::SetupAxisScale(ImAxis_X1, ImPlotScale_Log10);
+                    ImPlot::PlotStairs(zone.name.c_str(), bucket_us + 1, counts + 1, PROFILER_BUCKETS - 1);
+                    ImPlot::EndPlot();
+                }
+            }
+
+            ImGui::End();
+        }
+
+        // Receive the real time pairs of this frame, never blocks the producers
+        rt_history.Drain(rt_samples);
+        rt_history.Drain(com_status.samples);
+        rt_history.Drain(replay_status.samples);
+
+        // Pin the latest curves for this frame, the simulation jobs may publish new ones meanwhile
+        std::vector<PV::CurvePublisher::Handle> curves;
+        for (auto& simulation : simulations) curves.push_back(simulation->simulator.Module().AcquireSnapshot());
+        PV::CurvePublisher::Handle curve_nominal = module_nominal.AcquireSnapshot();
+
         if (show_current_voltage_plot_window)
         {
             ImGui::Begin("Current - Voltage Plot");
@@ -176,16 +681,33 @@ public:
 
                 ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, 0.20f);
 
-                ImPlot::PlotShaded("I-V plot", pvModule.GetVoltageArray(), pvModule.GetCurrentArray(), prev_voltage_steps);
-                ImPlot::PlotLine("I-V plot", pvModule.GetVoltageArray(), pvModule.GetCurrentArray(), prev_voltage_steps);
+                PlotView view = CurrentPlotView();
+
+                for (int s = 0; s < (int)simulations.size(); s++)
+                {
+                    if (!curves[s]) continue;
+
+                    LineLod& lod = simulations[s]->iv_lod;
+                    std::string label = "I-V " + simulations[s]->Name();
+                    lod.Update(curves[s]->voltage, curves[s]->current, curves[s]->steps, curves[s]->version, view);
+                    ImPlot::PlotShaded(label.c_str(), lod.X(), lod.Y(), lod.Size());
+                    ImPlot::PlotLine(label.c_str(), lod.X(), lod.Y(), lod.Size());
+                }
 
                 // Show real time
-                if (show_real_time_pairs) ImPlot::PlotScatter("Real Time (IV)", rt_v, rt_i, 1);
+                if (show_real_time_pairs && rt_history.Size() > 0)
+                {
+                    IVSample latest = rt_history.Latest();
+                    iv_history_lod.Update(rt_history.Voltage(), rt_history.Current(), rt_history.Size(), rt_history.Offset(), rt_history.Appended(), view);
+                    ImPlot::PlotScatter("Real Time History (IV)", iv_history_lod.X(), iv_history_lod.Y(), iv_history_lod.Size());
+                    ImPlot::PlotScatter("Real Time (IV)", &latest.voltage, &latest.current, 1);
+                }
 
-                if (show_nominal_curves)
+                if (show_nominal_curves && curve_nominal)
                 {
-                    ImPlot::PlotShaded("I-V plot Nominal", pvModuleNominal.GetVoltageArray(), pvModuleNominal.GetCurrentArray(), PV::STEPS_nominal);
-                    ImPlot::PlotLine("I-V plot Nominal", pvModuleNominal.GetVoltageArray(), pvModuleNominal.GetCurrentArray(), PV::STEPS_nominal);
+                    iv_nominal_lod.Update(curve_nominal->voltage, curve_nominal->current, curve_nominal->steps, curve_nominal->version, view);
+                    ImPlot::PlotShaded("I-V plot Nominal", iv_nominal_lod.X(), iv_nominal_lod.Y(), iv_nominal_lod.Size());
+                    ImPlot::PlotLine("I-V plot Nominal", iv_nominal_lod.X(), iv_nominal_lod.Y(), iv_nominal_lod.Size());
                 }
 
                 ImPlot::EndPlot();
@@ -203,16 +725,33 @@ public:
 
                 ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, 0.20f);
 
-                ImPlot::PlotShaded("P-V plot", pvModule.GetVoltageArray(), pvModule.GetPowerArray(), prev_voltage_steps);
-                ImPlot::PlotLine("P-V plot", pvModule.GetVoltageArray(), pvModule.GetPowerArray(), prev_voltage_steps);
+                PlotView view = CurrentPlotView();
+
+                for (int s = 0; s < (int)simulations.size(); s++)
+                {
+                    if (!curves[s]) continue;
+
+                    LineLod& lod = simulations[s]->pv_lod;
+                    std::string label = "P-V " + simulations[s]->Name();
+                    lod.Update(curves[s]->voltage, curves[s]->power, curves[s]->steps, curves[s]->version, view);
+                    ImPlot::PlotShaded(label.c_str(), lod.X(), lod.Y(), lod.Size());
+                    ImPlot::PlotLine(label.c_str(), lod.X(), lod.Y(), lod.Size());
+                }
 
                 // Show real time
-                if (show_real_time_pairs) ImPlot::PlotScatter("Real Time (PV)", rt_v, rt_p, 1);
+                if (show_real_time_pairs && rt_history.Size() > 0)
+                {
+                    IVSample latest = rt_history.Latest();
+                    pv_history_lod.Update(rt_history.Voltage(), rt_history.Power(), rt_history.Size(), rt_history.Offset(), rt_history.Appended(), view);
+                    ImPlot::PlotScatter("Real Time History (PV)", pv_history_lod.X(), pv_history_lod.Y(), pv_history_lod.Size());
+                    ImPlot::PlotScatter("Real Time (PV)", &latest.voltage, &latest.power, 1);
+                }
 
-                if (show_nominal_curves)
+                if (show_nominal_curves && curve_nominal)
                 {
-                    ImPlot::PlotShaded("P-V plot Nominal", pvModuleNominal.GetVoltageArray(), pvModuleNominal.GetPowerArray(), PV::STEPS_nominal);
-                    ImPlot::PlotLine("P-V plot Nominal", pvModuleNominal.GetVoltageArray(), pvModuleNominal.GetPowerArray(), PV::STEPS_nominal);
+                    pv_nominal_lod.Update(curve_nominal->voltage, curve_nominal->power, curve_nominal->steps, curve_nominal->version, view);
+                    ImPlot::PlotShaded("P-V plot Nominal", pv_nominal_lod.X(), pv_nominal_lod.Y(), pv_nominal_lod.Size());
+                    ImPlot::PlotLine("P-V plot Nominal", pv_nominal_lod.X(), pv_nominal_lod.Y(), pv_nominal_lod.Size());
                 }
 
                 ImPlot::EndPlot();
@@ -222,11 +761,98 @@ public:
     }
 
 private:
+    CurveRequest GetCurveRequest() const
+    {
+        return { v_oc, i_sc, v_mp, i_mp, g, t_e, voltage_steps, iterrations, (PV::SolverMethod)solver_method, tolerance, use_simd, warm_start,
+            (PV::InterpolationMode)interpolation_mode, (PV::GridMode)grid_mode, grid_tolerance };
+    }
+
+    /*
+        Show the settings of a module in the input window
+    */
+    void SetCurveRequest(const CurveRequest& request)
+    {
+        v_oc = request.v_oc;
+        i_sc = request.i_sc;
+        v_mp = request.v_mp;
+        i_mp = request.i_mp;
+        g = request.g;
+        t_e = request.t_e;
+        voltage_steps = request.steps;
+        iterrations = request.iterations;
+        solver_method = (int)request.solver_method;
+        tolerance = request.tolerance;
+        use_simd = request.use_simd;
+        warm_start = request.warm_start;
+        interpolation_mode = (int)request.interpolation_mode;
+        grid_mode = (int)request.grid_mode;
+        grid_tolerance = request.grid_tolerance;
+    }
+
+    /*
+        Add a module to the comparison with the settings of the input window and select it,
+        it needs a Plot before it can be swept
+    */
+    void AddSimulation()
+    {
+        std::unique_ptr<ModuleSimulation> simulation(new ModuleSimulation());
+        simulation->id = next_simulation_id++;
+        simulation->request = GetCurveRequest();
+        simulation->solver_stats = {};
+        simulation->iv_lod.SetMethod((DecimationMethod)decimation_method);
+        simulation->pv_lod.SetMethod((DecimationMethod)decimation_method);
+
+        simulations.push_back(std::move(simulation));
+        selected_simulation = (int)simulations.size() - 1;
+    }
+
+    ModuleSimulation* FindSimulation(int id)
+    {
+        for (auto& simulation : simulations)
+        {
+            if (simulation->id == id) return simulation.get();
+        }
+        return nullptr;
+    }
+
+    /*
+        Sweep a module with the parameters of the simulation window, supersedes its running job.
+        Modules without a Plot have no model yet and are skipped.
+    */
+    void StartSimulation(ModuleSimulation& simulation)
+    {
+        if (!simulation.plotted) return;
+
+        PV::Simulator* simulator = &simulation.simulator;
+
+        // The modules share the cores for their precomputed curves
+        int threads = std::max(1, (int)std::thread::hardware_concurrency() / (int)simulations.size());
+
+        jobs.Submit(simulation.Channel(), [simulator, mode = (PV::SimulationMode)sim_mode, threads, g_start = sim_g_start, g_stop = sim_g_stop,
+            t_start = sim_t_start, t_stop = sim_t_stop, time_s = sim_time_s, steps = sim_steps](JobContext& job)
+        {
+            simulator->mode = mode;
+            simulator->threads = threads;
+            simulator->Simulation(g_start, g_stop, t_start, t_stop, time_s, steps, &job.CancelFlag());
+        });
+    }
+
+    /*
+        Visible range and pixels of the current plot, after its axes are set up
+    */
+    static PlotView CurrentPlotView()
+    {
+        ImPlotRect limits = ImPlot::GetPlotLimits();
+        ImVec2 size = ImPlot::GetPlotSize();
+        return { limits.X.Min, limits.X.Max, limits.Y.Min, limits.Y.Max, (int)size.x, (int)size.y };
+    }
+
     bool show_demo_windows = false;
     bool show_simulation_window = true;
     bool show_parameter_window = true;
     bool show_current_voltage_plot_window = true;
     bool show_power_voltage_plot_window = true;
+    bool show_profiler_window = Profiler::Enabled();
 };
 
 int main(int, char**)
@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "../../pv/include/pv.h"
+
+namespace PV
+{
+	/*
+		What a controller measures at its input every step
+	*/
+	struct MpptMeasurement
+	{
+		double time;	// Simulated time (s)
+		double V;
+		double I;
+	};
+
+	/*
+		Maximum power point tracking algorithm, called once per controller period with the
+		latest measurement. Returns the voltage reference of the next period.
+		Implement it to emulate other algorithms.
+	*/
+	class MpptController
+	{
+	public:
+		virtual ~MpptController() = default;
+
+		virtual const char* Name(void) const = 0;
+
+		/*
+			Start tracking from v_start, v_max is the highest reference allowed
+		*/
+		virtual void Reset(double v_start, double v_max) = 0;
+
+		virtual double Step(const MpptMeasurement& measurement) = 0;
+	};
+
+	/*
+		Perturb and observe (hill climbing) with a fixed voltage step
+	*/
+	class PerturbObserve : public MpptController
+	{
+	public:
+		explicit PerturbObserve(double step = 0.1);
+
+		const char* Name(void) const override { return "Perturb & Observe"; }
+		void Reset(double v_start, double v_max) override;
+		double Step(const MpptMeasurement& measurement) override;
+
+	private:
+		double step;
+		double v_max;
+		double v_ref;
+		double p_prev;
+		double direction;
+		bool first;
+	};
+
+	/*
+		Incremental conductance on the relative slope s = (dP/dV) / (P/V) = 1 + (V/I) * dI/dV,
+		zero at the maximum power point and independent of the size of the module.
+		The reference moves by step * s (at most step), so the steps shrink towards the MPP, and is
+		held while |s| < threshold. A held reference probes a small step when the current changes.
+	*/
+	class IncrementalConductance : public MpptController
+	{
+	public:
+		explicit IncrementalConductance(double step = 0.1, double threshold = 0.01);
+
+		const char* Name(void) const override { return "Incremental Conductance"; }
+		void Reset(double v_start, double v_max) override;
+		double Step(const MpptMeasurement& measurement) override;
+
+	private:
+		double step;
+		double threshold;
+		double v_max;
+		double v_ref;
+		double v_prev;
+		double i_prev;
+		bool first;
+	};
+
+	/*
+		Operating condition over the simulated time: G (W/m2) and T (C) at time (s)
+	*/
+	typedef std::function<void(double time, double& g, double& t_e)> ConditionProfile;
+
+	/*
+		Linear G and T ramp over duration (s), the sweep of PV::Simulator
+	*/
+	ConditionProfile RampProfile(double G_start, double G_stop, double T_start, double T_stop, double duration);
+
+	struct MpptOptions
+	{
+		double rate = 20e3;					// Controller rate (Hz)
+		double duration = 60;				// Simulated time (s)
+		double condition_interval = 0.01;	// The profile (and the reference MPP) is sampled every interval (s)
+		double v_start = 0;					// Initial reference, 0 starts at half the nominal Voc
+		double tolerance = 1e-6;			// Current tolerance of the plant solve (A)
+		double settle_band = 0.99;			// Tracked power / MPP power that counts as settled
+		double settle_window = 0.1;			// Time the power must stay in the band (s)
+	};
+
+	struct MpptMetrics
+	{
+		uint64_t steps;				// Controller steps
+		double simulated_time;		// s
+		double energy;				// Tracked energy (Wh)
+		double available_energy;	// Energy at the maximum power point (Wh)
+		double efficiency;			// energy / available_energy
+		double settling_time;		// First entry in the settle band, -1 when never settled (s)
+		double oscillation_loss;	// Energy lost after settling (Wh)
+		double oscillation_fraction;// Loss after settling / available energy after settling
+		double ripple;				// RMS distance of the reference from Vmp after settling (V)
+		double wall_time;			// s
+		double steps_per_second;	// Controller steps per wall clock second
+	};
+
+	/*
+		Run a controller in closed loop against the model. Simulated time advances one
+		controller period per step, independent of the wall clock. The converter is ideal:
+		the module voltage follows the reference of the previous step.
+	*/
+	MpptMetrics RunMppt(const ModelParameters& params, MpptController& controller, const ConditionProfile& profile,
+		const MpptOptions& options, std::atomic<bool>* cancel = nullptr);
+
+	/*
+		Shared state of an emulation run on its own thread, owned by the UI
+	*/
+	struct MpptStatus
+	{
+		std::atomic<bool> cancel{ false };
+		std::atomic<bool> running{ false };
+
+		std::mutex result_mtx;
+		MpptMetrics result = {};
+		std::string controller;
+	};
+
+	/*
+		RunMppt of one of the built in controllers (0: P&O, 1: IncCond) over a ramp, for a thread
+	*/
+	void RunMpptJob(ModelParameters params, int controller, double G_start, double G_stop, double T_start, double T_stop,
+		MpptOptions options, MpptStatus* status);
+}
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <memory>
+
+#include "../include/mppt.h"
+
+namespace
+{
+	inline double Clamp(double value, double low, double high)
+	{
+		return std::min(std::max(value, low), high);
+	}
+}
+
+PV::PerturbObserve::PerturbObserve(double step)
+{
+	this->step = step;
+	this->Reset(0, 0);
+}
+
+void PV::PerturbObserve::Reset(double v_start, double v_max)
+{
+	this->v_max = v_max;
+	this->v_ref = v_start;
+	this->p_prev = 0;
+	this->direction = 1;
+	this->first = true;
+}
+
+double PV::PerturbObserve::Step(const MpptMeasurement& measurement)
+{
+	double p = measurement.V * measurement.I;
+
+	// Keep climbing while the power rises, turn around when it drops
+	if (!this->first && p < this->p_prev) this->direction = -this->direction;
+	this->first = false;
+	this->p_prev = p;
+
+	this->v_ref = Clamp(this->v_ref + this->direction * this->step, 0, this->v_max);
+	return this->v_ref;
+}
+
+PV::IncrementalConductance::IncrementalConductance(double step, double threshold)
+{
+	this->step = step;
+	this->threshold = threshold;
+	this->Reset(0, 0);
+}
+
+void PV::IncrementalConductance::Reset(double v_start, double v_max)
+{
+	this->v_max = v_max;
+	this->v_ref = v_start;
+	this->v_prev = 0;
+	this->i_prev = 0;
+	this->first = true;
+}
+
+double PV::IncrementalConductance::Step(const MpptMeasurement& measurement)
+{
+	double v = measurement.V;
+	double i = measurement.I;
+
+	// Smallest move of the reference, also the probe of a held reference
+	double probe = this->step * this->threshold;
+
+	if (this->first)
+	{
+		this->v_ref += this->step;
+	}
+	else if (i <= 0)
+	{
+		// Beyond the open circuit voltage
+		this->v_ref -= this->step;
+	}
+	else
+	{
+		double dv = v - this->v_prev;
+		double di = i - this->i_prev;
+
+		if (dv == 0)
+		{
+			// Reference held, a change of the condition is probed with a small step,
+			// the slope measured over it moves the reference from the next period on
+			if (di > 0) this->v_ref += probe;
+			else if (di < 0) this->v_ref -= probe;
+		}
+		else
+		{
+			// (dP/dV) / (P/V) = 1 + (V/I) * dI/dV, zero at the maximum power point
+			double slope = 1 + v / i * (di / dv);
+			if (fabs(slope) >= this->threshold) this->v_ref += this->step * Clamp(slope, -1, 1);
+		}
+	}
+
+	this->first = false;
+	this->v_prev = v;
+	this->i_prev = i;
+
+	this->v_ref = Clamp(this->v_ref, 0, this->v_max);
+	return this->v_ref;
+}
+
+PV::ConditionProfile PV::RampProfile(double G_start, double G_stop, double T_start, double T_stop, double duration)
+{
+	return [=](double time, double& g, double& t_e)
+	{
+		double fraction = (duration > 0) ? Clamp(time / duration, 0, 1) : 1;
+		g = G_start + (G_stop - G_start) * fraction;
+		t_e = T_start + (T_stop - T_start) * fraction;
+	};
+}
+
+PV::MpptMetrics PV::RunMppt(const ModelParameters& params, MpptController& controller, const ConditionProfile& profile,
+	const MpptOptions& options, std::atomic<bool>* cancel)
+{
+	auto wall_start = std::chrono::steady_clock::now();
+
+	MpptMetrics metrics = {};
+	metrics.settling_time = -1;
+
+	double dt = 1.0 / options.rate;
+	uint64_t steps = (uint64_t)(options.duration * options.rate);
+	uint64_t update_every = std::max<uint64_t>(1, (uint64_t)llround(options.condition_interval * options.rate));
+
+	double v_max = 1.5 * params.Voc_nom;
+	double v_ref = (options.v_start > 0) ? options.v_start : 0.5 * params.Voc_nom;
+	controller.Reset(v_ref, v_max);
+
+	Simd::DiodeParameters diode = {};
+	MaxPowerPoint mpp = {};
+	double current = 0;
+
+	double energy = 0;
+	double available = 0;
+	double settled_available = 0;
+	double settled_loss = 0;
+	double ripple_sum = 0;
+	uint64_t settled_steps = 0;
+	double band_entry = -1;
+
+	uint64_t step = 0;
+	for (; step < steps; step++)
+	{
+		double time = step * dt;
+
+		// The condition changes slowly compared to the controller, sample it on its own interval
+		if (step % update_every == 0)
+		{
+			if (cancel != nullptr && *cancel) break;
+
+			double g, t_e;
+			profile(time, g, t_e);
+			diode = DiodeAtCondition(params, g, t_e);
+			mpp = SolveMaxPowerPoint(params, g, t_e);
+			if (step == 0) current = diode.Ipv;
+		}
+
+		// Plant: the module at the reference voltage, warm started from the last step
+		double voltage = v_ref;
+		current = SolveCurrent(diode, voltage, current, options.tolerance);
+		double i_out = std::max(current, 0.0);
+		double power = voltage * i_out;
+
+		energy += power * dt;
+		available += mpp.P * dt;
+
+		if (metrics.settling_time < 0)
+		{
+			if (power >= options.settle_band * mpp.P)
+			{
+				if (band_entry < 0) band_entry = time;
+				if (time - band_entry >= options.settle_window) metrics.settling_time = band_entry;
+			}
+			else
+			{
+				band_entry = -1;
+			}
+		}
+		else
+		{
+			settled_available += mpp.P * dt;
+			settled_loss += (mpp.P - power) * dt;
+			ripple_sum += (voltage - mpp.V) * (voltage - mpp.V);
+			settled_steps++;
+		}
+
+		v_ref = controller.Step({ time, voltage, i_out });
+	}
+
+	metrics.steps = step;
+	metrics.simulated_time = step * dt;
+	metrics.energy = energy / 3600.0;
+	metrics.available_energy = available / 3600.0;
+	metrics.efficiency = (available > 0) ? energy / available : 0;
+	metrics.oscillation_loss = settled_loss / 3600.0;
+	metrics.oscillation_fraction = (settled_available > 0) ? settled_loss / settled_available : 0;
+	metrics.ripple = (settled_steps > 0) ? sqrt(ripple_sum / settled_steps) : 0;
+
+	metrics.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+	metrics.steps_per_second = (metrics.wall_time > 0) ? step / metrics.wall_time : 0;
+
+	return metrics;
+}
+
+void PV::RunMpptJob(ModelParameters params, int controller, double G_start, double G_stop, double T_start, double T_stop,
+	MpptOptions options, MpptStatus* status)
+{
+	status->running = true;
+
+	std::unique_ptr<MpptController> tracker;
+	if (controller == 1) tracker.reset(new IncrementalConductance());
+	else tracker.reset(new PerturbObserve());
+
+	MpptMetrics metrics = RunMppt(params, *tracker, RampProfile(G_start, G_stop, T_start, T_stop, options.duration), options, &status->cancel);
+
+	{
+		std::lock_guard<std::mutex> lock(status->result_mtx);
+		status->result = metrics;
+		status->controller = tracker->Name();
+	}
+
+	status->running = false;
+}
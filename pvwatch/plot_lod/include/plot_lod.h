@@ -0,0 +1,137 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+/*
+	Level of detail of the plotted series: a series is decimated to the pixels of its plot
+	before it is handed to ImPlot, so the points drawn per frame are bounded by the plot size
+	and not by the length of the series. The decimated series is cached per view and only
+	recomputed when the view changes or points are appended.
+*/
+
+enum class DecimationMethod
+{
+	MinMax,	// First, min, max and last point of every pixel column, exact to the pixel
+	Lttb	// Largest triangle three buckets, one point per pixel column
+};
+
+/*
+	Visible range and size in pixels of a plot
+*/
+struct PlotView
+{
+	double x_min;
+	double x_max;
+	double y_min;
+	double y_max;
+	int width;
+	int height;
+
+	bool operator==(const PlotView& other) const;
+	bool operator!=(const PlotView& other) const { return !(*this == other); }
+};
+
+/*
+	Decimated line of a series with increasing x (a curve on its voltage grid)
+*/
+class LineLod
+{
+public:
+	explicit LineLod(DecimationMethod method = DecimationMethod::MinMax);
+
+	void SetMethod(DecimationMethod method);
+
+	/*
+		Decimate the count points of x, y visible in view. version identifies the series: with
+		the same version the first points are unchanged and only the appended ones are
+		bucketed (min-max), a new version decimates the series again.
+		Returns true when the decimated series changed.
+	*/
+	bool Update(const double* x, const double* y, int count, uint64_t version, const PlotView& view);
+
+	int Size(void) const { return (int)this->out_x.size(); }
+	const double* X(void) const { return this->out_x.data(); }
+	const double* Y(void) const { return this->out_y.data(); }
+
+private:
+	/*
+		Point indices of a pixel column
+	*/
+	struct Bucket
+	{
+		int first;
+		int last;
+		int min;
+		int max;
+	};
+
+	DecimationMethod method;
+
+	// Cache key
+	bool valid;
+	uint64_t version;
+	int count;
+	PlotView view;
+
+	std::vector<Bucket> buckets;
+	int before;	// Last point left of the view (-1 for none), keeps the line running to the edge
+	int after;	// First point right of the view (-1 for none)
+
+	std::vector<double> out_x;
+	std::vector<double> out_y;
+
+	void AddPoints(const double* x, const double* y, int first, int count);
+	void BuildMinMax(const double* x, const double* y);
+	void BuildLttb(const double* x, const double* y);
+};
+
+/*
+	Decimated scatter of a trailing sample history: the newest sample of every occupied pixel
+	of the view is kept, which draws the same pixels as the whole history.
+	Appended samples only update their own pixels, samples dropped from the history expire
+	their pixels lazily (a pixel keeps the sequence number of its newest sample).
+*/
+class ScatterLod
+{
+public:
+	ScatterLod();
+
+	/*
+		x, y: the history arrays (ring buffers), size samples from offset, the oldest first.
+		total: samples ever appended to the history, the newest has the sequence total - 1.
+		Returns true when the decimated scatter changed.
+	*/
+	bool Update(const double* x, const double* y, int size, int offset, uint64_t total, const PlotView& view);
+
+	int Size(void) const { return (int)this->out_x.size(); }
+	const double* X(void) const { return this->out_x.data(); }
+	const double* Y(void) const { return this->out_y.data(); }
+
+private:
+	struct Cell
+	{
+		int pixel;
+		uint64_t sequence;	// Of the newest sample in the pixel
+		double x;
+		double y;
+	};
+
+	// Cache key
+	bool valid;
+	PlotView view;
+	uint64_t total;
+	double x_scale;	// Pixels per unit of the view
+	double y_scale;
+
+	std::vector<int> grid;		// Index in cells of every pixel, -1 when empty
+	std::vector<Cell> cells;	// Occupied pixels
+
+	std::vector<double> out_x;
+	std::vector<double> out_y;
+
+	/*
+		Put a sample on its pixel, over the sample already there when newest.
+		Returns true when the pixel changed.
+	*/
+	bool AddSample(double x, double y, uint64_t sequence, bool newest);
+};
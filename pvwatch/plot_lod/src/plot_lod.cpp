@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <math.h>
+
+#include "../include/plot_lod.h"
+#include "../../profiler/include/profiler.h"
+
+bool PlotView::operator==(const PlotView& other) const
+{
+	return this->x_min == other.x_min && this->x_max == other.x_max && this->y_min == other.y_min && this->y_max == other.y_max &&
+		this->width == other.width && this->height == other.height;
+}
+
+LineLod::LineLod(DecimationMethod method)
+{
+	this->method = method;
+	this->valid = false;
+	this->version = 0;
+	this->count = 0;
+	this->view = {};
+	this->before = -1;
+	this->after = -1;
+}
+
+void LineLod::SetMethod(DecimationMethod method)
+{
+	if (method == this->method) return;
+	this->method = method;
+	this->valid = false;
+}
+
+bool LineLod::Update(const double* x, const double* y, int count, uint64_t version, const PlotView& view)
+{
+	PVWATCH_PROFILE_SCOPE("plot.lod.line");
+
+	if (count <= 0 || !(view.x_max > view.x_min))
+	{
+		bool changed = this->valid || !this->out_x.empty();
+		this->valid = false;
+		this->out_x.clear();
+		this->out_y.clear();
+		return changed;
+	}
+
+	bool same_series = this->valid && version == this->version && view == this->view;
+	if (same_series && count == this->count) return false;
+
+	// Only appended points of the same series in the same view are added to the buckets
+	int first = (same_series && count > this->count) ? this->count : 0;
+
+	this->valid = true;
+	this->version = version;
+	this->count = count;
+	this->view = view;
+
+	// LTTB picks every point against its neighbours, appending changes the buckets before it
+	if (this->method == DecimationMethod::Lttb)
+	{
+		this->BuildLttb(x, y);
+		return true;
+	}
+
+	if (first == 0)
+	{
+		// Only the visible points of the increasing x go through the buckets
+		int lo = (int)(std::lower_bound(x, x + count, view.x_min) - x);
+		int hi = (int)(std::upper_bound(x, x + count, view.x_max) - x);
+
+		this->buckets.assign(std::max(view.width, 1), { -1, -1, -1, -1 });
+		this->before = lo - 1;
+		this->after = (hi < count) ? hi : -1;
+		this->AddPoints(x, y, lo, hi - lo);
+	}
+	else
+	{
+		this->AddPoints(x, y, first, count - first);
+	}
+
+	this->BuildMinMax(x, y);
+
+	return true;
+}
+
+void LineLod::AddPoints(const double* x, const double* y, int first, int count)
+{
+	int width = (int)this->buckets.size();
+	double scale = width / (this->view.x_max - this->view.x_min);
+
+	for (int i = first; i < first + count; i++)
+	{
+		double xi = x[i];
+		if (isnan(xi) || isnan(y[i])) continue;
+
+		if (xi < this->view.x_min)
+		{
+			this->before = i;
+			continue;
+		}
+		if (xi > this->view.x_max)
+		{
+			if (this->after < 0) this->after = i;
+			continue;
+		}
+
+		Bucket& bucket = this->buckets[std::min((int)((xi - this->view.x_min) * scale), width - 1)];
+		if (bucket.first < 0)
+		{
+			bucket = { i, i, i, i };
+			continue;
+		}
+
+		bucket.last = i;
+		if (y[i] < y[bucket.min]) bucket.min = i;
+		if (y[i] > y[bucket.max]) bucket.max = i;
+	}
+}
+
+void LineLod::BuildMinMax(const double* x, const double* y)
+{
+	this->out_x.clear();
+	this->out_y.clear();
+
+	auto push = [&](int i)
+	{
+		this->out_x.push_back(x[i]);
+		this->out_y.push_back(y[i]);
+	};
+
+	if (this->before >= 0) push(this->before);
+
+	for (const Bucket& bucket : this->buckets)
+	{
+		if (bucket.first < 0) continue;
+
+		// The extremes in the order of the series, so the line draws the column from end to end
+		int points[4] = { bucket.first, bucket.min, bucket.max, bucket.last };
+		std::sort(points + 1, points + 3);
+		for (int p = 0; p < 4; p++)
+		{
+			if (p == 0 || points[p] != points[p - 1]) push(points[p]);
+		}
+	}
+
+	if (this->after >= 0) push(this->after);
+}
+
+void LineLod::BuildLttb(const double* x, const double* y)
+{
+	const PlotView& view = this->view;
+	this->out_x.clear();
+	this->out_y.clear();
+
+	// Visible points of the increasing x, with one neighbour on each side
+	int lo = (int)(std::lower_bound(x, x + this->count, view.x_min) - x);
+	int hi = (int)(std::upper_bound(x, x + this->count, view.x_max) - x);
+	lo = std::max(lo - 1, 0);
+	hi = std::min(hi + 1, this->count);
+
+	int points = hi - lo;
+	int threshold = std::max(view.width, 3);
+	if (points <= threshold)
+	{
+		this->out_x.assign(x + lo, x + hi);
+		this->out_y.assign(y + lo, y + hi);
+		return;
+	}
+
+	// The first and last points are kept, the points between are split into threshold - 2 buckets
+	double every = (double)(points - 2) / (threshold - 2);
+	int a = lo;
+	this->out_x.push_back(x[a]);
+	this->out_y.push_back(y[a]);
+
+	for (int b = 0; b < threshold - 2; b++)
+	{
+		// Average of the next bucket, the third vertex of the triangles
+		int next_start = lo + (int)((b + 1) * every) + 1;
+		int next_end = std::min(lo + (int)((b + 2) * every) + 1, hi);
+		double avg_x = x[hi - 1];
+		double avg_y = y[hi - 1];
+		if (next_end > next_start)
+		{
+			avg_x = 0;
+			avg_y = 0;
+			for (int i = next_start; i < next_end; i++)
+			{
+				avg_x += x[i];
+				avg_y += y[i];
+			}
+			avg_x /= next_end - next_start;
+			avg_y /= next_end - next_start;
+		}
+
+		int start = lo + (int)(b * every) + 1;
+		int end = std::min(lo + (int)((b + 1) * every) + 1, hi - 1);
+		double max_area = -1;
+		int picked = start;
+		for (int i = start; i < end; i++)
+		{
+			double area = fabs((x[a] - avg_x) * (y[i] - y[a]) - (x[a] - x[i]) * (avg_y - y[a]));
+			if (area > max_area)
+			{
+				max_area = area;
+				picked = i;
+			}
+		}
+
+		this->out_x.push_back(x[picked]);
+		this->out_y.push_back(y[picked]);
+		a = picked;
+	}
+
+	this->out_x.push_back(x[hi - 1]);
+	this->out_y.push_back(y[hi - 1]);
+}
+
+ScatterLod::ScatterLod()
+{
+	this->valid = false;
+	this->view = {};
+	this->x_scale = 0;
+	this->y_scale = 0;
+	this->total = 0;
+}
+
+bool ScatterLod::AddSample(double x, double y, uint64_t sequence, bool newest)
+{
+	const PlotView& view = this->view;
+	if (!(x >= view.x_min && x <= view.x_max && y >= view.y_min && y <= view.y_max)) return false;
+
+	int px = std::min((int)((x - view.x_min) * this->x_scale), view.width - 1);
+	int py = std::min((int)((y - view.y_min) * this->y_scale), view.height - 1);
+	int pixel = py * view.width + px;
+
+	int& index = this->grid[pixel];
+	if (index < 0)
+	{
+		index = (int)this->cells.size();
+		this->cells.push_back({ pixel, sequence, x, y });
+		return true;
+	}
+
+	if (!newest) return false;
+	this->cells[index] = { pixel, sequence, x, y };
+	return true;
+}
+
+bool ScatterLod::Update(const double* x, const double* y, int size, int offset, uint64_t total, const PlotView& view)
+{
+	PVWATCH_PROFILE_SCOPE("plot.lod.scatter");
+
+	if (size <= 0 || view.width <= 0 || view.height <= 0 || !(view.x_max > view.x_min) || !(view.y_max > view.y_min))
+	{
+		bool changed = !this->out_x.empty();
+		this->valid = false;
+		this->out_x.clear();
+		this->out_y.clear();
+		return changed;
+	}
+
+	uint64_t oldest = total - (uint64_t)size;
+	bool changed = false;
+
+	if (!this->valid || view != this->view || total < this->total)
+	{
+		this->view = view;
+		this->x_scale = view.width / (view.x_max - view.x_min);
+		this->y_scale = view.height / (view.y_max - view.y_min);
+		this->grid.assign((size_t)view.width * view.height, -1);
+		this->cells.clear();
+		changed = true;
+
+		// From the newest sample back, a pixel keeps the first sample that lands on it
+		for (uint64_t sequence = total; sequence > oldest; sequence--)
+		{
+			int index = offset + (int)(sequence - 1 - oldest);
+			if (index >= size) index -= size;
+			this->AddSample(x[index], y[index], sequence - 1, false);
+		}
+	}
+	else
+	{
+		// Appended samples replace the older ones of their pixels
+		for (uint64_t sequence = std::max(this->total, oldest); sequence < total; sequence++)
+		{
+			int index = offset + (int)(sequence - oldest);
+			if (index >= size) index -= size;
+			changed |= this->AddSample(x[index], y[index], sequence, true);
+		}
+	}
+
+	this->valid = true;
+	this->total = total;
+
+	// Pixels whose newest sample left the history are empty now
+	size_t kept = 0;
+	for (size_t c = 0; c < this->cells.size(); c++)
+	{
+		const Cell& cell = this->cells[c];
+		if (cell.sequence < oldest)
+		{
+			this->grid[cell.pixel] = -1;
+			continue;
+		}
+
+		this->grid[cell.pixel] = (int)kept;
+		this->cells[kept++] = cell;
+	}
+	if (kept != this->cells.size())
+	{
+		this->cells.resize(kept);
+		changed = true;
+	}
+
+	if (changed)
+	{
+		this->out_x.resize(this->cells.size());
+		this->out_y.resize(this->cells.size());
+		for (size_t c = 0; c < this->cells.size(); c++)
+		{
+			this->out_x[c] = this->cells[c].x;
+			this->out_y[c] = this->cells[c].y;
+		}
+	}
+
+	return changed;
+}
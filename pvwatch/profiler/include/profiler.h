@@ -0,0 +1,213 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILER_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_TSC 1
+#else
+#include <chrono>
+#endif
+
+#define PROFILER_MAX_ZONES 64
+#define PROFILER_BUCKETS 64
+
+/*
+	Scoped hot path timers.
+
+	PVWATCH_PROFILE_SCOPE("name") times the rest of the enclosing scope, PVWATCH_PROFILE_VALUE("name", seconds)
+	records a measured duration (e.g. a lateness). Both compile to nothing unless PVWATCH_PROFILE is defined.
+
+	Every thread counts into its own slots (single writer, relaxed atomics, no locks), readers merge
+	the threads. The clock is the TSC where available (calibrated against steady_clock), durations
+	go to log2 histograms of ticks. A scope costs two TSC reads and two counter updates, the count,
+	minimum and maximum of a zone are read from its histogram.
+*/
+#ifdef PVWATCH_PROFILE
+#define PVWATCH_PROFILE_JOIN_(a, b) a##b
+#define PVWATCH_PROFILE_JOIN(a, b) PVWATCH_PROFILE_JOIN_(a, b)
+#define PVWATCH_PROFILE_SCOPE(name) \
+	static ProfileZone PVWATCH_PROFILE_JOIN(profile_zone_, __LINE__)(name); \
+	ProfileScope PVWATCH_PROFILE_JOIN(profile_scope_, __LINE__)(PVWATCH_PROFILE_JOIN(profile_zone_, __LINE__))
+#define PVWATCH_PROFILE_VALUE(name, seconds) \
+	do { static ProfileZone profile_zone(name); Profiler::RecordSeconds(profile_zone, seconds); } while (0)
+#else
+#define PVWATCH_PROFILE_SCOPE(name) ((void)0)
+#define PVWATCH_PROFILE_VALUE(name, seconds) ((void)0)
+#endif
+
+/*
+	Counters of one zone on one thread, only that thread writes them
+*/
+struct ProfileCounters
+{
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> histogram[PROFILER_BUCKETS];
+};
+
+struct ProfileThreadCounters
+{
+	ProfileCounters zones[PROFILER_MAX_ZONES];
+
+	ProfileThreadCounters();
+
+	void Clear(void);
+
+	/*
+		Add the counts of other, the caller must keep both from being written meanwhile
+	*/
+	void Merge(const ProfileThreadCounters& other);
+};
+
+/*
+	A named timer, registered once (function local static of the macros)
+*/
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name);
+
+	int Index(void) const { return this->index; }
+
+private:
+	int index;	// -1 when all PROFILER_MAX_ZONES are taken
+};
+
+/*
+	Merged statistics of a zone over all threads, durations in seconds
+*/
+struct ProfileZoneStats
+{
+	std::string name;
+	uint64_t count;
+	double total;
+	double mean;
+	double min;		// Bounds of the lowest and highest histogram buckets, within a factor of 2
+	double max;
+	double p50;		// Estimated from the histogram, within a factor of sqrt(2)
+	double p99;
+	uint64_t histogram[PROFILER_BUCKETS];	// Bucket b holds durations in [BucketSeconds(b), BucketSeconds(b + 1))
+};
+
+class Profiler
+{
+public:
+	static inline uint64_t Ticks(void)
+	{
+#ifdef PROFILER_TSC
+		return __rdtsc();
+#else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	/*
+		Count a duration in ticks for the zone on the calling thread
+	*/
+	static inline void Record(const ProfileZone& zone, uint64_t ticks)
+	{
+		int index = zone.Index();
+		if (index < 0) return;
+
+		ProfileThreadCounters* counters = thread_counters;
+		if (counters == nullptr) counters = RegisterThread();
+
+		ProfileCounters& counter = counters->zones[index];
+		Add(counter.total, ticks);
+		Add(counter.histogram[Bucket(ticks)], 1);
+	}
+
+	static void RecordSeconds(const ProfileZone& zone, double seconds);
+
+	/*
+		Ticks per second, calibrated from the start of the program. Measured on the first use and
+		then only refreshed by Snapshot() (and Dump()), the hot paths read the cached value.
+	*/
+	static double TickFrequency(void);
+
+	/*
+		Lower bound of a histogram bucket
+	*/
+	static double BucketSeconds(int bucket);
+
+	/*
+		Statistics of every zone that recorded something
+	*/
+	static std::vector<ProfileZoneStats> Snapshot(void);
+
+	/*
+		Zero the counters of all threads. A scope ending concurrently on another thread may keep
+		its previous count, the profiler never locks the writers for this.
+	*/
+	static void Reset(void);
+
+	/*
+		Write the snapshot as a text table, returns false if the file can't be written
+	*/
+	static bool Dump(const std::string& path);
+
+	static bool Enabled(void);
+
+private:
+	static thread_local ProfileThreadCounters* thread_counters;
+	static std::atomic<double> tick_frequency;
+
+	/*
+		Returns the counters of an ended thread to the registry when the thread exits
+	*/
+	struct ThreadRelease
+	{
+		~ThreadRelease();
+	};
+
+	static ProfileThreadCounters* RegisterThread(void);
+
+	/*
+		Measure the ticks per second since the start of the program and cache them
+	*/
+	static double Calibrate(void);
+
+	// Single writer increments, relaxed loads and stores compile to plain moves
+	static inline void Add(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	// floor(log2(ticks)), 0 for 0 and 1 tick
+	static inline int Bucket(uint64_t ticks)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		return _BitScanReverse64(&index, ticks) ? (int)index : 0;
+#elif defined(__GNUC__)
+		return (ticks > 0) ? 63 - __builtin_clzll(ticks) : 0;
+#else
+		int bucket = 0;
+		while (ticks > 1)
+		{
+			ticks >>= 1;
+			bucket++;
+		}
+		return bucket;
+#endif
+	}
+};
+
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const ProfileZone& zone) : zone(zone), start(Profiler::Ticks()) {}
+	~ProfileScope() { Profiler::Record(this->zone, Profiler::Ticks() - this->start); }
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const ProfileZone& zone;
+	uint64_t start;
+};
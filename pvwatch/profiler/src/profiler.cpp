@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+
+#include "../include/profiler.h"
+
+namespace
+{
+	/*
+		Zone names and the counters of every running thread that recorded. The counts of ended
+		threads are merged into retired and their counters reused by the next threads, so the
+		short lived workers of the batch jobs don't grow the registry.
+	*/
+	struct Registry
+	{
+		std::mutex mtx;
+		const char* names[PROFILER_MAX_ZONES] = {};
+		std::atomic<int> zone_count{ 0 };
+		std::vector<std::unique_ptr<ProfileThreadCounters>> threads;
+		std::vector<std::unique_ptr<ProfileThreadCounters>> free_counters;
+		ProfileThreadCounters retired;
+
+		// Reference point of the TSC calibration
+		uint64_t start_ticks = Profiler::Ticks();
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	};
+
+	Registry& GetRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	double Percentile(const ProfileZoneStats& stats, double fraction)
+	{
+		uint64_t rank = (uint64_t)ceil(fraction * stats.count);
+		uint64_t seen = 0;
+
+		for (int b = 0; b < PROFILER_BUCKETS; b++)
+		{
+			seen += stats.histogram[b];
+			if (seen >= rank && stats.histogram[b] > 0)
+			{
+				// Geometric middle of the bucket, within the observed range
+				double value = Profiler::BucketSeconds(b) * sqrt(2.0);
+				return std::min(std::max(value, stats.min), stats.max);
+			}
+		}
+
+		return stats.max;
+	}
+}
+
+thread_local ProfileThreadCounters* Profiler::thread_counters = nullptr;
+std::atomic<double> Profiler::tick_frequency{ 0 };
+
+ProfileThreadCounters::ProfileThreadCounters()
+{
+	this->Clear();
+}
+
+void ProfileThreadCounters::Clear()
+{
+	for (ProfileCounters& zone : this->zones)
+	{
+		zone.total.store(0, std::memory_order_relaxed);
+		for (std::atomic<uint64_t>& bucket : zone.histogram) bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+void ProfileThreadCounters::Merge(const ProfileThreadCounters& other)
+{
+	for (int z = 0; z < PROFILER_MAX_ZONES; z++)
+	{
+		ProfileCounters& zone = this->zones[z];
+		const ProfileCounters& from = other.zones[z];
+
+		zone.total.fetch_add(from.total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		for (int b = 0; b < PROFILER_BUCKETS; b++) zone.histogram[b].fetch_add(from.histogram[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+ProfileZone::ProfileZone(const char* name)
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mtx);
+
+	// The same name from several places shares one zone
+	int count = registry.zone_count.load();
+	for (int i = 0; i < count; i++)
+	{
+		if (std::string(registry.names[i]) == name)
+		{
+			this->index = i;
+			return;
+		}
+	}
+
+	if (count >= PROFILER_MAX_ZONES)
+	{
+		this->index = -1;
+		return;
+	}
+
+	registry.names[count] = name;
+	registry.zone_count.store(count + 1);
+	this->index = count;
+}
+
+ProfileThreadCounters* Profiler::RegisterThread()
+{
+	// Destroyed when the thread exits, which releases its counters
+	static thread_local ThreadRelease release;
+	(void)release;
+
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mtx);
+
+	// Counters released by an ended thread are already zeroed
+	if (!registry.free_counters.empty())
+	{
+		registry.threads.push_back(std::move(registry.free_counters.back()));
+		registry.free_counters.pop_back();
+	}
+	else
+	{
+		registry.threads.emplace_back(new ProfileThreadCounters());
+	}
+
+	thread_counters = registry.threads.back().get();
+	return thread_counters;
+}
+
+Profiler::ThreadRelease::~ThreadRelease()
+{
+	ProfileThreadCounters* counters = thread_counters;
+	if (counters == nullptr) return;
+	thread_counters = nullptr;
+
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mtx);
+
+	auto entry = std::find_if(registry.threads.begin(), registry.threads.end(),
+		[counters](const std::unique_ptr<ProfileThreadCounters>& thread) { return thread.get() == counters; });
+	if (entry == registry.threads.end()) return;
+
+	// The snapshots keep the counts of the thread, under the same lock they are read with
+	registry.retired.Merge(*counters);
+	counters->Clear();
+
+	registry.free_counters.push_back(std::move(*entry));
+	registry.threads.erase(entry);
+}
+
+void Profiler::RecordSeconds(const ProfileZone& zone, double seconds)
+{
+	Record(zone, (seconds > 0) ? (uint64_t)(seconds * TickFrequency()) : 0);
+}
+
+double Profiler::TickFrequency()
+{
+	double frequency = tick_frequency.load(std::memory_order_relaxed);
+	return (frequency > 0) ? frequency : Calibrate();
+}
+
+double Profiler::Calibrate()
+{
+#ifdef PROFILER_TSC
+	// More accurate as the program runs
+	Registry& registry = GetRegistry();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - registry.start_time).count();
+	uint64_t ticks = Ticks() - registry.start_ticks;
+
+	// Too short to be accurate, measure a millisecond
+	if (elapsed < 1e-3)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - registry.start_time).count();
+		ticks = Ticks() - registry.start_ticks;
+	}
+
+	double frequency = ticks / elapsed;
+#else
+	double frequency = 1e9;
+#endif
+
+	tick_frequency.store(frequency, std::memory_order_relaxed);
+	return frequency;
+}
+
+double Profiler::BucketSeconds(int bucket)
+{
+	return (bucket <= 0) ? 0 : ldexp(1.0, bucket) / TickFrequency();
+}
+
+std::vector<ProfileZoneStats> Profiler::Snapshot()
+{
+	Registry& registry = GetRegistry();
+	double tick = 1.0 / Calibrate();
+
+	std::lock_guard<std::mutex> lock(registry.mtx);
+
+	std::vector<ProfileZoneStats> snapshot;
+	int zone_count = registry.zone_count.load();
+
+	for (int z = 0; z < zone_count; z++)
+	{
+		ProfileZoneStats stats = {};
+		stats.name = registry.names[z];
+
+		uint64_t total = 0;
+
+		auto add = [&](const ProfileThreadCounters& thread)
+		{
+			const ProfileCounters& counter = thread.zones[z];
+			total += counter.total.load(std::memory_order_relaxed);
+			for (int b = 0; b < PROFILER_BUCKETS; b++) stats.histogram[b] += counter.histogram[b].load(std::memory_order_relaxed);
+		};
+
+		add(registry.retired);
+		for (const std::unique_ptr<ProfileThreadCounters>& thread : registry.threads) add(*thread);
+
+		// Count and range from the histogram, the scopes don't keep them
+		int lowest = -1;
+		int highest = -1;
+		for (int b = 0; b < PROFILER_BUCKETS; b++)
+		{
+			stats.count += stats.histogram[b];
+			if (stats.histogram[b] > 0 && lowest < 0) lowest = b;
+			if (stats.histogram[b] > 0) highest = b;
+		}
+
+		if (stats.count == 0) continue;
+
+		stats.total = total * tick;
+		stats.mean = stats.total / stats.count;
+		stats.min = BucketSeconds(lowest);
+		stats.max = (highest + 1 < PROFILER_BUCKETS) ? BucketSeconds(highest + 1) : ldexp(1.0, PROFILER_BUCKETS) * tick;
+		stats.p50 = Percentile(stats, 0.50);
+		stats.p99 = Percentile(stats, 0.99);
+		snapshot.push_back(stats);
+	}
+
+	return snapshot;
+}
+
+void Profiler::Reset()
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mtx);
+
+	registry.retired.Clear();
+	for (const std::unique_ptr<ProfileThreadCounters>& thread : registry.threads) thread->Clear();
+}
+
+bool Profiler::Dump(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr) return false;
+
+	fprintf(file, "%-32s %12s %12s %12s %12s %12s %12s %12s\n", "zone", "count", "total_ms", "mean_us", "min_us", "p50_us", "p99_us", "max_us");
+	for (const ProfileZoneStats& stats : Snapshot())
+	{
+		fprintf(file, "%-32s %12llu %12.3f %12.3f %12.3f %12.3f %12.3f %12.3f\n", stats.name.c_str(), (unsigned long long)stats.count,
+			1e3 * stats.total, 1e6 * stats.mean, 1e6 * stats.min, 1e6 * stats.p50, 1e6 * stats.p99, 1e6 * stats.max);
+	}
+
+	return fclose(file) == 0;
+}
+
+bool Profiler::Enabled()
+{
+#ifdef PVWATCH_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
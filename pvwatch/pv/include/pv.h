@@ -1,6 +1,15 @@
 #pragma once
+#include <atomic>
 #include <string>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "pv_buffer.h"
+#include "pv_clock.h"
+#include "pv_simd.h"
+#include "pv_snapshot.h"
 
 #define k 1.38064852e-23
 #define q 1.602176634e-19
@@ -15,10 +24,198 @@ namespace PV
 	static float T_nominal = 25.0;
 	static int STEPS_nominal = 200;
 	static int ITERS_nominal = 50;
+	static double TOLERANCE_nominal = 1e-9;
+
+	/*
+		Method used to solve the implicit single diode equation at every voltage step
+	*/
+	enum class SolverMethod
+	{
+		FixedPoint,	// Plain fixed point iteration I = f(I), stops at the tolerance
+		Newton,		// Newton-Raphson, warm started from the neighbouring voltage points (SIMD kernel)
+		LambertW	// Explicit closed form through the Lambert W function
+	};
+
+	/*
+		Interpolation used by the current lookups between the curve points
+	*/
+	enum class InterpolationMode
+	{
+		Linear,
+		Pchip	// Monotone piecewise cubic Hermite, more accurate for low step counts
+	};
+
+	/*
+		Placement of the voltage points of a curve
+	*/
+	enum class GridMode
+	{
+		Uniform,	// steps points evenly spaced from 0 to Voc
+		Adaptive	// Points added where the interpolation error is the largest, up to steps. PCHIP
+					// interpolation uses the exact slopes of the model there (cubic Hermite).
+					// The points are solved one at a time with scalar Newton whatever the
+					// solver_method and use_simd, within the iteration limit of the module.
+	};
+
+	/*
+		Convergence report of the last curve calculation
+	*/
+	struct SolverStats
+	{
+		int points;				// Voltage points solved
+		int total_iterations;	// Sum of iterations over all points (~ exp() calls)
+		int max_iterations;		// Worst case iterations of a single point
+		int unconverged_points;	// Points that hit the iteration limit before the tolerance
+		double max_residual;	// Worst |f(I)| of the single diode equation in A
+	};
+
+	/*
+		Pacing of a simulation sweep
+	*/
+	enum class SimulationMode
+	{
+		RealTime,		// Every step is calculated at its deadline on the clock
+		MaxSpeed,		// Steps back to back on a virtual clock, for batch runs
+		Precomputed		// All steps are calculated in parallel first, then only published on schedule
+	};
+
+	/*
+		Schedule report of the last simulation sweep, lateness is the time from a step
+		deadline to the publication of its curve
+	*/
+	struct SimulationTiming
+	{
+		int steps;				// Steps published
+		double mean_lateness;	// s
+		double max_lateness;	// s
+		double duration_error;	// Actual minus requested sweep duration (s)
+		double precompute_time;	// Wall time of the parallel precomputation (s)
+	};
+
+	/*
+		Single diode model parameters extracted from the datasheet values.
+		They don't depend on the operating condition (G, T), so they are extracted once
+		and reused for every curve of the same module.
+	*/
+	struct ModelParameters
+	{
+		// Datasheet (nominal) values
+		double Voc_nom;
+		double Isc_nom;
+		double Vmp_nom;
+		double Imp_nom;
+
+		double G_nom;
+		double T_nom;
+		double Vthermal_nom;
+
+		// Extracted parameters
+		double Ns;
+		double Np;
+		double a;
+		double Rs;
+		double Rsh;
+		double I0_num;	// Numerator of I0 (eq. 6), I0 = I0_num / (Rsh * exp(Voc_nom / (a * Vt)))
+		double Ipv_nom;
+	};
+
+	/*
+		Extract Ns, Np, a, Rs, Rsh and Ipv_nom from the datasheet values at the nominal conditions.
+		Inputs: Voc (V), Isc (A), Vmp (V), Imp (A), and the iterations of the Rs extraction
+	*/
+	ModelParameters ExtractModelParameters(float v_oc, float i_sc, float v_mp, float i_mp, int iterations);
+
+	/*
+		Single diode parameters of the model at an operating condition: G (W/m2), T (C)
+	*/
+	Simd::DiodeParameters DiodeAtCondition(const ModelParameters& params, double g, double t_e);
+
+	/*
+		Solve the single diode equation for the current at one voltage with Newton-Raphson, in at
+		most max_iterations. Any initial guess converges, the neighbouring solution of a sweep takes
+		1-2 iterations. converged (when not nullptr) tells whether the last step was within tolerance.
+	*/
+	double SolveCurrent(const Simd::DiodeParameters& diode, double voltage, double initial_guess, double tolerance = TOLERANCE_nominal,
+		int* iterations = nullptr, int max_iterations = ITERS_nominal, bool* converged = nullptr);
+
+	/*
+		Maximum power point of the model at an operating condition
+	*/
+	struct MaxPowerPoint
+	{
+		double V;
+		double I;
+		double P;
+		int iterations;	// Newton (or bisection) steps on dP/dV
+	};
+
+	/*
+		Solve dP/dV = 0 directly with Newton, I' and I'' come from implicit differentiation of
+		the single diode equation. A bisection bracket up to the open circuit voltage keeps
+		every step safe.
+		Converges to tolerance (V), without a curve. Returns zeros for G <= 0.
+	*/
+	MaxPowerPoint SolveMaxPowerPoint(const ModelParameters& params, double g, double t_e, double tolerance = 1e-6);
+
+	/*
+		SolveMaxPowerPoint of single diode parameters (e.g. fitted ones), starting from the given
+		fractions of the open circuit voltage and the photocurrent
+	*/
+	MaxPowerPoint SolveMaxPowerPoint(const Simd::DiodeParameters& diode, double tolerance = 1e-6,
+		double voltage_fraction = 0.8, double current_fraction = 0.9);
+
+	/*
+		Thread safe cache of the extracted model parameters, keyed by the datasheet tuple
+	*/
+	class ParameterCache
+	{
+	public:
+		static ParameterCache& Instance();
+
+		/*
+			Get the parameters of a datasheet tuple, extracting them on the first request
+		*/
+		ModelParameters Get(float v_oc, float i_sc, float v_mp, float i_mp, int iterations);
+
+		void Clear(void);
+
+		size_t Size(void);
+
+	private:
+		typedef std::tuple<float, float, float, float, int> Key;
+
+		std::mutex mtx;
+		std::map<Key, ModelParameters> entries;
+	};
+
+	/*
+		Get the currents of a batch of voltages from a uniform voltage grid curve.
+		Uses a linear approximation between the two closest points, or the monotone cubic
+		(PCHIP) one when the slopes are given. Voltages outside [0, Voc] are clamped.
+	*/
+	void LookupCurrent(const double* voltage_array, const double* current_array, const double* slope_array,
+		int steps, double v_oc, double i_sc, const double* voltages, double* currents, int count);
+
+	/*
+		Bucket index of a non-uniform (increasing) voltage grid: bucket b covers the voltages from
+		b * Vmax / buckets and holds the last point at or below its start
+	*/
+	void BuildGridIndex(const double* voltage_array, int steps, std::vector<int>& index);
+
+	/*
+		LookupCurrent of a curve on a non-uniform voltage grid, the bucket index (BuildGridIndex)
+		gives the interval of every voltage in O(1). The Hermite slopes are in A/V.
+	*/
+	void LookupCurrentNonUniform(const double* voltage_array, const double* current_array, const double* slope_array,
+		int steps, const int* index, int buckets, double i_sc, const double* voltages, double* currents, int count);
 
 	class PVModule
 	{
 	public:
+		PVModule();
+		PVModule(const PVModule& other);
+		PVModule& operator=(const PVModule& other);
+
 		// PV internal parameters
 		double Voc;
 		double Isc;
@@ -30,7 +227,17 @@ namespace PV
 
 		// Calculation parameters
 		int steps;
-		int iters;
+		int iters;	// Maximum iterations per voltage point (and for the Rs extraction)
+
+		SolverMethod solver_method = SolverMethod::Newton;
+		double tolerance = TOLERANCE_nominal; // Per point convergence tolerance on the current (A)
+		bool use_simd = true; // Use the vectorized Newton kernel when the CPU supports it
+		bool warm_start = true; // Seed Newton from the previous curves of the module (consecutive sweep steps)
+		InterpolationMode interpolation_mode = InterpolationMode::Linear;
+
+		// Adaptive grids use at most steps points, fewer once the interpolation error is below grid_tolerance
+		GridMode grid_mode = GridMode::Uniform;
+		double grid_tolerance = 1e-4; // Max interpolation error of the adaptive grid (A)
 
 		/*
 			Calculate I, V, P arrays using analytical method.
@@ -40,10 +247,35 @@ namespace PV
 		void CalculateIVPArrays(float v_oc, float i_sc, float v_mp, float i_mp, float g, float t_e, int steps, int iterations);
 
 		/*
-			Clears the current array
+			Calculate I, V, P arrays from already extracted model parameters,
+			only the G and T dependent terms are recalculated.
+			With warm_start, a uniform grid curve of the same model and steps as the previous ones
+			starts every point from them (extrapolated over the last two conditions), small condition
+			changes then converge in about one Newton correction per point.
+		*/
+		void CalculateIVPArrays(const ModelParameters& params, float g, float t_e, int steps, int iterations);
+
+		/*
+			Get the model parameters used by the last calculation
+		*/
+		ModelParameters GetModelParameters();
+
+		/*
+			Get the steps requested by the last calculation, an adaptive grid may have used fewer (this.steps)
+		*/
+		int GetRequestedSteps(void);
+
+		/*
+			Clears the current array (the storage is kept for the next calculation)
 		*/
 		void ClearCurrentArray(void);
 
+		/*
+			Allocate the curve storage from a shared arena instead of the heap, nullptr goes back
+			to the heap. Clears the current curve, the arena must outlive the module.
+		*/
+		void SetArena(CurveArena* arena);
+
 		/*
 			Get the Current Array
 		*/
@@ -60,64 +292,229 @@ namespace PV
 		double* GetPowerArray();
 
 		/*
-			Get current value from the voltage, Implements also a linear approximation between
-			two closest values.
+			Get current value from the voltage, Implements also a linear (or PCHIP) approximation
+			between two closest values. Voltages outside [0, Voc] are clamped.
+			O(1) on both grids, the adaptive one through its bucket index.
 		*/
 		double GetCurrentFromVoltage(double voltage);
+
+		/*
+			Batch version of GetCurrentFromVoltage, O(1) per voltage and vectorized
+		*/
+		void GetCurrentFromVoltage(const double* voltages, double* currents, int count);
+
+		/*
+			Pin the last calculated curve for reading from another thread, never blocks.
+			The Get*Array pointers are only safe on the calculating thread.
+		*/
+		CurvePublisher::Handle AcquireSnapshot() const;
+
+		/*
+			View of the last calculated curve, its arrays are the ones of the module and change
+			with the next calculation. Only valid on the calculating thread.
+		*/
+		CurveSnapshot GetCurve(void);
+
+		/*
+			Publish a curve solved by another module of the same model to the readers of this one,
+			without touching the arrays of this module
+		*/
+		void PublishCurve(const CurveSnapshot& curve);
+
+		/*
+			Adopt a curve solved by another module of the same model: its arrays, operating
+			condition and grid become the ones of this module, and are published
+		*/
+		void SetCurve(const CurveSnapshot& curve);
+
+		/*
+			Get the convergence report (iterations and residuals) of the last CalculateIVPArrays call
+		*/
+		SolverStats GetSolverStats();
 	
 	private:
 
 		// Nominal Parameters
-		double Voc_nom;
-		double Isc_nom;
-		double Vmp_nom;
-		double Imp_nom;
+		ModelParameters model_params;
 
-		double G_nom;
-		double T_nom;
-
-		// ----- //
+		// Parameters at the operating condition
 		double Vthermal;
 		double Rsh;
 		double Rs;
 		double I0;
 		double a;
-		double Ns;
-		double Np;
-		double idealityFactor;
 
 		double Ipv;
-		double Ipv_nom;
 
-		// Array pointers
+		// Reused curve storage and the array pointers into it
+		CurveBuffer buffer;
 		double* current_array;
 		double* voltage_array;
 		double* power_array;
+		double* slope_array;
+
+		void UpdateArrayPointers(void);
+
+		// Warm start of consecutive curves: the curve before the last one and the Newton seeds
+		std::vector<double> previous_current;
+		std::vector<double> warm_guess;
+		int warm_curves = 0;	// Solved curves of the current model and grid in current_array and previous_current (0 to 2)
+
+		// Grid of the calculated curve, the lookups depend on it
+		bool uniform_grid = true;
+		int requested_steps = 0;
+		std::vector<int> grid_index;
+
+		/*
+			Solved point of the adaptive refinement, with the exact slope dI/dV (A/V)
+		*/
+		struct GridPoint
+		{
+			double v, i, slope;
+			bool converged;
+
+			bool operator<(const GridPoint& other) const { return this->v < other.v; }
+		};
+
+		/*
+			Interval of the adaptive refinement, its midpoint is already solved
+		*/
+		struct GridInterval
+		{
+			GridPoint p0, p1, mid;
+			double error;	// Interpolation error at the midpoint, where it is the largest
+
+			bool operator<(const GridInterval& other) const { return this->error < other.error; }
+		};
+
+		// Scratch of the adaptive refinement, kept from call to call
+		std::vector<GridInterval> grid_intervals;
+		std::vector<GridPoint> grid_points;
+
+		/*
+			Place and solve the points of an adaptive grid, returns their count (at most this->steps)
+		*/
+		int RefineGrid(const Simd::DiodeParameters& diode);
+
+		// Snapshots of the calculated curves for the reader threads
+		CurvePublisher publisher;
+
+		void PublishSnapshot(void);
+
+		SolverStats solver_stats;
+
+		/*
+			Solve the single diode equation for the current at a voltage point,
+			starting from the initial guess. Returns the number of iterations used, converged tells
+			whether the fixed point iteration reached the tolerance.
+		*/
+		int SolveCurrentFixedPoint(double voltage, double& current, bool& converged);
+		int SolveCurrentLambertW(double voltage, double& current);
+
+		/*
+			Residual of the single diode equation f(I) = Ipv - I0 * (exp((V + I*Rs) / (a*Vt)) - 1) - (V + I*Rs) / Rsh - I
+		*/
+		double Residual(double voltage, double current);
 	};
 
+	/*
+		A sweep of one module. Every simulator owns its module, progress and timing report,
+		so several of them run at the same time (e.g. to compare modules under one sweep).
+	*/
 	class Simulator
 	{
 	public:
-		// Maybe add here the extern handle to the current PV module
-		// And add the extern handle of the sim_progress
-
-		bool enable_simulation;
-		bool thread_active;
+		SimulationMode mode = SimulationMode::RealTime;
+		int threads = 0;	// Workers of the Precomputed curves, 0 for one per core
 
 		Simulator();
 
 		/*
-			Start a simulation sweeping values for G and T from G_start to G_stop, T_start and T_stop
-			in a set time (seconds) time_secs
+			Sweep a copy of module, with its datasheet values, solver and grid settings
+		*/
+		explicit Simulator(const PVModule& module);
+
+		Simulator(const Simulator&) = delete;
+		Simulator& operator=(const Simulator&) = delete;
+
+		/*
+			Start a simulation of the module sweeping values for G and T from G_start to G_stop, T_start
+			and T_stop in a set time (seconds) time_secs. Step i is due at start + i * time_secs / sim_steps
+			on the clock, the computation time of a step never delays the following ones.
+			The curves of the module must be calculated once before, the sweep reuses its settings
+			(a module never calculated is not swept).
+			The sweep stops early once cancel (when not nullptr) is set, e.g. by the job running it.
+		*/
+		void Simulation(float G_start, float G_stop, float T_start, float T_stop, float time_secs, int sim_steps,
+			const std::atomic<bool>* cancel = nullptr);
+
+		/*
+			Pace the RealTime and Precomputed sweeps with another clock (nullptr for the wall clock).
+			The clock must outlive the simulation.
+		*/
+		void SetClock(Clock* clock);
+
+		/*
+			Get the schedule report of the last (or running) sweep
 		*/
-		void Simulation(float G_start, float G_stop, float T_start, float T_stop, float time_secs, int sim_steps);
+		SimulationTiming GetTiming(void);
+
+		/*
+			The swept module. Change it only while no sweep runs, its curves can be read from any
+			thread with AcquireSnapshot().
+		*/
+		PVModule& Module(void) { return this->module; }
+		const PVModule& Module(void) const { return this->module; }
+
+		/*
+			Progress of the last (or running) sweep from 0 to 1, 0 once cancelled
+		*/
+		float Progress(void) const { return this->progress.load(std::memory_order_relaxed); }
 	
 	private:
+		PVModule module;
+		std::atomic<float> progress;
+
 		float G_start;
 		float G_stop;
 		float T_start;
 		float T_stop;
 		float time_secs;
 		int sim_steps;
+
+		SteadyClock steady_clock;
+		Clock* clock;
+
+		// Cancellation flag of the running sweep, nullptr when it can't be cancelled
+		const std::atomic<bool>* cancel;
+
+		bool Cancelled(void) const { return this->cancel != nullptr && this->cancel->load(std::memory_order_relaxed); }
+
+		std::mutex timing_mtx;
+		SimulationTiming timing;
+
+		// Operating condition of every step of the sweep
+		std::vector<float> sim_g;
+		std::vector<float> sim_t;
+
+		// Precomputed curves, step i holds its voltage, current, power and slope arrays of
+		// curve_capacity points at precomputed[i * 4 * curve_capacity] and its grid index at
+		// precomputed_grid[i * 2 * curve_capacity]. Kept between sweeps with the worker modules.
+		int curve_capacity = 0;
+		std::vector<double> precomputed;
+		std::vector<int> precomputed_grid;
+		std::vector<CurveSnapshot> precomputed_curves;
+		std::vector<PVModule> solvers;
+
+		void Precompute(const ModelParameters& params, int count, int steps, int iterations);
+
+		void StoreCurve(int i, const CurveSnapshot& curve);
+
+		/*
+			Wait for a step deadline in short slices, so a stop request is seen while waiting
+		*/
+		bool WaitForDeadline(Clock* clock, double deadline);
+
+		void RecordLateness(double lateness);
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Alignment of the curve arrays, one cache line (and a full AVX-512 register)
+#define CURVE_ALIGNMENT 64
+
+// Arrays per curve: voltage, current, power and the interpolation slopes
+#define CURVE_ARRAYS 4
+
+namespace PV
+{
+	/*
+		Arena that backs the curve storage of many modules with a few large aligned blocks.
+		Released storage is kept in a free list and handed out again to the next request
+		of the same size. The arena must outlive every buffer allocated from it.
+	*/
+	class CurveArena
+	{
+	public:
+		explicit CurveArena(size_t block_doubles = 1 << 17);
+		~CurveArena();
+
+		CurveArena(const CurveArena&) = delete;
+		CurveArena& operator=(const CurveArena&) = delete;
+
+		/*
+			Get count doubles of CURVE_ALIGNMENT aligned storage
+		*/
+		double* Allocate(size_t count);
+
+		/*
+			Give back storage of a previous Allocate(count) call
+		*/
+		void Release(double* ptr, size_t count);
+
+	private:
+		std::mutex mtx;
+		size_t block_doubles;
+		std::vector<double*> blocks;
+		double* block_ptr;
+		size_t block_left;
+		std::map<size_t, std::vector<double*>> free_list;
+	};
+
+	/*
+		Capacity tracked, CURVE_ALIGNMENT aligned storage for the V, I, P and slope arrays of a curve.
+		The storage only grows, recalculating a curve with the same or fewer steps reuses it.
+	*/
+	class CurveBuffer
+	{
+	public:
+		CurveBuffer();
+		~CurveBuffer();
+
+		CurveBuffer(const CurveBuffer& other);
+		CurveBuffer& operator=(const CurveBuffer& other);
+		CurveBuffer(CurveBuffer&& other) noexcept;
+		CurveBuffer& operator=(CurveBuffer&& other) noexcept;
+
+		/*
+			Make room for steps points per array, existing contents are not kept on growth
+		*/
+		void Reserve(int steps);
+
+		/*
+			Back the storage by an arena instead of the heap (releases the current storage)
+		*/
+		void SetArena(CurveArena* arena);
+
+		double* Voltage() { return this->data; }
+		double* Current() { return this->data + this->capacity; }
+		double* Power() { return this->data + 2 * this->capacity; }
+		double* Slope() { return this->data + 3 * this->capacity; }
+
+		int Capacity() const { return (int)this->capacity; }
+
+		/*
+			Number of heap (or arena) allocations done by all curve buffers of the process
+		*/
+		static size_t AllocationCount(void);
+
+	private:
+		double* data;
+		size_t capacity;	// Points per array, a multiple of the alignment
+		CurveArena* arena;
+
+		static std::atomic<size_t> allocations;
+
+		void Free(void);
+	};
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+
+namespace PV
+{
+	/*
+		Time source of the simulator, in seconds. The simulator schedules every step at an
+		absolute deadline and waits for it through the clock, so a test (or a batch run) can
+		replace the wall clock with a virtual one.
+	*/
+	class Clock
+	{
+	public:
+		virtual ~Clock() = default;
+
+		virtual double Now(void) = 0;
+
+		/*
+			Block until Now() >= time, returns at once when time has already passed
+		*/
+		virtual void SleepUntil(double time) = 0;
+	};
+
+	/*
+		Wall clock over std::chrono::steady_clock, seconds since construction
+	*/
+	class SteadyClock : public Clock
+	{
+	public:
+		SteadyClock();
+
+		double Now(void) override;
+
+		/*
+			Sleeps until shortly before the deadline and yields for the rest, so the wake up
+			error stays well below the scheduler tick of the OS
+		*/
+		void SleepUntil(double time) override;
+
+	private:
+		std::chrono::steady_clock::time_point start;
+	};
+
+	/*
+		Clock that only moves when it is waited on (or advanced), waits never block
+	*/
+	class VirtualClock : public Clock
+	{
+	public:
+		explicit VirtualClock(double start = 0);
+
+		double Now(void) override;
+		void SleepUntil(double time) override;
+
+		void Advance(double seconds);
+
+	private:
+		std::atomic<double> time;
+	};
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+
+#include "pv_simd.h"
+
+namespace PV
+{
+	class PVModule;
+	struct CurveSnapshot;
+
+	/*
+		Interpolation policies of a CurveTable
+	*/
+	struct LinearInterpolation
+	{
+		static constexpr bool hermite = false;
+	};
+
+	struct PchipInterpolation
+	{
+		static constexpr bool hermite = true;	// Monotone cubic Hermite, the table stores the slopes too
+	};
+
+	/*
+		Compact lookup table of a curve on a uniform voltage grid, for the hardware in the loop lookups.
+
+		The precision and the interpolation are chosen at compile time: a float table takes half the
+		memory of a double one and its lookups run 8 instead of 4 points per AVX2 register, double
+		keeps the reference precision of the solved curve. The curve itself is always solved in
+		double (PVModule), the table only rounds it. Instantiated for float and double with both
+		interpolations (pv_curve.cpp).
+	*/
+	template <typename Scalar, typename Interpolation = LinearInterpolation>
+	class CurveTable
+	{
+		static_assert(std::is_same<Scalar, float>::value || std::is_same<Scalar, double>::value,
+			"CurveTable is only instantiated for float and double");
+		static_assert(std::is_same<Interpolation, LinearInterpolation>::value || std::is_same<Interpolation, PchipInterpolation>::value,
+			"CurveTable interpolation must be LinearInterpolation or PchipInterpolation");
+
+	public:
+		// Values per AVX2 register
+		static constexpr int LANES = 32 / sizeof(Scalar);
+
+		// Largest table resampled from an adaptive curve
+		static constexpr int MAX_RESAMPLED_STEPS = 1 << 16;
+
+		CurveTable();
+
+		/*
+			Round a curve on a uniform voltage grid from 0 to v_max into the table, the PCHIP slopes
+			are calculated from the double curve. i_sc is returned by the lookups of an empty curve.
+		*/
+		void Assign(const double* current, int steps, double v_max, double i_sc);
+
+		/*
+			Sample the last curve of a module at steps uniform voltages (0 for its requested steps),
+			on any voltage grid of the module
+		*/
+		void Assign(PVModule& module, int steps = 0);
+
+		/*
+			Sample a published curve at steps uniform voltages (0 for its own points). An adaptive
+			grid packs its points where the curve bends, the same count of uniform points misses
+			the knee: the points of the table are then doubled (up to MAX_RESAMPLED_STEPS) until
+			it reproduces the curve within tolerance (A) between them, or its error stops dropping
+			(the rounding floor of a float table).
+		*/
+		void Assign(const CurveSnapshot& curve, int steps = 0, double tolerance = 1e-4);
+
+		/*
+			Get current value from the voltage, voltages outside [0, v_max] are clamped
+		*/
+		Scalar GetCurrentFromVoltage(Scalar voltage) const;
+
+		/*
+			Batch version of GetCurrentFromVoltage, vectorized
+		*/
+		void GetCurrentFromVoltage(const Scalar* voltages, Scalar* currents, int count) const;
+
+		int Steps(void) const { return this->table.steps; }
+
+		/*
+			Memory of the table arrays in bytes
+		*/
+		size_t Bytes(void) const;
+
+	private:
+		std::vector<Scalar> current;
+		std::vector<Scalar> slope;
+		Simd::BasicLookupTable<Scalar> table;
+		Scalar i_sc;
+
+		// Scratch of Assign, kept from call to call
+		std::vector<double> sample_voltages;
+		std::vector<double> samples;
+		std::vector<double> sample_slopes;
+
+		void Sample(const CurveSnapshot& curve, int steps);
+
+		/*
+			Largest difference to the curve at the midpoints of the table intervals
+		*/
+		double ResampleError(const CurveSnapshot& curve) const;
+	};
+
+	/*
+		Precision of the hardware in the loop lookup tables, float unless the build defines
+		PVWATCH_HIL_DOUBLE for reference precision lookups
+	*/
+#ifdef PVWATCH_HIL_DOUBLE
+	typedef double HilScalar;
+#else
+	typedef float HilScalar;
+#endif
+
+	extern template class CurveTable<float, LinearInterpolation>;
+	extern template class CurveTable<float, PchipInterpolation>;
+	extern template class CurveTable<double, LinearInterpolation>;
+	extern template class CurveTable<double, PchipInterpolation>;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+/*
+	Vectorized kernels of the single diode model.
+
+	The AVX2 kernel solves 4 voltage points per lane group and is selected at runtime,
+	machines (or builds) without AVX2 fall back to the scalar kernel.
+	Both kernels run Newton-Raphson to the same per point tolerance, so the curves they
+	produce agree to within 2 * tolerance (A). The vectorized exp() has a relative
+	error below 2 ulp over the clamped input range [-708, 709].
+*/
+
+namespace PV
+{
+	namespace Simd
+	{
+		enum class Isa
+		{
+			Scalar,
+			AVX2
+		};
+
+		/*
+			Single diode model parameters at one operating condition
+		*/
+		struct DiodeParameters
+		{
+			double Ipv;		// Photocurrent (A)
+			double I0;		// Diode saturation current (A)
+			double Rs;		// Series resistance (Ohm)
+			double Rsh;		// Shunt resistance (Ohm)
+			double a_vt;	// Modified ideality factor times thermal voltage (V)
+		};
+
+		/*
+			Single diode parameters of count points in columns (structure of arrays), every point
+			has its own, e.g. one point per module of a fleet
+		*/
+		struct DiodeColumns
+		{
+			const double* Ipv;
+			const double* I0;
+			const double* Rs;
+			const double* Rsh;
+			const double* a_vt;
+		};
+
+		/*
+			Convergence report of a kernel call
+		*/
+		struct KernelReport
+		{
+			int total_iterations;	// Iterations summed over all points
+			int max_iterations;		// Worst case iterations of a single point
+			int unconverged_points;	// Points whose last step was still above the tolerance
+			double max_residual;	// Worst |f(I)| at the returned currents (A)
+		};
+
+		/*
+			Lookup table of a curve sampled on a uniform voltage grid from 0 to v_max, in double
+			or in float (half the memory, 8 instead of 4 values per AVX2 register)
+		*/
+		template <typename Scalar>
+		struct BasicLookupTable
+		{
+			const Scalar* current;
+			const Scalar* slope;	// PCHIP slopes in A per grid step, nullptr for linear interpolation
+			int steps;				// At least 2 points
+			Scalar v_max;
+			Scalar inv_dv;			// (steps - 1) / v_max, reciprocal of the grid step
+		};
+
+		typedef BasicLookupTable<double> LookupTable;
+
+		/*
+			Best instruction set supported by this CPU (detected once)
+		*/
+		Isa DetectIsa(void);
+
+		const char* IsaName(Isa isa);
+
+		/*
+			Solve the single diode equation with Newton-Raphson for count points.
+			Inputs: the model parameters, voltage array, the first point initial guess (must be
+			above the solution, Ipv always is), max iterations and tolerance on the current (A).
+			guesses, when not nullptr, seeds every point instead (e.g. from the previous curve of a
+			sweep), a point stops as soon as its Newton error bound is within the tolerance.
+			Output: current array, and the convergence report
+		*/
+		KernelReport SolveCurrentNewton(const DiodeParameters& params, const double* voltage, double* current,
+			int count, double initial_guess, const double* guesses, int max_iters, double tolerance, Isa isa);
+
+		/*
+			SolveCurrentNewton of count points with their own parameters. Every point starts from
+			its guess (clamped to its photocurrent), or from its photocurrent when guesses is nullptr.
+		*/
+		KernelReport SolveCurrentNewtonColumns(const DiodeColumns& params, const double* voltage, double* current,
+			int count, const double* guesses, int max_iters, double tolerance, Isa isa);
+
+		/*
+			Interpolate the current of count voltages in O(1) each, voltages outside
+			[0, v_max] are clamped to the ends of the curve.
+			Instantiated for float and double only.
+		*/
+		template <typename Scalar>
+		void LookupCurrent(const BasicLookupTable<Scalar>& table, const Scalar* voltage, Scalar* current, int count, Isa isa);
+
+		/*
+			Monotone (Fritsch-Carlson) Hermite slopes of a uniform grid curve, in units per grid step
+		*/
+		void PchipSlopes(const double* current, double* slope, int steps);
+
+		/*
+			sum[i] += scale * values[i] for count values, composes the curves of series (or
+			parallel) connected modules
+		*/
+		void AccumulateScaled(double* sum, const double* values, double scale, int count, Isa isa);
+
+		/*
+			exp() of count values, used to validate the vectorized exp against libm
+		*/
+		void Exp(const double* x, double* y, int count, Isa isa);
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "pv_buffer.h"
+
+namespace PV
+{
+	/*
+		Immutable view of a published curve, valid while its CurvePublisher::Handle is alive
+	*/
+	struct CurveSnapshot
+	{
+		uint64_t version;	// Increases with every publication
+		int steps;
+		double G;
+		double T;
+		double Voc;
+		double Isc;
+
+		const double* voltage;
+		const double* current;
+		const double* power;
+		const double* slope;	// PCHIP slopes, nullptr when the curve uses linear interpolation
+
+		// Bucket index of an adaptive voltage grid (slopes per volt), nullptr for a uniform grid (slopes per step)
+		const int* grid_index;
+		int grid_buckets;
+
+		/*
+			Get current value from the voltage, with a linear (or PCHIP) approximation between
+			the two closest points
+		*/
+		double GetCurrentFromVoltage(double voltage) const;
+
+		/*
+			Batch version of GetCurrentFromVoltage
+		*/
+		void GetCurrentFromVoltage(const double* voltages, double* currents, int count) const;
+	};
+
+	/*
+		Publishes the curves of a writer (calculation or simulation thread) to any number of
+		readers (render loop, communication threads) without locking the readers.
+
+		The writer fills a free back slot and swaps it in with one atomic store. A reader pins
+		the published slot with a reference count, so the writer never reuses a slot that
+		is still read. With SNAPSHOT_SLOTS slots up to SNAPSHOT_SLOTS - 2 readers can hold a
+		snapshot at the same time without ever delaying the writer.
+	*/
+	class CurvePublisher
+	{
+		struct Slot;
+
+	public:
+		static const int SNAPSHOT_SLOTS = 4;
+
+		/*
+			RAII pin of a snapshot, readers should keep it only for the duration of a frame
+		*/
+		class Handle
+		{
+		public:
+			Handle() : slot(nullptr) {}
+			~Handle() { this->Release(); }
+
+			Handle(const Handle&) = delete;
+			Handle& operator=(const Handle&) = delete;
+			Handle(Handle&& other) noexcept : slot(other.slot) { other.slot = nullptr; }
+			Handle& operator=(Handle&& other) noexcept;
+
+			explicit operator bool() const { return this->slot != nullptr; }
+			const CurveSnapshot& operator*() const { return this->slot->snapshot; }
+			const CurveSnapshot* operator->() const { return &this->slot->snapshot; }
+
+		private:
+			friend class CurvePublisher;
+
+			Slot* slot;
+
+			void Release(void);
+		};
+
+		CurvePublisher();
+
+		CurvePublisher(const CurvePublisher&) = delete;
+		CurvePublisher& operator=(const CurvePublisher&) = delete;
+
+		/*
+			Copy a curve into a back slot and make it the published snapshot, slope may be nullptr,
+			grid_index too for uniform voltage grids
+		*/
+		void Publish(const double* voltage, const double* current, const double* power, const double* slope,
+			int steps, double g, double t, double v_oc, double i_sc, const int* grid_index = nullptr, int grid_buckets = 0);
+
+		/*
+			Pin the latest published snapshot, never blocks. Empty if nothing was published yet.
+		*/
+		Handle Acquire(void) const;
+
+		/*
+			Version of the latest published snapshot (0 if none)
+		*/
+		uint64_t Version(void) const;
+
+	private:
+		struct Slot
+		{
+			std::atomic<int> readers;
+			CurveBuffer buffer;
+			std::vector<int> grid_index;
+			CurveSnapshot snapshot;
+		};
+
+		mutable Slot slots[SNAPSHOT_SLOTS];
+		std::atomic<int> published;
+		std::atomic<uint64_t> version;
+
+		// Serializes writers only, readers never touch it
+		std::mutex write_mtx;
+	};
+}
@@ -1,127 +1,573 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <random>
 #include <math.h>
+#include <string.h>
 #include <thread>
 #include <chrono>
 
 #include "../include/pv.h"
+#include "../include/pv_simd.h"
+#include "../include/pv_buffer.h"
+#include "../include/pv_snapshot.h"
+#include "../../profiler/include/profiler.h"
 
+// Uniform points the adaptive refinement starts from
+#define GRID_SEED_POINTS 9
+
+
+PV::PVModule::PVModule()
+{
+	this->Voc = 0;
+	this->Isc = 0;
+	this->Vmp = 0;
+	this->Imp = 0;
+	this->G = G_nominal;
+	this->T = T_nominal;
+
+	this->steps = 0;
+	this->iters = 0;
+
+	this->model_params = {};
+	this->Vthermal = 0;
+	this->Rsh = 0;
+	this->Rs = 0;
+	this->I0 = 0;
+	this->a = 0;
+	this->Ipv = 0;
+
+	this->current_array = nullptr;
+	this->voltage_array = nullptr;
+	this->power_array = nullptr;
+	this->slope_array = nullptr;
+
+	this->solver_stats = { 0, 0, 0, 0, 0.0 };
+}
+
+PV::PVModule::PVModule(const PVModule& other)
+{
+	*this = other;
+}
+
+PV::PVModule& PV::PVModule::operator=(const PVModule& other)
+{
+	if (this == &other) return *this;
+
+	this->Voc = other.Voc;
+	this->Isc = other.Isc;
+	this->Vmp = other.Vmp;
+	this->Imp = other.Imp;
+	this->G = other.G;
+	this->T = other.T;
+
+	this->steps = other.steps;
+	this->iters = other.iters;
+	this->solver_method = other.solver_method;
+	this->tolerance = other.tolerance;
+	this->use_simd = other.use_simd;
+	this->warm_start = other.warm_start;
+	this->interpolation_mode = other.interpolation_mode;
+	this->grid_mode = other.grid_mode;
+	this->grid_tolerance = other.grid_tolerance;
+	this->uniform_grid = other.uniform_grid;
+	this->requested_steps = other.requested_steps;
+	this->grid_index = other.grid_index;
+
+	this->model_params = other.model_params;
+	this->Vthermal = other.Vthermal;
+	this->Rsh = other.Rsh;
+	this->Rs = other.Rs;
+	this->I0 = other.I0;
+	this->a = other.a;
+	this->Ipv = other.Ipv;
+
+	this->solver_stats = other.solver_stats;
+
+	// The array pointers must follow the copied storage
+	this->buffer = other.buffer;
+	this->UpdateArrayPointers();
+
+	// The copied curve can seed the next one, the curve before it stays with other
+	this->warm_curves = std::min(other.warm_curves, 1);
+
+	// Readers of the copy get its own snapshots
+	if (this->steps > 0) this->PublishSnapshot();
+
+	return *this;
+}
 
 void PV::PVModule::ClearCurrentArray()
 {
-	delete[] this->current_array;
-	delete[] this->voltage_array;
-	delete[] this->power_array;
+	// Keep the storage for the next calculation, only the curve is dropped
+	this->steps = 0;
+	this->warm_curves = 0;
+	this->PublishSnapshot();
+}
 
-	this->current_array = new double[0];
-	this->voltage_array = new double[0];
-	this->power_array = new double[0];
+void PV::PVModule::SetArena(CurveArena* arena)
+{
+	this->buffer.SetArena(arena);
+	this->steps = 0;
+	this->warm_curves = 0;
+	this->UpdateArrayPointers();
 }
 
-void PV::PVModule::CalculateIVPArrays(float v_oc,float i_sc, float v_mp, float i_mp, float g, float t_e, int steps, int iterations)
+void PV::PVModule::UpdateArrayPointers()
 {
-	// Set up calculation parameters
-	this->steps = steps >= 0 ? steps : 0;
-	this->iters = iterations >= 0 ? iterations : 0;
+	this->voltage_array = this->buffer.Voltage();
+	this->current_array = this->buffer.Current();
+	this->power_array = this->buffer.Power();
+	this->slope_array = this->buffer.Slope();
+}
+
+PV::ModelParameters PV::ExtractModelParameters(float v_oc, float i_sc, float v_mp, float i_mp, int iterations)
+{
+	PVWATCH_PROFILE_SCOPE("pv.extract_parameters");
 
-	// Set up current, voltage, and power arrays
-	this->current_array = new double[this->steps];
-	this->voltage_array = new double[this->steps];
-	this->power_array	= new double[this->steps];
+	ModelParameters params;
 
 	// Setup nominal parameters
-	this->Voc_nom = (double)v_oc;
-	this->Isc_nom = (double)i_sc;
-	this->Vmp_nom = (double)v_mp;
-	this->Imp_nom = (double)i_mp;
-	this->G_nom = 1000;
-	this->T_nom = 25;
+	params.Voc_nom = (double)v_oc;
+	params.Isc_nom = (double)i_sc;
+	params.Vmp_nom = (double)v_mp;
+	params.Imp_nom = (double)i_mp;
+	params.G_nom = G_nominal;
+	params.T_nom = T_nominal;
 
-	this->Vthermal = k * (this->T + 274.15) / q;
+	// The extraction is done at the nominal (datasheet) temperature
+	params.Vthermal_nom = k * (params.T_nom + 273.15) / q;
+	double Vthermal = params.Vthermal_nom;
 
-	// Set up intrinsic PV parameters
-	this->G = (double)g;
-	this->T = (double)t_e;
-	this->Voc = this->Voc_nom + (this->Vthermal * log(this->G / this->G_nom));
-	this->Isc = (double)i_sc;
-	this->Vmp = (double)v_mp;
-	this->Imp = (double)i_mp;
+	double Voc_nom = params.Voc_nom;
+	double Isc = params.Isc_nom;
+	double Vmp = params.Vmp_nom;
+	double Imp = params.Imp_nom;
 
 	//Initialize this values for convergence
 	//According to https://oa.upm.es/30693/1/2014ICREARA.pdf
 
-	this->Rsh = 100;
-	this->Rs = 1;
-	this->I0 = 0;
-	this->a = 1;
-	this->Ns = 1;
-	this->Np = 1;
-	this->idealityFactor = 1;
-	this->Ipv = 0;
+	double Rs = 1;
+	double idealityFactor = 1;
 
 	//Calculate a including Number of series and parallel cells
-	this->Ns = this->Voc_nom / UNITY_CELL_VOC;
-	if (this->Ns - floor(this->Ns) > 0.5) this->Ns = floor(this->Ns) + 1;
-	else this->Ns = floor(this->Ns);
+	params.Ns = Voc_nom / UNITY_CELL_VOC;
+	if (params.Ns - floor(params.Ns) > 0.5) params.Ns = floor(params.Ns) + 1;
+	else params.Ns = floor(params.Ns);
 
-	this->Np = this->Isc / UNITY_CELL_ISC;
-	if (this->Np - floor(this->Np) > 0.5) this->Np = floor(this->Np) + 1;
-	else this->Np = floor(this->Np);
+	params.Np = Isc / UNITY_CELL_ISC;
+	if (params.Np - floor(params.Np) > 0.5) params.Np = floor(params.Np) + 1;
+	else params.Np = floor(params.Np);
 
-	this->a = this->Ns / this->Np;
-	this->a *= this->idealityFactor;
+	params.a = params.Ns / params.Np;
+	params.a *= idealityFactor;
 
+	double a = params.a;
 
 	//Calculate Rs based on the above mentioned paper
-	for (int i = 0; i < this->iters; i++)
+	for (int i = 0; i < iterations; i++)
 	{
-		double eq_10_num = this->a * this->Vthermal * this->Vmp * (2 * this->Imp - this->Isc);
-		double eq_10_den = (this->Vmp * this->Isc + this->Voc_nom * (this->Imp - this->Isc)) * 
-			(this->Vmp - this->Imp * this->Rs) - this->a * this->Vthermal * 
-			(this->Vmp * this->Isc - this->Voc_nom * this->Imp);
-		
-		this->Rs = (this->a * this->Vthermal * log(eq_10_num / eq_10_den) + this->Voc_nom - this->Vmp) / this->Imp;
+		double eq_10_num = a * Vthermal * Vmp * (2 * Imp - Isc);
+		double eq_10_den = (Vmp * Isc + Voc_nom * (Imp - Isc)) *
+			(Vmp - Imp * Rs) - a * Vthermal *
+			(Vmp * Isc - Voc_nom * Imp);
+
+		Rs = (a * Vthermal * log(eq_10_num / eq_10_den) + Voc_nom - Vmp) / Imp;
 	}
 
+	params.Rs = Rs;
+
 	//Calculate Rsh based on the above mentioned paper
-	float eq_11_num = (this->Vmp * this->Imp * this->Rs) * (this->Vmp - this->Rs * (this->Isc - this->Imp) - this->a * this->Vthermal);
-	float eq_11_den = (this->Vmp - this->Imp * this->Rs) * (this->Isc - this->Imp) - this->a * this->Vthermal * this->Imp;
+	double eq_11_num = (Vmp * Imp * Rs) * (Vmp - Rs * (Isc - Imp) - a * Vthermal);
+	double eq_11_den = (Vmp - Imp * Rs) * (Isc - Imp) - a * Vthermal * Imp;
 
-	this->Rsh = eq_11_num / eq_11_den;
+	params.Rsh = eq_11_num / eq_11_den;
 
-	//calculate I0
-	float eq_6_num = (this->Rsh + this->Rs) * this->Isc - this->Voc_nom;
-	float eq_6_den = this->Rsh * exp(this->Voc_nom / (this->a * this->Vthermal));
+	//Numerator of I0 (eq. 6), the denominator depends on the cell temperature
+	params.I0_num = (params.Rsh + params.Rs) * Isc - Voc_nom;
 
-	this->I0 = eq_6_num / eq_6_den;
+	//Calculate nominal photocurrent Ipv
+	params.Ipv_nom = ((params.Rsh + params.Rs) / params.Rsh) * params.Isc_nom;
 
-	//Calculate photocurrent Ipv
-	
-	this->Ipv_nom = ((this->Rsh + this->Rs) / this->Rsh) * this->Isc_nom;
-	this->Ipv = (this->G / this->G_nom) * this->Ipv_nom;
+	return params;
+}
 
-	for (int i = 0; i < this->steps; i++)
+PV::ParameterCache& PV::ParameterCache::Instance()
+{
+	static ParameterCache cache;
+	return cache;
+}
+
+PV::ModelParameters PV::ParameterCache::Get(float v_oc, float i_sc, float v_mp, float i_mp, int iterations)
+{
+	Key key(v_oc, i_sc, v_mp, i_mp, iterations);
+
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	auto it = this->entries.find(key);
+	if (it != this->entries.end()) return it->second;
+
+	ModelParameters params = ExtractModelParameters(v_oc, i_sc, v_mp, i_mp, iterations);
+	this->entries.emplace(key, params);
+	return params;
+}
+
+void PV::ParameterCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	this->entries.clear();
+}
+
+size_t PV::ParameterCache::Size()
+{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->entries.size();
+}
+
+void PV::PVModule::CalculateIVPArrays(float v_oc,float i_sc, float v_mp, float i_mp, float g, float t_e, int steps, int iterations)
+{
+	int iters = iterations >= 0 ? iterations : 0;
+
+	this->CalculateIVPArrays(ParameterCache::Instance().Get(v_oc, i_sc, v_mp, i_mp, iters), g, t_e, steps, iterations);
+}
+
+void PV::PVModule::CalculateIVPArrays(const ModelParameters& params, float g, float t_e, int steps, int iterations)
+{
+	PVWATCH_PROFILE_SCOPE("pv.curve_solve");
+
+	// The previous curves only seed this one on the same model and uniform grid
+	int new_steps = steps >= 0 ? steps : 0;
+	bool uniform = !(this->grid_mode == GridMode::Adaptive && new_steps > 2);
+	bool same_grid = uniform && this->uniform_grid && new_steps == this->steps;
+	if (!(this->warm_start && same_grid && memcmp(&params, &this->model_params, sizeof(ModelParameters)) == 0)) this->warm_curves = 0;
+
+	// Set up calculation parameters
+	this->steps = new_steps;
+	this->requested_steps = this->steps;
+	this->iters = iterations >= 0 ? iterations : 0;
+
+	// Set up current, voltage, and power arrays, the storage only grows with the steps
+	this->buffer.Reserve(this->steps);
+	this->UpdateArrayPointers();
+
+	// So do the warm start seeds and the grid index (2 buckets per point), sized with the first
+	// curve rather than the first one they are used for
+	if (uniform && this->warm_start && (int)this->warm_guess.size() < this->steps)
+	{
+		this->warm_guess.resize(this->steps);
+		this->previous_current.resize(this->steps);
+	}
+	if (!uniform) this->grid_index.reserve(2 * this->steps);
+
+	this->model_params = params;
+
+	// Set up intrinsic PV parameters, only the condition dependent terms are calculated here
+	this->G = (double)g;
+	this->T = (double)t_e;
+	this->Vthermal = k * (this->T + 273.15) / q;
+	this->Voc = params.Voc_nom + (this->Vthermal * log(this->G / params.G_nom));
+	this->Isc = params.Isc_nom;
+	this->Vmp = params.Vmp_nom;
+	this->Imp = params.Imp_nom;
+
+	Simd::DiodeParameters diode = DiodeAtCondition(params, this->G, this->T);
+	this->a = params.a;
+	this->Rs = diode.Rs;
+	this->Rsh = diode.Rsh;
+	this->I0 = diode.I0;
+	this->Ipv = diode.Ipv;
+
+	this->solver_stats = { this->steps, 0, 0, 0, 0.0 };
+	this->uniform_grid = uniform;
+
+	//Fill V array, the adaptive grid places its points while solving them
+	if (this->uniform_grid)
 	{
-		//Fill V array and zero the I array
-		this->voltage_array[i] = (double)i * this->Voc / (double)(this->steps - 1);
-		this->current_array[i] = 0;
+		for (int i = 0; i < this->steps; i++)
+		{
+			this->voltage_array[i] = (double)i * this->Voc / (double)(this->steps - 1);
+		}
+	}
 
-		for (int j = 0; j < this->iters; j++)
+	// Warm start, every point starts from the previous curves linearly extrapolated in the sweep.
+	// The solution is below the photocurrent, guesses above it would only cost iterations.
+	// The last curve is kept, it is the one before the next.
+	const double* guesses = nullptr;
+	if (this->warm_curves > 0)
+	{
+		this->warm_guess.resize(this->steps);
+		this->previous_current.resize(this->steps);
+		for (int i = 0; i < this->steps; i++)
 		{
-			double voltageAtThisPoint = (double)i * this->Voc / (double)(this->steps - 1);
-			//float voltageAtThisPoint = this->voltageLookUpTable[i];
-			double exponent_value = (voltageAtThisPoint + this->current_array[i] * this->Rs) / (this->a * this->Vthermal);
-			double term1 = this->I0 * (exp(exponent_value) - 1);
-			double term2 = (voltageAtThisPoint + this->current_array[i] * this->Rs) / this->Rsh;
-			this->current_array[i] = this->Ipv - term1 - term2;
+			double last = this->current_array[i];
+			double guess = (this->warm_curves > 1) ? 2 * last - this->previous_current[i] : last;
+			this->warm_guess[i] = std::min(guess, this->Ipv);
+			this->previous_current[i] = last;
 		}
-		
+		guesses = this->warm_guess.data();
+	}
+
+	if (!this->uniform_grid)
+	{
+		this->steps = this->RefineGrid(diode);
+		this->solver_stats.points = this->steps;
+	}
+	else if (this->solver_method == SolverMethod::Newton)
+	{
+		// Vectorized kernel, without guesses the first point starts from the photocurrent which is
+		// always above the solution, every next point is warm started from its neighbours
+		Simd::Isa isa = this->use_simd ? Simd::DetectIsa() : Simd::Isa::Scalar;
+
+		Simd::KernelReport report = Simd::SolveCurrentNewton(
+			diode,
+			this->voltage_array,
+			this->current_array,
+			this->steps,
+			this->Ipv,
+			guesses,
+			this->iters,
+			this->tolerance,
+			isa
+		);
+
+		this->solver_stats.total_iterations = report.total_iterations;
+		this->solver_stats.max_iterations = report.max_iterations;
+		this->solver_stats.unconverged_points = report.unconverged_points;
+		this->solver_stats.max_residual = report.max_residual;
+	}
+	else
+	{
+		for (int i = 0; i < this->steps; i++)
+		{
+			double voltageAtThisPoint = this->voltage_array[i];
+			double current = 0;
+			int point_iters = 0;
+			bool converged = true;
+
+			if (this->solver_method == SolverMethod::FixedPoint) point_iters = this->SolveCurrentFixedPoint(voltageAtThisPoint, current, converged);
+			else point_iters = this->SolveCurrentLambertW(voltageAtThisPoint, current);
+
+			// Convergence report
+			double residual = fabs(this->Residual(voltageAtThisPoint, current));
+			this->solver_stats.total_iterations += point_iters;
+			if (point_iters > this->solver_stats.max_iterations) this->solver_stats.max_iterations = point_iters;
+				if (residual > this->solver_stats.max_residual) this->solver_stats.max_residual = residual;
+
+			this->current_array[i] = current;
+		}
+	}
+
+	for (int i = 0; i < this->steps; i++)
+	{
 		// Clip current to avoid negative values
 		if (this->current_array[i] < 0) this->current_array[i] = 0;
-		
+
 		// Fill the power array
 		this->power_array[i] = this->voltage_array[i] * this->current_array[i];
 	}
+
+	// Monotone cubic interpolation slopes for the lookups, the adaptive grid has the exact ones
+	if (this->interpolation_mode == InterpolationMode::Pchip && this->uniform_grid) Simd::PchipSlopes(this->current_array, this->slope_array, this->steps);
+
+	if (!this->uniform_grid) BuildGridIndex(this->voltage_array, this->steps, this->grid_index);
+
+	this->warm_curves = (this->warm_start && this->uniform_grid) ? std::min(this->warm_curves + 1, 2) : 0;
+
+	this->PublishSnapshot();
+}
+
+PV::Simd::DiodeParameters PV::DiodeAtCondition(const ModelParameters& params, double g, double t_e)
+{
+	Simd::DiodeParameters diode;
+	double v_thermal = k * (t_e + 273.15) / q;
+
+	diode.Rs = params.Rs;
+	diode.Rsh = params.Rsh;
+	diode.a_vt = params.a * v_thermal;
+
+	//calculate I0 (eq. 6) at the cell temperature
+	diode.I0 = params.I0_num / (params.Rsh * exp(params.Voc_nom / diode.a_vt));
+
+	//Calculate photocurrent Ipv
+	diode.Ipv = (g / params.G_nom) * params.Ipv_nom;
+
+	return diode;
+}
+
+double PV::SolveCurrent(const Simd::DiodeParameters& diode, double voltage, double initial_guess, double tolerance,
+	int* iterations, int max_iterations, bool* converged)
+{
+	// f(I) is decreasing and concave: a step from below the root lands above it (the step is at
+	// most Ipv + I0 since f' <= -1), from above Newton converges monotonically
+	double current = initial_guess;
+	bool within = false;
+	int j = 0;
+	for (; j < max_iterations; j++)
+	{
+		double e = diode.I0 * exp((voltage + current * diode.Rs) / diode.a_vt);
+		double f = diode.Ipv - (e - diode.I0) - (voltage + current * diode.Rs) / diode.Rsh - current;
+		double df = -(e * diode.Rs / diode.a_vt + diode.Rs / diode.Rsh + 1);
+
+		double delta = f / df;
+		current -= delta;
+		if (fabs(delta) <= tolerance) { within = true; j++; break; }
+	}
+
+	if (iterations != nullptr) *iterations = j;
+	if (converged != nullptr) *converged = within;
+	return current;
+}
+
+PV::MaxPowerPoint PV::SolveMaxPowerPoint(const ModelParameters& params, double g, double t_e, double tolerance)
+{
+	if (!(g > 0)) return {};
+
+	// Start from the datasheet MPP, scaled to the condition
+	double voltage_fraction = (params.Voc_nom > 0) ? params.Vmp_nom / params.Voc_nom : 0.8;
+	double current_fraction = (params.Isc_nom > 0) ? params.Imp_nom / params.Isc_nom : 1.0;
+
+	return SolveMaxPowerPoint(DiodeAtCondition(params, g, t_e), tolerance, voltage_fraction, current_fraction);
+}
+
+PV::MaxPowerPoint PV::SolveMaxPowerPoint(const Simd::DiodeParameters& d, double tolerance, double voltage_fraction, double current_fraction)
+{
+	MaxPowerPoint mpp = {};
+	if (!(d.Ipv > 0 && d.I0 > 0 && d.a_vt > 0)) return mpp;
+
+	double n = d.a_vt;
+
+	// dP/dV > 0 at 0, and < 0 from the open circuit voltage on. The open circuit voltage without
+	// the shunt is above the real one, so it closes the bracket without solving for Voc
+	double low = 0;
+	double high = n * log(d.Ipv / d.I0 + 1);
+
+	double voltage = voltage_fraction * high;
+	double current = current_fraction * d.Ipv;
+
+	for (int j = 0; j < 100; j++)
+	{
+		current = SolveCurrent(d, voltage, current, TOLERANCE_nominal);
+
+		// Implicit derivatives of f(V, I) = 0, with gd the conductance of the diode and shunt branch
+		double e = d.I0 * exp((voltage + current * d.Rs) / n);
+		double gd = e / n + 1 / d.Rsh;
+		double di = -gd / (1 + gd * d.Rs);
+		double dgd = e / (n * n) * (1 + d.Rs * di);
+		double ddi = -dgd / ((1 + gd * d.Rs) * (1 + gd * d.Rs));
+
+		double dp = current + voltage * di;
+		double ddp = 2 * di + voltage * ddi;
+
+		if (dp > 0) low = voltage;
+		else high = voltage;
+
+		// Newton inside the bracket, bisection when it leaves it (or P is not concave there)
+		double next = (ddp < 0) ? voltage - dp / ddp : low - 1;
+		if (!(next > low && next < high)) next = 0.5 * (low + high);
+
+		mpp.iterations = j + 1;
+
+		double step = fabs(next - voltage);
+		voltage = next;
+		if (step <= tolerance || high - low <= tolerance) break;
+	}
+
+	mpp.V = voltage;
+	mpp.I = SolveCurrent(d, voltage, current, TOLERANCE_nominal);
+	mpp.P = mpp.V * mpp.I;
+
+	return mpp;
+}
+
+double PV::PVModule::Residual(double voltage, double current)
+{
+	double exponent_value = (voltage + current * this->Rs) / (this->a * this->Vthermal);
+	double term1 = this->I0 * (exp(exponent_value) - 1);
+	double term2 = (voltage + current * this->Rs) / this->Rsh;
+	return this->Ipv - term1 - term2 - current;
+}
+
+int PV::PVModule::SolveCurrentFixedPoint(double voltage, double& current, bool& converged)
+{
+	// Original iteration I(n+1) = Ipv - I0 * (exp(..) - 1) - (V + I(n)*Rs) / Rsh, starting from zero
+	current = 0;
+	converged = false;
+
+	for (int j = 0; j < this->iters; j++)
+	{
+		double exponent_value = (voltage + current * this->Rs) / (this->a * this->Vthermal);
+		double term1 = this->I0 * (exp(exponent_value) - 1);
+		double term2 = (voltage + current * this->Rs) / this->Rsh;
+		double next = this->Ipv - term1 - term2;
+
+		converged = fabs(next - current) < this->tolerance;
+		current = next;
+
+		if (converged) return j + 1;
+	}
+
+	return this->iters;
+}
+
+int PV::PVModule::SolveCurrentLambertW(double voltage, double& current)
+{
+	double a_vt = this->a * this->Vthermal;
+
+	// Without series resistance the equation is already explicit
+	if (this->Rs <= 0)
+	{
+		current = this->Ipv - this->I0 * (exp(voltage / a_vt) - 1) - voltage / this->Rsh;
+		return 0;
+	}
+
+	// I = (Rsh * (Ipv + I0) - V) / (Rs + Rsh) - (a*Vt / Rs) * W(theta), see Jain & Kapoor (2004)
+	// theta overflows a double close to Voc, so W is evaluated from ln(theta)
+	double r_sum = this->Rs + this->Rsh;
+	double log_theta = log(this->Rs * this->Rsh * this->I0 / (a_vt * r_sum))
+		+ this->Rsh * (this->Rs * (this->Ipv + this->I0) + voltage) / (a_vt * r_sum);
+
+	// Principal branch, W * exp(W) = theta
+	double w;
+	int j = 0;
+	if (log_theta < 0)
+	{
+		// Small argument, Halley on w * exp(w) - theta
+		double theta = exp(log_theta);
+		w = log1p(theta);
+		for (; j < 16; j++)
+		{
+			double ew = exp(w);
+			double f = w * ew - theta;
+			double delta = f / (ew * (w + 1) - (w + 2) * f / (2 * w + 2));
+			w -= delta;
+			if (fabs(delta) <= 1e-15 * (1 + fabs(w))) { j++; break; }
+		}
+	}
+	else
+	{
+		// Large argument, Newton on w + ln(w) - ln(theta) which never touches exp()
+		w = (log_theta > 1) ? log_theta - log(log_theta) : 1;
+		for (; j < 16; j++)
+		{
+			double delta = (w + log(w) - log_theta) * w / (w + 1);
+			w -= delta;
+			if (fabs(delta) <= 1e-15 * (1 + w)) { j++; break; }
+		}
+	}
+
+	current = (this->Rsh * (this->Ipv + this->I0) - voltage) / r_sum - a_vt / this->Rs * w;
+
+	return j;
+}
+
+int PV::PVModule::GetRequestedSteps()
+{
+	return this->requested_steps;
+}
+
+PV::ModelParameters PV::PVModule::GetModelParameters()
+{
+	return this->model_params;
 }
 
 double* PV::PVModule::GetCurrentArray()
@@ -139,44 +585,388 @@ double* PV::PVModule::GetPowerArray()
 	return this->power_array;
 }
 
+PV::SolverStats PV::PVModule::GetSolverStats()
+{
+	return this->solver_stats;
+}
+
 double PV::PVModule::GetCurrentFromVoltage(double voltage)
 {
-	if (this->steps <= 1) return this->Isc;
+	double current;
+	this->GetCurrentFromVoltage(&voltage, &current, 1);
+	return current;
+}
 
-	double real_voltage = (voltage > this->Voc) ? this->Voc : voltage;
+void PV::PVModule::GetCurrentFromVoltage(const double* voltages, double* currents, int count)
+{
+	PVWATCH_PROFILE_SCOPE("pv.lookup");
+
+	const double* slope = (this->interpolation_mode == InterpolationMode::Pchip) ? this->slope_array : nullptr;
 
-	double approx_voltage_idx = real_voltage / (this->Voc / (this->steps - 1));
+	if (this->uniform_grid) LookupCurrent(this->voltage_array, this->current_array, slope, this->steps, this->Voc, this->Isc, voltages, currents, count);
+	else LookupCurrentNonUniform(this->voltage_array, this->current_array, slope, this->steps,
+		this->grid_index.data(), (int)this->grid_index.size(), this->Isc, voltages, currents, count);
+}
 
-	int voltage_floor_idx = (int)floor(approx_voltage_idx);
-	int voltage_ceil_idx = (int)ceil(approx_voltage_idx);
+void PV::LookupCurrent(const double* voltage_array, const double* current_array, const double* slope_array,
+	int steps, double v_oc, double i_sc, const double* voltages, double* currents, int count)
+{
+	if (steps <= 1 || !(v_oc > 0))
+	{
+		for (int i = 0; i < count; i++) currents[i] = i_sc;
+		return;
+	}
 
-	double voltage_floor = this->voltage_array[voltage_floor_idx];
-	double voltage_ceil = this->voltage_array[voltage_ceil_idx];
+	Simd::LookupTable table = { current_array, slope_array, steps, voltage_array[steps - 1], (double)(steps - 1) / voltage_array[steps - 1] };
 
-	double current_floor = this->current_array[voltage_floor_idx];
-	double current_ceil = this->current_array[voltage_ceil_idx];
+	// Single lookups skip the dispatch, batches go through the vectorized gather
+	Simd::LookupCurrent(table, voltages, currents, count, (count >= 4) ? Simd::DetectIsa() : Simd::Isa::Scalar);
+}
 
-	// Calculate semi linear current through the slope of the floor and ceil currents
-	double slope = (current_ceil - current_floor) / (voltage_ceil - voltage_floor);
-	
-	double current = ((real_voltage - voltage_floor) * slope) + current_floor;
+void PV::BuildGridIndex(const double* voltage_array, int steps, std::vector<int>& index)
+{
+	// Twice the points, most buckets then hold at most one point
+	int buckets = (steps > 1 && voltage_array[steps - 1] > 0) ? 2 * steps : 0;
+	index.resize(buckets);
 
-	return current;
+	int point = 0;
+	for (int b = 0; b < buckets; b++)
+	{
+		double start = (double)b * voltage_array[steps - 1] / buckets;
+		while (point < steps - 2 && voltage_array[point + 1] <= start) point++;
+		index[b] = point;
+	}
+}
+
+void PV::LookupCurrentNonUniform(const double* voltage_array, const double* current_array, const double* slope_array,
+	int steps, const int* index, int buckets, double i_sc, const double* voltages, double* currents, int count)
+{
+	if (steps <= 1 || buckets <= 0 || !(voltage_array[steps - 1] > 0))
+	{
+		for (int i = 0; i < count; i++) currents[i] = i_sc;
+		return;
+	}
+
+	double buckets_per_volt = buckets / voltage_array[steps - 1];
+
+	for (int i = 0; i < count; i++)
+	{
+		double voltage = voltages[i];
+
+		// Written so that NaN lands on the first point
+		if (!(voltage > voltage_array[0]))
+		{
+			currents[i] = current_array[0];
+			continue;
+		}
+		if (voltage >= voltage_array[steps - 1])
+		{
+			currents[i] = current_array[steps - 1];
+			continue;
+		}
+
+		// From the last point at or below the bucket start to voltage_array[idx] <= voltage < voltage_array[idx + 1]
+		int bucket = std::min((int)(voltage * buckets_per_volt), buckets - 1);
+		int idx = index[bucket];
+		while (idx < steps - 2 && voltage_array[idx + 1] <= voltage) idx++;
+		double h = voltage_array[idx + 1] - voltage_array[idx];
+		double t = (voltage - voltage_array[idx]) / h;
+
+		double c0 = current_array[idx];
+		double c1 = current_array[idx + 1];
+
+		if (slope_array == nullptr)
+		{
+			currents[i] = c0 + t * (c1 - c0);
+			continue;
+		}
+
+		// Cubic Hermite between the two points, the slopes are per volt
+		double t2 = t * t;
+		double t3 = t2 * t;
+		currents[i] = (2 * t3 - 3 * t2 + 1) * c0 + (t3 - 2 * t2 + t) * h * slope_array[idx]
+			+ (3 * t2 - 2 * t3) * c1 + (t3 - t2) * h * slope_array[idx + 1];
+	}
+}
+
+int PV::PVModule::RefineGrid(const Simd::DiodeParameters& diode)
+{
+	int max_points = this->steps;
+	int seed_points = std::min(max_points, GRID_SEED_POINTS);
+	bool hermite = this->interpolation_mode == InterpolationMode::Pchip;
+
+	this->grid_points.clear();
+	this->grid_intervals.clear();
+
+	auto solve = [&](double voltage, double guess)
+	{
+		int point_iters = 0;
+		GridPoint point;
+		point.v = voltage;
+		point.i = SolveCurrent(diode, voltage, guess, this->tolerance, &point_iters, this->iters, &point.converged);
+
+		// dI/dV of the single diode equation, by implicit differentiation
+		double conductance = diode.I0 / diode.a_vt * exp((voltage + point.i * diode.Rs) / diode.a_vt) + 1 / diode.Rsh;
+		point.slope = -conductance / (1 + diode.Rs * conductance);
+
+		// Convergence report
+		double residual = fabs(this->Residual(voltage, point.i));
+		this->solver_stats.total_iterations += point_iters;
+		if (point_iters > this->solver_stats.max_iterations) this->solver_stats.max_iterations = point_iters;
+		if (residual > this->solver_stats.max_residual) this->solver_stats.max_residual = residual;
+
+		return point;
+	};
+
+	// Every interval solves its midpoint up front, the largest error is split first
+	auto add_interval = [&](const GridPoint& p0, const GridPoint& p1)
+	{
+		GridInterval interval;
+		interval.p0 = p0;
+		interval.p1 = p1;
+
+		double linear = 0.5 * (p0.i + p1.i);
+		interval.mid = solve(0.5 * (p0.v + p1.v), linear);
+
+		// Both interpolations are exact at the ends, their error peaks at the middle
+		double predicted = hermite ? linear + (p1.v - p0.v) * (p0.slope - p1.slope) / 8 : linear;
+		interval.error = fabs(interval.mid.i - predicted);
+
+		this->grid_intervals.push_back(interval);
+		std::push_heap(this->grid_intervals.begin(), this->grid_intervals.end());
+	};
+
+	// Uniform seed, the photocurrent is above the solution at every voltage
+	GridPoint previous = solve(0, this->Ipv);
+	this->grid_points.push_back(previous);
+
+	for (int s = 1; s < seed_points; s++)
+	{
+		GridPoint point = solve((double)s * this->Voc / (double)(seed_points - 1), previous.i);
+
+		this->grid_points.push_back(point);
+		add_interval(previous, point);
+		previous = point;
+	}
+
+	while (!this->grid_intervals.empty() && (int)this->grid_points.size() < max_points)
+	{
+		std::pop_heap(this->grid_intervals.begin(), this->grid_intervals.end());
+		GridInterval interval = this->grid_intervals.back();
+		this->grid_intervals.pop_back();
+
+		// Written so that a NaN error (no curve, G <= 0) stops the refinement
+		if (!(interval.error > this->grid_tolerance)) break;
+
+		this->grid_points.push_back(interval.mid);
+		add_interval(interval.p0, interval.mid);
+		add_interval(interval.mid, interval.p1);
+	}
+
+	std::sort(this->grid_points.begin(), this->grid_points.end());
+
+	int count = (int)this->grid_points.size();
+	for (int i = 0; i < count; i++)
+	{
+		this->voltage_array[i] = this->grid_points[i].v;
+		this->current_array[i] = this->grid_points[i].i;
+		this->slope_array[i] = this->grid_points[i].slope;
+
+		// Only the points of the curve count, not the midpoints left out
+		if (!this->grid_points[i].converged) this->solver_stats.unconverged_points++;
+	}
+
+	return count;
+}
+
+PV::CurvePublisher::Handle PV::PVModule::AcquireSnapshot() const
+{
+	return this->publisher.Acquire();
+}
+
+void PV::PVModule::PublishSnapshot()
+{
+	this->publisher.Publish(this->voltage_array, this->current_array, this->power_array,
+		(this->interpolation_mode == InterpolationMode::Pchip) ? this->slope_array : nullptr,
+		this->steps, this->G, this->T, this->Voc, this->Isc,
+		this->uniform_grid ? nullptr : this->grid_index.data(), this->uniform_grid ? 0 : (int)this->grid_index.size());
+}
+
+PV::CurveSnapshot PV::PVModule::GetCurve()
+{
+	CurveSnapshot curve = {};
+	curve.version = this->publisher.Version();
+	curve.steps = this->steps;
+	curve.G = this->G;
+	curve.T = this->T;
+	curve.Voc = this->Voc;
+	curve.Isc = this->Isc;
+	curve.voltage = this->voltage_array;
+	curve.current = this->current_array;
+	curve.power = this->power_array;
+	curve.slope = (this->interpolation_mode == InterpolationMode::Pchip) ? this->slope_array : nullptr;
+	curve.grid_index = this->uniform_grid ? nullptr : this->grid_index.data();
+	curve.grid_buckets = this->uniform_grid ? 0 : (int)this->grid_index.size();
+	return curve;
+}
+
+void PV::PVModule::PublishCurve(const CurveSnapshot& curve)
+{
+	this->publisher.Publish(curve.voltage, curve.current, curve.power, curve.slope,
+		curve.steps, curve.G, curve.T, curve.Voc, curve.Isc, curve.grid_index, curve.grid_buckets);
+}
+
+void PV::PVModule::SetCurve(const CurveSnapshot& curve)
+{
+	// Operating condition, the model is the one of this module
+	this->G = curve.G;
+	this->T = curve.T;
+	this->Vthermal = k * (this->T + 273.15) / q;
+	this->Voc = curve.Voc;
+	this->Isc = curve.Isc;
+
+	Simd::DiodeParameters diode = DiodeAtCondition(this->model_params, this->G, this->T);
+	this->a = this->model_params.a;
+	this->Rs = diode.Rs;
+	this->Rsh = diode.Rsh;
+	this->I0 = diode.I0;
+	this->Ipv = diode.Ipv;
+
+	this->buffer.Reserve(curve.steps);
+	this->UpdateArrayPointers();
+	this->steps = curve.steps;
+
+	memcpy(this->voltage_array, curve.voltage, this->steps * sizeof(double));
+	memcpy(this->current_array, curve.current, this->steps * sizeof(double));
+	memcpy(this->power_array, curve.power, this->steps * sizeof(double));
+	if (curve.slope != nullptr) memcpy(this->slope_array, curve.slope, this->steps * sizeof(double));
+
+	this->uniform_grid = (curve.grid_index == nullptr);
+	if (!this->uniform_grid) this->grid_index.assign(curve.grid_index, curve.grid_index + curve.grid_buckets);
+
+	// The adopted curve can seed the next one, the curve before it is unknown
+	this->warm_curves = (this->warm_start && this->uniform_grid) ? 1 : 0;
+
+	this->PublishSnapshot();
 }
 
 PV::Simulator::Simulator()
 {
-	this->enable_simulation = true;
-	this->thread_active = false;
+	this->progress = 0;
+	this->cancel = nullptr;
+	this->clock = &this->steady_clock;
+	this->timing = {};
 }
 
-void PV::Simulator::Simulation(float G_start, float G_stop, float T_start, float T_stop, float time_secs, int sim_steps)
+PV::Simulator::Simulator(const PVModule& module) : Simulator()
 {
-	// Enable the simulation thread flag;
-	this->enable_simulation = true;
-	
-	// Prevent doublicate threads
-	this->thread_active = true;
+	this->module = module;
+}
+
+void PV::Simulator::SetClock(Clock* clock)
+{
+	this->clock = (clock != nullptr) ? clock : &this->steady_clock;
+}
+
+PV::SimulationTiming PV::Simulator::GetTiming()
+{
+	std::lock_guard<std::mutex> lock(this->timing_mtx);
+	return this->timing;
+}
+
+bool PV::Simulator::WaitForDeadline(Clock* clock, double deadline)
+{
+	const double slice = 0.05;
+
+	while (!this->Cancelled())
+	{
+		double now = clock->Now();
+		if (now >= deadline) return true;
+
+		clock->SleepUntil((deadline - now > slice) ? now + slice : deadline);
+	}
+
+	return false;
+}
+
+void PV::Simulator::RecordLateness(double lateness)
+{
+	PVWATCH_PROFILE_VALUE("sim.step_lateness", lateness);
+
+	std::lock_guard<std::mutex> lock(this->timing_mtx);
+
+	this->timing.steps++;
+	this->timing.mean_lateness += (lateness - this->timing.mean_lateness) / this->timing.steps;
+	if (lateness > this->timing.max_lateness) this->timing.max_lateness = lateness;
+}
+
+void PV::Simulator::Precompute(const ModelParameters& params, int count, int steps, int iterations)
+{
+	// Flat storage of every curve, only grows
+	this->curve_capacity = std::max(steps, 1);
+	this->precomputed.resize((size_t)(count + 1) * 4 * this->curve_capacity);
+	this->precomputed_grid.resize((size_t)(count + 1) * 2 * this->curve_capacity);
+	this->precomputed_curves.resize(count + 1);
+
+	// Workers take runs of consecutive steps, so one module solves them warm started from each other
+	const int chunk = 32;
+
+	int thread_count = (this->threads > 0) ? this->threads : (int)std::thread::hardware_concurrency();
+	thread_count = std::max(1, std::min(thread_count, count / chunk + 1));
+
+	if ((int)this->solvers.size() < thread_count) this->solvers.resize(thread_count);
+	for (int t = 0; t < thread_count; t++) this->solvers[t] = this->module;
+
+	std::atomic<int> next(0);
+	auto worker = [&](int t)
+	{
+		PVModule& solver = this->solvers[t];
+		int first;
+		while ((first = next.fetch_add(chunk)) <= count && !this->Cancelled())
+		{
+			int last = std::min(first + chunk, count + 1);
+			for (int i = first; i < last && !this->Cancelled(); i++)
+			{
+				solver.CalculateIVPArrays(params, this->sim_g[i], this->sim_t[i], steps, iterations);
+				this->StoreCurve(i, solver.GetCurve());
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	workers.reserve(thread_count - 1);
+	for (int t = 1; t < thread_count; t++) workers.emplace_back(worker, t);
+	worker(0);
+	for (std::thread& thread : workers) thread.join();
+}
+
+void PV::Simulator::StoreCurve(int i, const CurveSnapshot& curve)
+{
+	double* voltage = &this->precomputed[(size_t)i * 4 * this->curve_capacity];
+	double* current = voltage + this->curve_capacity;
+	double* power = current + this->curve_capacity;
+	double* slope = power + this->curve_capacity;
+	int* grid_index = &this->precomputed_grid[(size_t)i * 2 * this->curve_capacity];
+
+	memcpy(voltage, curve.voltage, curve.steps * sizeof(double));
+	memcpy(current, curve.current, curve.steps * sizeof(double));
+	memcpy(power, curve.power, curve.steps * sizeof(double));
+	if (curve.slope != nullptr) memcpy(slope, curve.slope, curve.steps * sizeof(double));
+	if (curve.grid_index != nullptr) memcpy(grid_index, curve.grid_index, curve.grid_buckets * sizeof(int));
+
+	CurveSnapshot& stored = this->precomputed_curves[i];
+	stored = curve;
+	stored.voltage = voltage;
+	stored.current = current;
+	stored.power = power;
+	stored.slope = (curve.slope != nullptr) ? slope : nullptr;
+	stored.grid_index = (curve.grid_index != nullptr) ? grid_index : nullptr;
+}
+
+void PV::Simulator::Simulation(float G_start, float G_stop, float T_start, float T_stop, float time_secs, int sim_steps,
+	const std::atomic<bool>* cancel)
+{
+	this->cancel = cancel;
 
 	this->G_start	= G_start;
 	this->G_stop	= G_stop;
@@ -185,85 +975,102 @@ void PV::Simulator::Simulation(float G_start, float G_stop, float T_start, float
 	this->time_secs = time_secs;
 	this->sim_steps = sim_steps;
 
-	// Get the current displayed pv module
-	extern PVModule pvModule;
+	this->progress = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(this->timing_mtx);
+		this->timing = {};
+	}
+
+	// Without a calculated curve the module has no model (nor grid) to sweep
+	if (this->module.GetRequestedSteps() <= 0)
+	{
+		this->cancel = nullptr;
+		return;
+	}
+
+	// The datasheet values don't change during the sweep, so the
+	// parameter extraction of the module is reused by every step
+	ModelParameters params = this->module.GetModelParameters();
 
-	// Get the current progress bar variable
-	extern float sim_progress;
+	int current_pv_parameter_calc_steps = this->module.GetRequestedSteps();
+	int current_pv_parameter_calc_inter = this->module.iters;
 
-	// Set the initial state of the PV module to G_start and T_start
-	double current_v_oc = pvModule.Voc;
-	double current_i_sc = pvModule.Isc;
-	double current_v_mp = pvModule.Vmp;
-	double current_i_mp = pvModule.Imp;
+	// Operating condition of every step, from the start values (step 0) to exactly the stop values
+	int count = (this->sim_steps > 0) ? this->sim_steps : 0;
+	this->sim_g.resize(count + 1);
+	this->sim_t.resize(count + 1);
+	for (int i = 0; i <= count; i++)
+	{
+		float fraction = (count > 0) ? (float)i / (float)count : 1.0f;
+		this->sim_g[i] = this->G_start + (this->G_stop - this->G_start) * fraction;
+		this->sim_t[i] = this->T_start + (this->T_stop - this->T_start) * fraction;
+	}
 
-	int current_pv_parameter_calc_steps = pvModule.steps;
-	int current_pv_parameter_calc_inter = pvModule.iters;
+	double step_time = (count > 0) ? (double)this->time_secs / count : 0;
 
-	pvModule.CalculateIVPArrays(
-		current_v_oc,
-		current_i_sc,
-		current_v_mp,
-		current_i_mp,
-		this->G_start,
-		this->T_start,
-		current_pv_parameter_calc_steps,
-		current_pv_parameter_calc_inter
-	);
+	// Max speed runs the same schedule on a clock that never waits
+	VirtualClock virtual_clock(this->clock->Now());
+	Clock* clock = (this->mode == SimulationMode::MaxSpeed) ? &virtual_clock : this->clock;
 
+	// Precomputed sweeps calculate every curve up front, the playback only publishes them
+	if (this->mode == SimulationMode::Precomputed)
+	{
+		auto precompute_start = std::chrono::steady_clock::now();
 
-	float G_step = (this->G_stop - this->G_start) / this->sim_steps;
-	float T_step = (this->T_stop - this->T_start) / this->sim_steps;
+		this->Precompute(params, count, current_pv_parameter_calc_steps, current_pv_parameter_calc_inter);
 
-	int time_in_millis = (int)ceil((1000 * this->time_secs) / this->sim_steps);
+		std::lock_guard<std::mutex> lock(this->timing_mtx);
+		this->timing.precompute_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - precompute_start).count();
+	}
 
-	float sim_g = this->G_start;
-	float sim_t = this->T_start;
+	double start = clock->Now();
 
-	for (int i = 0; i < this->sim_steps; i++)
+	for (int i = 0; i <= count; i++)
 	{
-		if (!this->enable_simulation)
+		// Deadlines are absolute, a late step doesn't shift the following ones
+		double deadline = start + i * step_time;
+
+		if (!this->WaitForDeadline(clock, deadline))
 		{
-			// Update the progress bar
-			sim_progress = 0;
-			this->thread_active = false;
+			// The module keeps the last published curve
+			if (this->mode == SimulationMode::Precomputed && i > 0) this->module.SetCurve(this->precomputed_curves[i - 1]);
+
+			this->progress = 0;
+			this->cancel = nullptr;
 			return;
 		}
 
-		pvModule.CalculateIVPArrays(
-			pvModule.Voc,
-			pvModule.Isc,
-			pvModule.Vmp,
-			pvModule.Imp,
-			sim_g,
-			sim_t,
-			pvModule.steps,
-			pvModule.iters
-		);
-		
-		sim_g += G_step;
-		sim_t += T_step;
+		PVWATCH_PROFILE_SCOPE("sim.step");
+
+		if (this->mode == SimulationMode::Precomputed)
+		{
+			// Only the last curve is copied into the module, the readers get every one
+			if (i < count) this->module.PublishCurve(this->precomputed_curves[i]);
+			else this->module.SetCurve(this->precomputed_curves[i]);
+		}
+		else
+		{
+			this->module.CalculateIVPArrays(
+				params,
+				this->sim_g[i],
+				this->sim_t[i],
+				current_pv_parameter_calc_steps,
+				current_pv_parameter_calc_inter
+			);
+		}
 
-		// Update the progress bar
-		sim_progress = (float)i / (float)this->sim_steps;
+		this->RecordLateness(clock->Now() - deadline);
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(time_in_millis));
+		this->progress = (count > 0) ? (float)i / (float)count : 1.0f;
 	}
 
-	// Set the stop parameters
-
-	pvModule.CalculateIVPArrays(
-		current_v_oc,
-		current_i_sc,
-		current_v_mp,
-		current_i_mp,
-		this->G_stop,
-		this->T_stop,
-		current_pv_parameter_calc_steps,
-		current_pv_parameter_calc_inter
-	);
+	{
+		std::lock_guard<std::mutex> lock(this->timing_mtx);
+		this->timing.duration_error = (clock->Now() - start) - this->time_secs;
+	}
 
-	this->thread_active = false;
+	this->cancel = nullptr;
 
 	return;
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <new>
+#include <string.h>
+
+#include "../include/pv_buffer.h"
+
+#define DOUBLES_PER_LINE (CURVE_ALIGNMENT / sizeof(double))
+
+namespace
+{
+	size_t RoundToLine(size_t count)
+	{
+		return (count + DOUBLES_PER_LINE - 1) / DOUBLES_PER_LINE * DOUBLES_PER_LINE;
+	}
+
+	double* AlignedAllocate(size_t count)
+	{
+		return static_cast<double*>(::operator new(count * sizeof(double), std::align_val_t(CURVE_ALIGNMENT)));
+	}
+
+	void AlignedFree(double* ptr)
+	{
+		::operator delete(ptr, std::align_val_t(CURVE_ALIGNMENT));
+	}
+}
+
+std::atomic<size_t> PV::CurveBuffer::allocations(0);
+
+PV::CurveArena::CurveArena(size_t block_doubles)
+{
+	this->block_doubles = RoundToLine(block_doubles > 0 ? block_doubles : DOUBLES_PER_LINE);
+	this->block_ptr = nullptr;
+	this->block_left = 0;
+}
+
+PV::CurveArena::~CurveArena()
+{
+	for (double* block : this->blocks) AlignedFree(block);
+}
+
+double* PV::CurveArena::Allocate(size_t count)
+{
+	count = RoundToLine(count);
+
+	std::lock_guard<std::mutex> lock(this->mtx);
+
+	// Reuse released storage of the same size first
+	auto it = this->free_list.find(count);
+	if (it != this->free_list.end() && !it->second.empty())
+	{
+		double* ptr = it->second.back();
+		it->second.pop_back();
+		return ptr;
+	}
+
+	if (count > this->block_left)
+	{
+		size_t block_size = (count > this->block_doubles) ? count : this->block_doubles;
+		this->block_ptr = AlignedAllocate(block_size);
+		this->block_left = block_size;
+		this->blocks.push_back(this->block_ptr);
+	}
+
+	double* ptr = this->block_ptr;
+	this->block_ptr += count;
+	this->block_left -= count;
+	return ptr;
+}
+
+void PV::CurveArena::Release(double* ptr, size_t count)
+{
+	if (ptr == nullptr) return;
+
+	std::lock_guard<std::mutex> lock(this->mtx);
+	this->free_list[RoundToLine(count)].push_back(ptr);
+}
+
+PV::CurveBuffer::CurveBuffer()
+{
+	this->data = nullptr;
+	this->capacity = 0;
+	this->arena = nullptr;
+}
+
+PV::CurveBuffer::~CurveBuffer()
+{
+	this->Free();
+}
+
+PV::CurveBuffer::CurveBuffer(const CurveBuffer& other) : CurveBuffer()
+{
+	*this = other;
+}
+
+PV::CurveBuffer& PV::CurveBuffer::operator=(const CurveBuffer& other)
+{
+	if (this == &other) return *this;
+
+	// Copies keep the array layout of the source (every array at the same offset)
+	if (this->capacity != other.capacity)
+	{
+		this->Free();
+		if (other.capacity > 0)
+		{
+			this->data = (this->arena != nullptr) ? this->arena->Allocate(CURVE_ARRAYS * other.capacity) : AlignedAllocate(CURVE_ARRAYS * other.capacity);
+			this->capacity = other.capacity;
+			allocations++;
+		}
+	}
+
+	if (other.capacity > 0) memcpy(this->data, other.data, CURVE_ARRAYS * other.capacity * sizeof(double));
+
+	return *this;
+}
+
+PV::CurveBuffer::CurveBuffer(CurveBuffer&& other) noexcept
+{
+	this->data = other.data;
+	this->capacity = other.capacity;
+	this->arena = other.arena;
+
+	other.data = nullptr;
+	other.capacity = 0;
+}
+
+PV::CurveBuffer& PV::CurveBuffer::operator=(CurveBuffer&& other) noexcept
+{
+	if (this == &other) return *this;
+
+	this->Free();
+	this->data = other.data;
+	this->capacity = other.capacity;
+	this->arena = other.arena;
+
+	other.data = nullptr;
+	other.capacity = 0;
+
+	return *this;
+}
+
+void PV::CurveBuffer::Reserve(int steps)
+{
+	size_t needed = RoundToLine(steps > 0 ? (size_t)steps : 0);
+	if (needed <= this->capacity) return;
+
+	this->Free();
+
+	// V, I, P and the slopes share one allocation, every array starts on a cache line
+	this->data = (this->arena != nullptr) ? this->arena->Allocate(CURVE_ARRAYS * needed) : AlignedAllocate(CURVE_ARRAYS * needed);
+	this->capacity = needed;
+	allocations++;
+}
+
+void PV::CurveBuffer::SetArena(CurveArena* arena)
+{
+	if (arena == this->arena) return;
+
+	this->Free();
+	this->arena = arena;
+}
+
+size_t PV::CurveBuffer::AllocationCount()
+{
+	return allocations.load();
+}
+
+void PV::CurveBuffer::Free()
+{
+	if (this->data != nullptr)
+	{
+		if (this->arena != nullptr) this->arena->Release(this->data, CURVE_ARRAYS * this->capacity);
+		else AlignedFree(this->data);
+	}
+
+	this->data = nullptr;
+	this->capacity = 0;
+}
@@ -0,0 +1,50 @@
+#include <thread>
+
+#include "../include/pv_clock.h"
+
+// Part of a wait that is spent yielding instead of sleeping (s)
+#define CLOCK_SPIN_WINDOW 0.002
+
+PV::SteadyClock::SteadyClock()
+{
+	this->start = std::chrono::steady_clock::now();
+}
+
+double PV::SteadyClock::Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count();
+}
+
+void PV::SteadyClock::SleepUntil(double time)
+{
+	double remaining = time - this->Now();
+	if (remaining > CLOCK_SPIN_WINDOW)
+	{
+		std::this_thread::sleep_until(this->start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(time - CLOCK_SPIN_WINDOW)));
+	}
+
+	while (this->Now() < time) std::this_thread::yield();
+}
+
+PV::VirtualClock::VirtualClock(double start)
+{
+	this->time = start;
+}
+
+double PV::VirtualClock::Now()
+{
+	return this->time.load();
+}
+
+void PV::VirtualClock::SleepUntil(double time)
+{
+	double now = this->time.load();
+	while (now < time && !this->time.compare_exchange_weak(now, time));
+}
+
+void PV::VirtualClock::Advance(double seconds)
+{
+	double now = this->time.load();
+	while (!this->time.compare_exchange_weak(now, now + seconds));
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <math.h>
+
+#include "../include/pv_curve.h"
+#include "../include/pv.h"
+#include "../include/pv_snapshot.h"
+#include "../../profiler/include/profiler.h"
+
+template <typename Scalar, typename Interpolation>
+PV::CurveTable<Scalar, Interpolation>::CurveTable()
+{
+	this->table = { nullptr, nullptr, 0, 0, 0 };
+	this->i_sc = 0;
+}
+
+template <typename Scalar, typename Interpolation>
+void PV::CurveTable<Scalar, Interpolation>::Assign(const double* current, int steps, double v_max, double i_sc)
+{
+	this->i_sc = (Scalar)i_sc;
+
+	if (steps <= 1 || !(v_max > 0))
+	{
+		this->table = { nullptr, nullptr, 0, 0, 0 };
+		return;
+	}
+
+	this->current.assign(current, current + steps);
+
+	if (Interpolation::hermite)
+	{
+		this->sample_slopes.resize(steps);
+		Simd::PchipSlopes(current, this->sample_slopes.data(), steps);
+		this->slope.assign(this->sample_slopes.begin(), this->sample_slopes.end());
+	}
+
+	this->table.current = this->current.data();
+	this->table.slope = Interpolation::hermite ? this->slope.data() : nullptr;
+	this->table.steps = steps;
+	this->table.v_max = (Scalar)v_max;
+	this->table.inv_dv = (Scalar)((steps - 1) / v_max);
+}
+
+template <typename Scalar, typename Interpolation>
+void PV::CurveTable<Scalar, Interpolation>::Assign(PVModule& module, int steps)
+{
+	if (steps <= 0) steps = module.GetRequestedSteps();
+	if (steps <= 1 || module.steps <= 0)
+	{
+		this->Assign(nullptr, 0, 0, module.Isc);
+		return;
+	}
+
+	// The module lookups return its own points on the same uniform grid, and interpolate any other one
+	this->sample_voltages.resize(steps);
+	for (int i = 0; i < steps; i++) this->sample_voltages[i] = (double)i * module.Voc / (double)(steps - 1);
+
+	this->samples.resize(steps);
+	module.GetCurrentFromVoltage(this->sample_voltages.data(), this->samples.data(), steps);
+
+	this->Assign(this->samples.data(), steps, module.Voc, module.Isc);
+}
+
+template <typename Scalar, typename Interpolation>
+void PV::CurveTable<Scalar, Interpolation>::Assign(const CurveSnapshot& curve, int steps, double tolerance)
+{
+	if (steps <= 0) steps = curve.steps;
+	if (steps <= 1 || curve.steps <= 1 || !(curve.Voc > 0))
+	{
+		this->Assign(nullptr, 0, 0, curve.Isc);
+		return;
+	}
+
+	this->Sample(curve, steps);
+
+	// 2 * steps - 1 points keep the previous ones and halve every interval. Once the error stops
+	// dropping it is the rounding of Scalar, not the interpolation: more points won't help.
+	if (curve.grid_index == nullptr || !(tolerance > 0)) return;
+
+	double error = this->ResampleError(curve);
+	while (error > tolerance && steps < MAX_RESAMPLED_STEPS)
+	{
+		int refined = std::min(2 * steps - 1, (int)MAX_RESAMPLED_STEPS);
+		this->Sample(curve, refined);
+
+		double refined_error = this->ResampleError(curve);
+		if (refined_error > 0.75 * error)
+		{
+			this->Sample(curve, steps);
+			break;
+		}
+
+		steps = refined;
+		error = refined_error;
+	}
+}
+
+template <typename Scalar, typename Interpolation>
+void PV::CurveTable<Scalar, Interpolation>::Sample(const CurveSnapshot& curve, int steps)
+{
+	// Same sampling as the module one, the snapshot lookups follow its grid and interpolation
+	this->sample_voltages.resize(steps);
+	for (int i = 0; i < steps; i++) this->sample_voltages[i] = (double)i * curve.Voc / (double)(steps - 1);
+
+	this->samples.resize(steps);
+	curve.GetCurrentFromVoltage(this->sample_voltages.data(), this->samples.data(), steps);
+
+	this->Assign(this->samples.data(), steps, curve.Voc, curve.Isc);
+}
+
+template <typename Scalar, typename Interpolation>
+double PV::CurveTable<Scalar, Interpolation>::ResampleError(const CurveSnapshot& curve) const
+{
+	double error = 0;
+	int steps = this->table.steps;
+	for (int i = 0; i + 1 < steps; i++)
+	{
+		// Both at the voltage the table sees, its rounding is not an interpolation error
+		Scalar voltage = (Scalar)((i + 0.5) * curve.Voc / (double)(steps - 1));
+		double difference = fabs((double)this->GetCurrentFromVoltage(voltage) - curve.GetCurrentFromVoltage((double)voltage));
+		if (difference > error) error = difference;
+	}
+
+	return error;
+}
+
+template <typename Scalar, typename Interpolation>
+Scalar PV::CurveTable<Scalar, Interpolation>::GetCurrentFromVoltage(Scalar voltage) const
+{
+	Scalar current;
+	this->GetCurrentFromVoltage(&voltage, &current, 1);
+	return current;
+}
+
+template <typename Scalar, typename Interpolation>
+void PV::CurveTable<Scalar, Interpolation>::GetCurrentFromVoltage(const Scalar* voltages, Scalar* currents, int count) const
+{
+	PVWATCH_PROFILE_SCOPE("pv.lookup");
+
+	if (this->table.steps <= 1)
+	{
+		for (int i = 0; i < count; i++) currents[i] = this->i_sc;
+		return;
+	}
+
+	// Single lookups skip the dispatch, batches of at least a register go through the vectorized gather
+	Simd::LookupCurrent(this->table, voltages, currents, count, (count >= LANES) ? Simd::DetectIsa() : Simd::Isa::Scalar);
+}
+
+template <typename Scalar, typename Interpolation>
+size_t PV::CurveTable<Scalar, Interpolation>::Bytes() const
+{
+	return (this->current.capacity() + this->slope.capacity()) * sizeof(Scalar);
+}
+
+template class PV::CurveTable<float, PV::LinearInterpolation>;
+template class PV::CurveTable<float, PV::PchipInterpolation>;
+template class PV::CurveTable<double, PV::LinearInterpolation>;
+template class PV::CurveTable<double, PV::PchipInterpolation>;
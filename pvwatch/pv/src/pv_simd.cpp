@@ -0,0 +1,701 @@
+#include <algorithm>
+#include <math.h>
+
+#include "../include/pv_simd.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PV_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PV_TARGET_AVX2
+#else
+#define PV_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+// Range of exp() arguments that keep 2^n a normal double
+#define EXP_MIN_ARG -708.0
+#define EXP_MAX_ARG 709.0
+
+namespace
+{
+	PV::Simd::Isa QueryIsa()
+	{
+#ifdef PV_SIMD_X86
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 0);
+		if (regs[0] < 7) return PV::Simd::Isa::Scalar;
+
+		__cpuid(regs, 1);
+		bool fma = (regs[2] & (1 << 12)) != 0;
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+		if (!(fma && osxsave && avx)) return PV::Simd::Isa::Scalar;
+
+		// The OS must save the YMM registers on context switch
+		if ((_xgetbv(0) & 0x6) != 0x6) return PV::Simd::Isa::Scalar;
+
+		__cpuidex(regs, 7, 0);
+		if ((regs[1] & (1 << 5)) == 0) return PV::Simd::Isa::Scalar;
+
+		return PV::Simd::Isa::AVX2;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return PV::Simd::Isa::AVX2;
+		return PV::Simd::Isa::Scalar;
+#endif
+#else
+		return PV::Simd::Isa::Scalar;
+#endif
+	}
+
+	/*
+		Largest Newton step after which the current is within tolerance of the solution.
+		|f''| <= |f'| * Rs / (a*Vt) everywhere, so the error left after a step d is at most
+		Rs / (2 * a*Vt) * d^2 (quadratic convergence). Without Rs the equation is linear in I
+		and the first step is exact.
+	*/
+	inline double ConvergedStep(const PV::Simd::DiodeParameters& p, double tolerance)
+	{
+		if (!(p.Rs > 0)) return INFINITY;
+		return std::max(tolerance, sqrt(tolerance * p.a_vt / p.Rs));
+	}
+
+	/*
+		Newton-Raphson of one point from c, returns the current, its iterations and whether its
+		last step was within converged_step (also on the last allowed iteration)
+	*/
+	inline double SolvePointScalar(const PV::Simd::DiodeParameters& p, double v, double c, int max_iters, double converged_step,
+		int& iters, bool& converged)
+	{
+		iters = max_iters;
+		converged = false;
+
+		for (int j = 0; j < max_iters; j++)
+		{
+			double exp_value = exp((v + c * p.Rs) / p.a_vt);
+			double f = p.Ipv - p.I0 * (exp_value - 1) - (v + c * p.Rs) / p.Rsh - c;
+			double df = -p.I0 * p.Rs * exp_value / p.a_vt - p.Rs / p.Rsh - 1;
+
+			double delta = f / df;
+			c -= delta;
+
+			if (fabs(delta) < converged_step)
+			{
+				iters = j + 1;
+				converged = true;
+				break;
+			}
+		}
+
+		return c;
+	}
+
+	void AddPoint(PV::Simd::KernelReport& report, const PV::Simd::DiodeParameters& p, double v, double c, int iters, bool converged)
+	{
+		double residual = fabs(p.Ipv - p.I0 * (exp((v + c * p.Rs) / p.a_vt) - 1) - (v + c * p.Rs) / p.Rsh - c);
+
+		report.total_iterations += iters;
+		if (iters > report.max_iterations) report.max_iterations = iters;
+		if (!converged) report.unconverged_points++;
+		if (residual > report.max_residual) report.max_residual = residual;
+	}
+
+	PV::Simd::KernelReport SolveCurrentNewtonScalar(const PV::Simd::DiodeParameters& p, const double* voltage, double* current,
+		int count, double initial_guess, const double* guesses, int max_iters, double tolerance)
+	{
+		PV::Simd::KernelReport report = { 0, 0, 0, 0.0 };
+		double guess = initial_guess;
+		double converged_step = ConvergedStep(p, tolerance);
+
+		for (int i = 0; i < count; i++)
+		{
+			int iters;
+			bool converged;
+			double c = SolvePointScalar(p, voltage[i], (guesses != nullptr) ? guesses[i] : guess, max_iters, converged_step, iters, converged);
+			AddPoint(report, p, voltage[i], c, iters, converged);
+
+			current[i] = c;
+			guess = c;
+		}
+
+		return report;
+	}
+
+	PV::Simd::KernelReport SolveCurrentNewtonColumnsScalar(const PV::Simd::DiodeColumns& columns, const double* voltage, double* current,
+		int count, const double* guesses, int max_iters, double tolerance)
+	{
+		PV::Simd::KernelReport report = { 0, 0, 0, 0.0 };
+
+		for (int i = 0; i < count; i++)
+		{
+			PV::Simd::DiodeParameters p = { columns.Ipv[i], columns.I0[i], columns.Rs[i], columns.Rsh[i], columns.a_vt[i] };
+			double guess = (guesses != nullptr && guesses[i] < p.Ipv) ? guesses[i] : p.Ipv;
+
+			int iters;
+			bool converged;
+			double c = SolvePointScalar(p, voltage[i], guess, max_iters, ConvergedStep(p, tolerance), iters, converged);
+			AddPoint(report, p, voltage[i], c, iters, converged);
+
+			current[i] = c;
+		}
+
+		return report;
+	}
+
+	template <typename Scalar, bool Hermite>
+	inline Scalar LookupPoint(const PV::Simd::BasicLookupTable<Scalar>& table, Scalar voltage)
+	{
+		Scalar x = voltage * table.inv_dv;
+		Scalar x_max = (Scalar)(table.steps - 1);
+
+		// Written so that NaN lands on the first point
+		x = (x > 0) ? x : 0;
+		x = (x < x_max) ? x : x_max;
+
+		int idx = (int)x;
+		if (idx > table.steps - 2) idx = table.steps - 2;
+		Scalar t = x - idx;
+
+		Scalar c0 = table.current[idx];
+		Scalar c1 = table.current[idx + 1];
+
+		if (!Hermite) return c0 + t * (c1 - c0);
+
+		// Cubic Hermite between the two points
+		Scalar t2 = t * t;
+		Scalar t3 = t2 * t;
+		return (2 * t3 - 3 * t2 + 1) * c0 + (t3 - 2 * t2 + t) * table.slope[idx]
+			+ (3 * t2 - 2 * t3) * c1 + (t3 - t2) * table.slope[idx + 1];
+	}
+
+	template <typename Scalar, bool Hermite>
+	void LookupCurrentScalar(const PV::Simd::BasicLookupTable<Scalar>& table, const Scalar* voltage, Scalar* current, int first, int count)
+	{
+		for (int i = first; i < count; i++) current[i] = LookupPoint<Scalar, Hermite>(table, voltage[i]);
+	}
+
+#ifdef PV_SIMD_X86
+	/*
+		exp() of 4 doubles: x = n * ln2 + r with |r| <= ln2 / 2, exp(r) from its degree 13
+		Taylor polynomial (truncation error < 1e-17) and 2^n built directly in the exponent bits
+	*/
+	PV_TARGET_AVX2 inline __m256d Exp4(__m256d x)
+	{
+		const __m256d log2e = _mm256_set1_pd(1.4426950408889634);
+		const __m256d ln2_hi = _mm256_set1_pd(6.93147180369123816490e-01);
+		const __m256d ln2_lo = _mm256_set1_pd(1.90821492927058770002e-10);
+		const __m256d shifter = _mm256_set1_pd(6755399441055744.0); // 1.5 * 2^52
+
+		x = _mm256_max_pd(_mm256_min_pd(x, _mm256_set1_pd(EXP_MAX_ARG)), _mm256_set1_pd(EXP_MIN_ARG));
+
+		__m256d n = _mm256_round_pd(_mm256_mul_pd(x, log2e), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256d r = _mm256_fnmadd_pd(n, ln2_hi, x);
+		r = _mm256_fnmadd_pd(n, ln2_lo, r);
+
+		__m256d poly = _mm256_set1_pd(1.0 / 6227020800.0);
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 479001600.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 39916800.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 3628800.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 362880.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 40320.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 5040.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 720.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 120.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 24.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0 / 6.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(0.5));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0));
+		poly = _mm256_fmadd_pd(poly, r, _mm256_set1_pd(1.0));
+
+		// n is integral, adding 1.5 * 2^52 leaves it in the low mantissa bits
+		__m256i n_int = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, shifter)), _mm256_castpd_si256(shifter));
+		__m256i pow2n = _mm256_slli_epi64(_mm256_add_epi64(n_int, _mm256_set1_epi64x(1023)), 52);
+
+		return _mm256_mul_pd(poly, _mm256_castsi256_pd(pow2n));
+	}
+
+	PV_TARGET_AVX2 void ExpAVX2(const double* x, double* y, int count)
+	{
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm256_storeu_pd(y + i, Exp4(_mm256_loadu_pd(x + i)));
+		}
+
+		// Tail through a padded lane group so it uses the same approximation
+		if (i < count)
+		{
+			double in[4] = { 0, 0, 0, 0 };
+			double out[4];
+			for (int j = i; j < count; j++) in[j - i] = x[j];
+			_mm256_storeu_pd(out, Exp4(_mm256_loadu_pd(in)));
+			for (int j = i; j < count; j++) y[j] = out[j - i];
+		}
+	}
+
+	PV_TARGET_AVX2 void AccumulateScaledAVX2(double* sum, const double* values, double scale, int count)
+	{
+		__m256d s = _mm256_set1_pd(scale);
+
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm256_storeu_pd(sum + i, _mm256_fmadd_pd(s, _mm256_loadu_pd(values + i), _mm256_loadu_pd(sum + i)));
+		}
+
+		for (; i < count; i++) sum[i] += scale * values[i];
+	}
+
+	/*
+		Convergence of a lane group after a Newton step: lanes whose step is within step are
+		converged from now on (Newton keeps them there), the others count one more iteration.
+		Returns true once every lane is converged.
+	*/
+	PV_TARGET_AVX2 inline bool UpdateLanes(__m256d delta, __m256d step, __m256d abs_mask, __m256d& converged, __m256d& iters)
+	{
+		iters = _mm256_add_pd(iters, _mm256_andnot_pd(converged, _mm256_set1_pd(1.0)));
+
+		// NaN steps are never within the tolerance
+		converged = _mm256_or_pd(converged, _mm256_cmp_pd(_mm256_and_pd(delta, abs_mask), step, _CMP_LT_OQ));
+		return _mm256_movemask_pd(converged) == 0xF;
+	}
+
+	/*
+		Add the lanes (valid lanes of a padded group) of a solved group to the report
+	*/
+	PV_TARGET_AVX2 inline void AddLanes(PV::Simd::KernelReport& report, __m256d converged, __m256d iters, int lanes)
+	{
+		double lane_iters[4];
+		_mm256_storeu_pd(lane_iters, iters);
+		int mask = _mm256_movemask_pd(converged);
+
+		for (int l = 0; l < lanes; l++)
+		{
+			int point_iters = (int)lane_iters[l];
+			report.total_iterations += point_iters;
+			if (point_iters > report.max_iterations) report.max_iterations = point_iters;
+			if ((mask & (1 << l)) == 0) report.unconverged_points++;
+		}
+	}
+
+	PV_TARGET_AVX2 PV::Simd::KernelReport SolveCurrentNewtonAVX2(const PV::Simd::DiodeParameters& p, const double* voltage, double* current,
+		int count, double initial_guess, const double* guesses, int max_iters, double tolerance)
+	{
+		PV::Simd::KernelReport report = { 0, 0, 0, 0.0 };
+
+		const __m256d ipv = _mm256_set1_pd(p.Ipv);
+		const __m256d i0 = _mm256_set1_pd(p.I0);
+		const __m256d rs = _mm256_set1_pd(p.Rs);
+		const __m256d inv_avt = _mm256_set1_pd(1.0 / p.a_vt);
+		const __m256d inv_rsh = _mm256_set1_pd(1.0 / p.Rsh);
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256d df_const = _mm256_set1_pd(-p.Rs / p.Rsh - 1);
+		const __m256d df_exp = _mm256_set1_pd(-p.I0 * p.Rs / p.a_vt);
+		const __m256d tol = _mm256_set1_pd(ConvergedStep(p, tolerance));
+		const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+		__m256d max_residual = _mm256_setzero_pd();
+		double guess = initial_guess;
+
+		for (int i = 0; i < count; i += 4)
+		{
+			int lanes = (count - i < 4) ? count - i : 4;
+
+			// Pad the last group by repeating its last voltage (and guess)
+			double v_in[4];
+			double c_in[4];
+			for (int l = 0; l < 4; l++)
+			{
+				int point = i + ((l < lanes) ? l : lanes - 1);
+				v_in[l] = voltage[point];
+				c_in[l] = (guesses != nullptr) ? guesses[point] : guess;
+			}
+
+			__m256d v = _mm256_loadu_pd(v_in);
+
+			// Without per point guesses every lane starts from the highest voltage point of the
+			// previous group, which is above the solution of all of them so Newton never overshoots
+			__m256d c = _mm256_loadu_pd(c_in);
+			__m256d converged = _mm256_setzero_pd();
+			__m256d iters = _mm256_setzero_pd();
+
+			for (int j = 0; j < max_iters; j++)
+			{
+				__m256d vd = _mm256_fmadd_pd(c, rs, v);
+				__m256d e = Exp4(_mm256_mul_pd(vd, inv_avt));
+
+				// f = Ipv - I0 * (e - 1) - vd / Rsh - I
+				__m256d f = _mm256_fnmadd_pd(i0, _mm256_sub_pd(e, one), ipv);
+				f = _mm256_fnmadd_pd(vd, inv_rsh, f);
+				f = _mm256_sub_pd(f, c);
+
+				__m256d df = _mm256_fmadd_pd(df_exp, e, df_const);
+				__m256d delta = _mm256_div_pd(f, df);
+				c = _mm256_sub_pd(c, delta);
+
+				if (UpdateLanes(delta, tol, abs_mask, converged, iters)) break;
+			}
+
+			// Residual at the returned currents
+			__m256d vd = _mm256_fmadd_pd(c, rs, v);
+			__m256d e = Exp4(_mm256_mul_pd(vd, inv_avt));
+			__m256d f = _mm256_fnmadd_pd(i0, _mm256_sub_pd(e, one), ipv);
+			f = _mm256_sub_pd(_mm256_fnmadd_pd(vd, inv_rsh, f), c);
+			max_residual = _mm256_max_pd(max_residual, _mm256_and_pd(f, abs_mask));
+
+			double c_out[4];
+			_mm256_storeu_pd(c_out, c);
+			for (int l = 0; l < lanes; l++) current[i + l] = c_out[l];
+			guess = c_out[lanes - 1];
+
+			AddLanes(report, converged, iters, lanes);
+		}
+
+		double residuals[4];
+		_mm256_storeu_pd(residuals, max_residual);
+		for (int l = 0; l < 4; l++)
+		{
+			if (residuals[l] > report.max_residual) report.max_residual = residuals[l];
+		}
+
+		return report;
+	}
+
+	/*
+		4 values of a column from point i, the last group is padded by repeating its last point
+	*/
+	PV_TARGET_AVX2 inline __m256d LoadColumn(const double* column, int i, int lanes)
+	{
+		if (lanes == 4) return _mm256_loadu_pd(column + i);
+
+		double in[4];
+		for (int l = 0; l < 4; l++) in[l] = column[i + ((l < lanes) ? l : lanes - 1)];
+		return _mm256_loadu_pd(in);
+	}
+
+	PV_TARGET_AVX2 PV::Simd::KernelReport SolveCurrentNewtonColumnsAVX2(const PV::Simd::DiodeColumns& columns, const double* voltage, double* current,
+		int count, const double* guesses, int max_iters, double tolerance)
+	{
+		PV::Simd::KernelReport report = { 0, 0, 0, 0.0 };
+
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d tol = _mm256_set1_pd(tolerance);
+		const __m256d infinity = _mm256_set1_pd(INFINITY);
+		const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+		__m256d max_residual = _mm256_setzero_pd();
+
+		for (int i = 0; i < count; i += 4)
+		{
+			int lanes = (count - i < 4) ? count - i : 4;
+
+			__m256d ipv = LoadColumn(columns.Ipv, i, lanes);
+			__m256d i0 = LoadColumn(columns.I0, i, lanes);
+			__m256d rs = LoadColumn(columns.Rs, i, lanes);
+			__m256d a_vt = LoadColumn(columns.a_vt, i, lanes);
+			__m256d inv_avt = _mm256_div_pd(one, a_vt);
+			__m256d inv_rsh = _mm256_div_pd(one, LoadColumn(columns.Rsh, i, lanes));
+			__m256d df_const = _mm256_fnmsub_pd(rs, inv_rsh, one);
+			__m256d df_exp = _mm256_sub_pd(zero, _mm256_mul_pd(_mm256_mul_pd(i0, rs), inv_avt));
+
+			// ConvergedStep of every lane, infinite without Rs
+			__m256d step = _mm256_max_pd(tol, _mm256_sqrt_pd(_mm256_div_pd(_mm256_mul_pd(tol, a_vt), rs)));
+			step = _mm256_blendv_pd(infinity, step, _mm256_cmp_pd(rs, zero, _CMP_GT_OQ));
+
+			__m256d v = LoadColumn(voltage, i, lanes);
+			// min returns its second operand (Ipv) for a NaN guess
+			__m256d c = (guesses != nullptr) ? _mm256_min_pd(LoadColumn(guesses, i, lanes), ipv) : ipv;
+			__m256d converged = _mm256_setzero_pd();
+			__m256d iters = _mm256_setzero_pd();
+
+			for (int j = 0; j < max_iters; j++)
+			{
+				__m256d vd = _mm256_fmadd_pd(c, rs, v);
+				__m256d e = Exp4(_mm256_mul_pd(vd, inv_avt));
+
+				// f = Ipv - I0 * (e - 1) - vd / Rsh - I
+				__m256d f = _mm256_fnmadd_pd(i0, _mm256_sub_pd(e, one), ipv);
+				f = _mm256_fnmadd_pd(vd, inv_rsh, f);
+				f = _mm256_sub_pd(f, c);
+
+				__m256d df = _mm256_fmadd_pd(df_exp, e, df_const);
+				__m256d delta = _mm256_div_pd(f, df);
+				c = _mm256_sub_pd(c, delta);
+
+				if (UpdateLanes(delta, step, abs_mask, converged, iters)) break;
+			}
+
+			// Residual at the returned currents
+			__m256d vd = _mm256_fmadd_pd(c, rs, v);
+			__m256d e = Exp4(_mm256_mul_pd(vd, inv_avt));
+			__m256d f = _mm256_fnmadd_pd(i0, _mm256_sub_pd(e, one), ipv);
+			f = _mm256_sub_pd(_mm256_fnmadd_pd(vd, inv_rsh, f), c);
+			max_residual = _mm256_max_pd(max_residual, _mm256_and_pd(f, abs_mask));
+
+			if (lanes == 4)
+			{
+				_mm256_storeu_pd(current + i, c);
+			}
+			else
+			{
+				double c_out[4];
+				_mm256_storeu_pd(c_out, c);
+				for (int l = 0; l < lanes; l++) current[i + l] = c_out[l];
+			}
+
+			AddLanes(report, converged, iters, lanes);
+		}
+
+		double residuals[4];
+		_mm256_storeu_pd(residuals, max_residual);
+		for (int l = 0; l < 4; l++)
+		{
+			if (residuals[l] > report.max_residual) report.max_residual = residuals[l];
+		}
+
+		return report;
+	}
+
+	template <bool Hermite>
+	PV_TARGET_AVX2 void LookupCurrentAVX2(const PV::Simd::BasicLookupTable<double>& table, const double* voltage, double* current, int count)
+	{
+		const __m256d inv_dv = _mm256_set1_pd(table.inv_dv);
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d x_max = _mm256_set1_pd((double)(table.steps - 1));
+		const __m128i idx_max = _mm_set1_epi32(table.steps - 2);
+		const __m256d two = _mm256_set1_pd(2.0);
+		const __m256d three = _mm256_set1_pd(3.0);
+		const __m256d one = _mm256_set1_pd(1.0);
+
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			// max/min return the second operand on NaN, so NaN lands on the first point
+			__m256d x = _mm256_mul_pd(_mm256_loadu_pd(voltage + i), inv_dv);
+			x = _mm256_max_pd(x, zero);
+			x = _mm256_min_pd(x, x_max);
+
+			__m128i idx = _mm_min_epi32(_mm256_cvttpd_epi32(x), idx_max);
+			__m256d t = _mm256_sub_pd(x, _mm256_cvtepi32_pd(idx));
+
+			__m256d c0 = _mm256_i32gather_pd(table.current, idx, 8);
+			__m256d c1 = _mm256_i32gather_pd(table.current + 1, idx, 8);
+
+			__m256d c;
+			if (!Hermite)
+			{
+				c = _mm256_fmadd_pd(t, _mm256_sub_pd(c1, c0), c0);
+			}
+			else
+			{
+				__m256d m0 = _mm256_i32gather_pd(table.slope, idx, 8);
+				__m256d m1 = _mm256_i32gather_pd(table.slope + 1, idx, 8);
+
+				__m256d t2 = _mm256_mul_pd(t, t);
+				__m256d t3 = _mm256_mul_pd(t2, t);
+
+				// h00 = 2t^3 - 3t^2 + 1, h10 = t^3 - 2t^2 + t, h01 = 1 - h00, h11 = t^3 - t^2
+				__m256d h00 = _mm256_add_pd(_mm256_fmsub_pd(two, t3, _mm256_mul_pd(three, t2)), one);
+				__m256d h11 = _mm256_sub_pd(t3, t2);
+				__m256d h10 = _mm256_add_pd(_mm256_sub_pd(h11, t2), t);
+
+				c = _mm256_add_pd(c1, _mm256_mul_pd(h00, _mm256_sub_pd(c0, c1)));
+				c = _mm256_fmadd_pd(h10, m0, c);
+				c = _mm256_fmadd_pd(h11, m1, c);
+			}
+
+			_mm256_storeu_pd(current + i, c);
+		}
+
+		LookupCurrentScalar<double, Hermite>(table, voltage, current, i, count);
+	}
+
+	/*
+		Same as the double kernel with 8 floats per register. The grid position is a float as well,
+		it stays within 1e-3 of a step up to 10^4 points.
+	*/
+	template <bool Hermite>
+	PV_TARGET_AVX2 void LookupCurrentAVX2(const PV::Simd::BasicLookupTable<float>& table, const float* voltage, float* current, int count)
+	{
+		const __m256 inv_dv = _mm256_set1_ps(table.inv_dv);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 x_max = _mm256_set1_ps((float)(table.steps - 1));
+		const __m256i idx_max = _mm256_set1_epi32(table.steps - 2);
+		const __m256 two = _mm256_set1_ps(2.0f);
+		const __m256 three = _mm256_set1_ps(3.0f);
+		const __m256 one = _mm256_set1_ps(1.0f);
+
+		int i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 x = _mm256_mul_ps(_mm256_loadu_ps(voltage + i), inv_dv);
+			x = _mm256_max_ps(x, zero);
+			x = _mm256_min_ps(x, x_max);
+
+			__m256i idx = _mm256_min_epi32(_mm256_cvttps_epi32(x), idx_max);
+			__m256 t = _mm256_sub_ps(x, _mm256_cvtepi32_ps(idx));
+
+			__m256 c0 = _mm256_i32gather_ps(table.current, idx, 4);
+			__m256 c1 = _mm256_i32gather_ps(table.current + 1, idx, 4);
+
+			__m256 c;
+			if (!Hermite)
+			{
+				c = _mm256_fmadd_ps(t, _mm256_sub_ps(c1, c0), c0);
+			}
+			else
+			{
+				__m256 m0 = _mm256_i32gather_ps(table.slope, idx, 4);
+				__m256 m1 = _mm256_i32gather_ps(table.slope + 1, idx, 4);
+
+				__m256 t2 = _mm256_mul_ps(t, t);
+				__m256 t3 = _mm256_mul_ps(t2, t);
+
+				__m256 h00 = _mm256_add_ps(_mm256_fmsub_ps(two, t3, _mm256_mul_ps(three, t2)), one);
+				__m256 h11 = _mm256_sub_ps(t3, t2);
+				__m256 h10 = _mm256_add_ps(_mm256_sub_ps(h11, t2), t);
+
+				c = _mm256_add_ps(c1, _mm256_mul_ps(h00, _mm256_sub_ps(c0, c1)));
+				c = _mm256_fmadd_ps(h10, m0, c);
+				c = _mm256_fmadd_ps(h11, m1, c);
+			}
+
+			_mm256_storeu_ps(current + i, c);
+		}
+
+		LookupCurrentScalar<float, Hermite>(table, voltage, current, i, count);
+	}
+#endif
+}
+
+PV::Simd::Isa PV::Simd::DetectIsa()
+{
+	static const Isa isa = QueryIsa();
+	return isa;
+}
+
+const char* PV::Simd::IsaName(Isa isa)
+{
+	switch (isa)
+	{
+	case Isa::AVX2:
+		return "AVX2";
+	default:
+		return "Scalar";
+	}
+}
+
+PV::Simd::KernelReport PV::Simd::SolveCurrentNewton(const DiodeParameters& params, const double* voltage, double* current,
+	int count, double initial_guess, const double* guesses, int max_iters, double tolerance, Isa isa)
+{
+	if (count <= 0) return { 0, 0, 0, 0.0 };
+
+#ifdef PV_SIMD_X86
+	if (isa == Isa::AVX2 && DetectIsa() == Isa::AVX2)
+	{
+		return SolveCurrentNewtonAVX2(params, voltage, current, count, initial_guess, guesses, max_iters, tolerance);
+	}
+#endif
+
+	return SolveCurrentNewtonScalar(params, voltage, current, count, initial_guess, guesses, max_iters, tolerance);
+}
+
+PV::Simd::KernelReport PV::Simd::SolveCurrentNewtonColumns(const DiodeColumns& params, const double* voltage, double* current,
+	int count, const double* guesses, int max_iters, double tolerance, Isa isa)
+{
+	if (count <= 0) return { 0, 0, 0, 0.0 };
+
+#ifdef PV_SIMD_X86
+	if (isa == Isa::AVX2 && DetectIsa() == Isa::AVX2)
+	{
+		return SolveCurrentNewtonColumnsAVX2(params, voltage, current, count, guesses, max_iters, tolerance);
+	}
+#endif
+
+	return SolveCurrentNewtonColumnsScalar(params, voltage, current, count, guesses, max_iters, tolerance);
+}
+
+template <typename Scalar>
+void PV::Simd::LookupCurrent(const BasicLookupTable<Scalar>& table, const Scalar* voltage, Scalar* current, int count, Isa isa)
+{
+	// The interpolation is chosen once per call, the loops are compiled for each
+	bool hermite = table.slope != nullptr;
+
+#ifdef PV_SIMD_X86
+	if (isa == Isa::AVX2 && DetectIsa() == Isa::AVX2)
+	{
+		if (hermite) LookupCurrentAVX2<true>(table, voltage, current, count);
+		else LookupCurrentAVX2<false>(table, voltage, current, count);
+		return;
+	}
+#endif
+
+	if (hermite) LookupCurrentScalar<Scalar, true>(table, voltage, current, 0, count);
+	else LookupCurrentScalar<Scalar, false>(table, voltage, current, 0, count);
+}
+
+template void PV::Simd::LookupCurrent<float>(const BasicLookupTable<float>&, const float*, float*, int, Isa);
+template void PV::Simd::LookupCurrent<double>(const BasicLookupTable<double>&, const double*, double*, int, Isa);
+
+void PV::Simd::PchipSlopes(const double* current, double* slope, int steps)
+{
+	if (steps < 2) return;
+
+	if (steps == 2)
+	{
+		slope[0] = slope[1] = current[1] - current[0];
+		return;
+	}
+
+	// Interior points, harmonic mean of the neighbouring secants (zero at local extrema)
+	for (int i = 1; i < steps - 1; i++)
+	{
+		double d0 = current[i] - current[i - 1];
+		double d1 = current[i + 1] - current[i];
+		slope[i] = (d0 * d1 > 0) ? 2 * d0 * d1 / (d0 + d1) : 0;
+	}
+
+	// End points, one sided three point estimate kept shape preserving
+	double d_first[2] = { current[1] - current[0], current[2] - current[1] };
+	double d_last[2] = { current[steps - 1] - current[steps - 2], current[steps - 2] - current[steps - 3] };
+	double* ends[2] = { &slope[0], &slope[steps - 1] };
+	double* d[2] = { d_first, d_last };
+
+	for (int e = 0; e < 2; e++)
+	{
+		double m = (3 * d[e][0] - d[e][1]) / 2;
+		if (m * d[e][0] <= 0) m = 0;
+		else if (d[e][0] * d[e][1] <= 0 && fabs(m) > fabs(3 * d[e][0])) m = 3 * d[e][0];
+		*ends[e] = m;
+	}
+}
+
+void PV::Simd::Exp(const double* x, double* y, int count, Isa isa)
+{
+#ifdef PV_SIMD_X86
+	if (isa == Isa::AVX2 && DetectIsa() == Isa::AVX2)
+	{
+		ExpAVX2(x, y, count);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < count; i++) y[i] = exp(x[i]);
+}
+
+void PV::Simd::AccumulateScaled(double* sum, const double* values, double scale, int count, Isa isa)
+{
+#ifdef PV_SIMD_X86
+	if (isa == Isa::AVX2 && DetectIsa() == Isa::AVX2)
+	{
+		AccumulateScaledAVX2(sum, values, scale, count);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < count; i++) sum[i] += scale * values[i];
+}
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+#include "../include/pv_snapshot.h"
+#include "../include/pv.h"
+#include "../../profiler/include/profiler.h"
+
+double PV::CurveSnapshot::GetCurrentFromVoltage(double voltage) const
+{
+	double current;
+	this->GetCurrentFromVoltage(&voltage, &current, 1);
+	return current;
+}
+
+void PV::CurveSnapshot::GetCurrentFromVoltage(const double* voltages, double* currents, int count) const
+{
+	PVWATCH_PROFILE_SCOPE("pv.lookup");
+
+	if (this->grid_index == nullptr) LookupCurrent(this->voltage, this->current, this->slope, this->steps, this->Voc, this->Isc, voltages, currents, count);
+	else LookupCurrentNonUniform(this->voltage, this->current, this->slope, this->steps, this->grid_index, this->grid_buckets, this->Isc, voltages, currents, count);
+}
+
+PV::CurvePublisher::Handle& PV::CurvePublisher::Handle::operator=(Handle&& other) noexcept
+{
+	if (this == &other) return *this;
+
+	this->Release();
+	this->slot = other.slot;
+	other.slot = nullptr;
+
+	return *this;
+}
+
+void PV::CurvePublisher::Handle::Release()
+{
+	if (this->slot != nullptr) this->slot->readers.fetch_sub(1);
+	this->slot = nullptr;
+}
+
+PV::CurvePublisher::CurvePublisher()
+{
+	for (int i = 0; i < SNAPSHOT_SLOTS; i++)
+	{
+		this->slots[i].readers.store(0);
+		this->slots[i].snapshot = {};
+	}
+
+	this->published.store(-1);
+	this->version.store(0);
+}
+
+void PV::CurvePublisher::Publish(const double* voltage, const double* current, const double* power, const double* slope,
+	int steps, double g, double t, double v_oc, double i_sc, const int* grid_index, int grid_buckets)
+{
+	std::lock_guard<std::mutex> lock(this->write_mtx);
+
+	// Find a back slot, not published and not pinned by any reader
+	int current_idx = this->published.load();
+	int back_idx = -1;
+	while (back_idx < 0)
+	{
+		for (int i = 0; i < SNAPSHOT_SLOTS; i++)
+		{
+			if (i != current_idx && this->slots[i].readers.load() == 0)
+			{
+				back_idx = i;
+				break;
+			}
+		}
+
+		// Only possible with more than SNAPSHOT_SLOTS - 2 readers holding snapshots
+		if (back_idx < 0) std::this_thread::yield();
+	}
+
+	Slot& slot = this->slots[back_idx];
+	int count = steps > 0 ? steps : 0;
+
+	slot.buffer.Reserve(count);
+	if (count > 0)
+	{
+		memcpy(slot.buffer.Voltage(), voltage, count * sizeof(double));
+		memcpy(slot.buffer.Current(), current, count * sizeof(double));
+		memcpy(slot.buffer.Power(), power, count * sizeof(double));
+		if (slope != nullptr) memcpy(slot.buffer.Slope(), slope, count * sizeof(double));
+	}
+
+	slot.snapshot.version = this->version.load() + 1;
+	slot.snapshot.steps = count;
+	slot.snapshot.G = g;
+	slot.snapshot.T = t;
+	slot.snapshot.Voc = v_oc;
+	slot.snapshot.Isc = i_sc;
+	slot.snapshot.voltage = slot.buffer.Voltage();
+	slot.snapshot.current = slot.buffer.Current();
+	slot.snapshot.power = slot.buffer.Power();
+	slot.snapshot.slope = (slope != nullptr) ? slot.buffer.Slope() : nullptr;
+
+	// The index storage only grows, like the curve buffer, and holds the index of any curve
+	// that fits the buffer (2 buckets per point) so adaptive grids of varying size don't grow it
+	if (grid_index != nullptr)
+	{
+		slot.grid_index.reserve(std::max(grid_buckets, 2 * slot.buffer.Capacity()));
+		slot.grid_index.assign(grid_index, grid_index + grid_buckets);
+	}
+	slot.snapshot.grid_index = (grid_index != nullptr) ? slot.grid_index.data() : nullptr;
+	slot.snapshot.grid_buckets = (grid_index != nullptr) ? grid_buckets : 0;
+
+	// Swap the back slot in, readers see a fully written snapshot from here on
+	this->published.store(back_idx);
+	this->version.store(slot.snapshot.version);
+}
+
+PV::CurvePublisher::Handle PV::CurvePublisher::Acquire() const
+{
+	Handle handle;
+
+	while (true)
+	{
+		int idx = this->published.load();
+		if (idx < 0) return handle;
+
+		Slot& slot = this->slots[idx];
+		slot.readers.fetch_add(1);
+
+		// The slot may have been retired between the load and the pin, then try the new one
+		if (this->published.load() == idx)
+		{
+			handle.slot = &slot;
+			return handle;
+		}
+
+		slot.readers.fetch_sub(1);
+	}
+}
+
+uint64_t PV::CurvePublisher::Version() const
+{
+	return this->version.load();
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+/*
+	Lock-free single producer / single consumer ring buffer.
+	The producer never blocks, when the ring is full new items are dropped and counted.
+	Head and tail live on their own cache lines, and each side keeps a cached copy of
+	the other side's index so the shared lines are only touched when really needed.
+*/
+template <typename T>
+class SpscRing
+{
+public:
+	/*
+		Capacity is rounded up to a power of two
+	*/
+	explicit SpscRing(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity) size <<= 1;
+
+		this->mask = size - 1;
+		this->items.reset(new T[size]);
+
+		this->head.store(0);
+		this->tail.store(0);
+		this->dropped.store(0);
+		this->cached_head = 0;
+		this->cached_tail = 0;
+	}
+
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	/*
+		Producer side, returns false (and counts a drop) when the ring is full
+	*/
+	bool TryPush(const T& item)
+	{
+		size_t h = this->head.load(std::memory_order_relaxed);
+
+		if (h - this->cached_tail > this->mask)
+		{
+			this->cached_tail = this->tail.load(std::memory_order_acquire);
+			if (h - this->cached_tail > this->mask)
+			{
+				this->dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		this->items[h & this->mask] = item;
+		this->head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*
+		Producer side, push as many items as fit, the rest count as dropped. Returns the number pushed.
+	*/
+	size_t PushBatch(const T* batch, size_t count)
+	{
+		size_t n = this->TryPushBatch(batch, count);
+		if (n < count) this->dropped.fetch_add(count - n, std::memory_order_relaxed);
+		return n;
+	}
+
+	/*
+		Producer side, push as many items as fit without counting the rest as dropped, for
+		producers that retry them later. Returns the number pushed.
+	*/
+	size_t TryPushBatch(const T* batch, size_t count)
+	{
+		size_t h = this->head.load(std::memory_order_relaxed);
+		size_t free_slots = this->mask + 1 - (h - this->cached_tail);
+
+		if (free_slots < count)
+		{
+			this->cached_tail = this->tail.load(std::memory_order_acquire);
+			free_slots = this->mask + 1 - (h - this->cached_tail);
+		}
+
+		size_t n = (count < free_slots) ? count : free_slots;
+		for (size_t i = 0; i < n; i++) this->items[(h + i) & this->mask] = batch[i];
+
+		this->head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	/*
+		Consumer side, returns false when the ring is empty
+	*/
+	bool TryPop(T& item)
+	{
+		return this->PopBatch(&item, 1) == 1;
+	}
+
+	/*
+		Consumer side, move up to max_count items (oldest first) into out. Returns the number moved.
+	*/
+	size_t PopBatch(T* out, size_t max_count)
+	{
+		size_t t = this->tail.load(std::memory_order_relaxed);
+
+		if (this->cached_head - t < max_count)
+		{
+			this->cached_head = this->head.load(std::memory_order_acquire);
+		}
+
+		size_t available = this->cached_head - t;
+		size_t n = (max_count < available) ? max_count : available;
+		for (size_t i = 0; i < n; i++) out[i] = this->items[(t + i) & this->mask];
+
+		this->tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+	size_t Size() const
+	{
+		return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+	}
+
+	size_t Capacity() const
+	{
+		return this->mask + 1;
+	}
+
+	/*
+		Items dropped by the producer because the ring was full
+	*/
+	size_t Dropped() const
+	{
+		return this->dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	// Producer owned line
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+	size_t cached_tail;
+	std::atomic<size_t> dropped;
+
+	// Consumer owned line
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+	size_t cached_head;
+
+	// Read only after construction
+	alignas(CACHE_LINE_SIZE) size_t mask;
+	std::unique_ptr<T[]> items;
+};
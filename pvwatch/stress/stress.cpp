@@ -0,0 +1,151 @@
+/*
+	Headless stress test of the curve snapshots, without the App window or any GUI library.
+	Meant to run under ThreadSanitizer (-fsanitize=thread).
+
+	Usage: stress [--seconds s]
+
+	One writer recalculates the curves of a module at full speed, changing the condition, the
+	point count and the grid, and plays back Precomputed sweeps of a simulator. Two readers pin
+	the published snapshots of both modules meanwhile and check every one of them: the power
+	must be exactly V * I at every point, the voltages increasing and the versions never going
+	back. Returns 0 when no reader saw a torn curve.
+*/
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "../pv/include/pv.h"
+
+namespace
+{
+	struct StressOptions
+	{
+		double seconds = 5;
+	};
+
+	/*
+		Counters of a reader thread
+	*/
+	struct ReaderStats
+	{
+		long long snapshots = 0;
+		long long points = 0;
+		long long torn = 0;
+	};
+
+	bool ParseArguments(int argc, char** argv, StressOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) options.seconds = atof(argv[++i]);
+			else
+			{
+				fprintf(stderr, "Usage: %s [--seconds s]\n", argv[0]);
+				return false;
+			}
+		}
+
+		return options.seconds > 0;
+	}
+
+	/*
+		Check a pinned snapshot, returns false when it is torn
+	*/
+	bool CheckSnapshot(const PV::CurveSnapshot& curve, uint64_t& last_version, ReaderStats& stats)
+	{
+		bool ok = (curve.version >= last_version) && curve.steps >= 0;
+		last_version = curve.version;
+
+		for (int i = 0; i < curve.steps && ok; i++)
+		{
+			// The writer computes the power from the published V and I, a copy must match bit for bit
+			ok = (curve.power[i] == curve.voltage[i] * curve.current[i]);
+			if (i > 0) ok = ok && curve.voltage[i] > curve.voltage[i - 1];
+		}
+
+		// Lookups read the same arrays and the grid index
+		if (ok && curve.steps > 1)
+		{
+			double current = curve.GetCurrentFromVoltage(0.5 * curve.Voc);
+			ok = current >= 0 && current <= curve.current[0];
+		}
+
+		stats.snapshots++;
+		stats.points += curve.steps;
+		return ok;
+	}
+
+	void Reader(const PV::PVModule& module, const PV::PVModule& swept, const std::atomic<bool>& stop, ReaderStats& stats)
+	{
+		uint64_t module_version = 0;
+		uint64_t swept_version = 0;
+
+		while (!stop)
+		{
+			{
+				PV::CurvePublisher::Handle curve = module.AcquireSnapshot();
+				if (curve && !CheckSnapshot(*curve, module_version, stats)) stats.torn++;
+			}
+			{
+				PV::CurvePublisher::Handle curve = swept.AcquireSnapshot();
+				if (curve && !CheckSnapshot(*curve, swept_version, stats)) stats.torn++;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	StressOptions options;
+	if (!ParseArguments(argc, argv, options)) return 1;
+
+	PV::ModelParameters params = PV::ExtractModelParameters(35.0f, 9.0f, 30.0f, 8.5f, PV::ITERS_nominal);
+
+	PV::PVModule module;
+	module.interpolation_mode = PV::InterpolationMode::Pchip;
+	module.CalculateIVPArrays(params, PV::G_nominal, PV::T_nominal, PV::STEPS_nominal, PV::ITERS_nominal);
+
+	PV::Simulator simulator(module);
+	simulator.mode = PV::SimulationMode::Precomputed;
+	simulator.threads = 2;
+
+	std::atomic<bool> stop(false);
+	ReaderStats stats[2];
+	std::thread readers[2];
+	for (int r = 0; r < 2; r++) readers[r] = std::thread(Reader, std::cref(module), std::cref(simulator.Module()), std::cref(stop), std::ref(stats[r]));
+
+	// Writer, on this thread
+	long long curves = 0;
+	long long sweeps = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < options.seconds)
+	{
+		for (int i = 0; i < 100; i++, curves++)
+		{
+			// Growing and shrinking curves on both grids, the slots resize under the readers
+			module.grid_mode = ((curves / 50) % 2 == 0) ? PV::GridMode::Uniform : PV::GridMode::Adaptive;
+			int steps = ((curves / 25) % 2 == 0) ? 100 : 400;
+			module.CalculateIVPArrays(params, 100.0f + (float)(curves % 900), 10.0f + (float)(curves % 50), steps, PV::ITERS_nominal);
+		}
+
+		simulator.Simulation(100.0f, 1000.0f, 10.0f, 60.0f, 0.0f, 100);
+		sweeps++;
+	}
+
+	stop = true;
+	for (std::thread& reader : readers) reader.join();
+
+	long long torn = 0;
+	for (int r = 0; r < 2; r++)
+	{
+		printf("reader %d: %lld snapshots, %lld points, %lld torn\n", r, stats[r].snapshots, stats[r].points, stats[r].torn);
+		torn += stats[r].torn;
+	}
+	printf("writer: %lld curves, %lld precomputed sweeps\n", curves, sweeps);
+
+	return (torn == 0) ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "../../pv/include/pv.h"
+
+/*
+	Binary weather file: a 16 byte header (magic, u32 version, u32 record size) followed by
+	WeatherRecord structs. Text files are CSV (or ; / tab / space separated) lines of
+	timestamp,G,T where the timestamp is in seconds or "YYYY-MM-DD HH:MM[:SS]" (also with a T).
+	Lines that don't start with a number are skipped (headers, # comments).
+*/
+#define WEATHER_MAGIC "PVWTHR01"
+#define WEATHER_VERSION 1
+
+// Records evaluated per chunk, the memory of a yield run doesn't grow beyond two chunks
+#define YIELD_CHUNK_RECORDS (1 << 15)
+
+namespace PV
+{
+	/*
+		One row of an irradiance / temperature time series
+	*/
+	struct WeatherRecord
+	{
+		double timestamp;	// Seconds
+		double G;			// Plane of array irradiance (W/m2)
+		double T;			// Cell or ambient temperature (C), see YieldOptions
+	};
+
+	/*
+		Streaming reader of weather files, reads through a fixed size buffer
+	*/
+	class WeatherReader
+	{
+	public:
+		WeatherReader();
+		~WeatherReader();
+
+		WeatherReader(const WeatherReader&) = delete;
+		WeatherReader& operator=(const WeatherReader&) = delete;
+
+		/*
+			Open a binary or text weather file, the format is detected from the header
+		*/
+		bool Open(const std::string& path);
+		void Close(void);
+
+		/*
+			Read up to max_count records. Returns the number read, 0 at the end of the file.
+		*/
+		size_t Read(WeatherRecord* out, size_t max_count);
+
+		bool IsBinary(void) const { return this->binary; }
+
+		/*
+			Fraction of the file read so far
+		*/
+		double Progress(void) const;
+
+		const std::string& Error(void) const { return this->error; }
+
+		uint64_t SkippedLines(void) const { return this->skipped_lines; }
+
+	private:
+		FILE* file;
+		bool binary;
+		uint64_t file_size;
+		uint64_t file_position;
+		uint64_t skipped_lines;
+		std::string error;
+
+		// Text buffer and the unparsed part of it
+		std::vector<char> buffer;
+		size_t begin;
+		size_t end;
+		bool eof;
+
+		bool Fill(void);
+		bool ParseLine(const char* line, const char* line_end, WeatherRecord& record);
+	};
+
+	/*
+		Writer of binary weather files, faster to read than text and without parsing
+	*/
+	class WeatherWriter
+	{
+	public:
+		WeatherWriter();
+		~WeatherWriter();
+
+		WeatherWriter(const WeatherWriter&) = delete;
+		WeatherWriter& operator=(const WeatherWriter&) = delete;
+
+		bool Open(const std::string& path);
+		bool Write(const WeatherRecord* records, size_t count);
+		void Close(void);
+
+	private:
+		FILE* file;
+	};
+
+	enum class TemperatureInput
+	{
+		Cell,		// T is the cell temperature
+		Ambient		// T is the ambient temperature, the cell temperature follows from the NOCT
+	};
+
+	struct YieldBin;
+
+	struct YieldOptions
+	{
+		int threads = 0;				// 0 uses every core
+		double tolerance = 1e-6;		// Voltage tolerance of the maximum power point (V)
+		TemperatureInput temperature = TemperatureInput::Cell;
+		double noct = 45;				// Nominal operating cell temperature (C)
+		double max_gap = 3600;			// Intervals longer than this (s) are data gaps, not integrated
+		double period = 86400;			// Aggregation period of the yield bins (s)
+
+		// Receives every bin once it is closed, in time order, instead of YieldResult::bins. The
+		// memory of a run then doesn't depend on the period or the length of the file.
+		std::function<void(const YieldBin& bin)> bin_sink;
+	};
+
+	/*
+		Energy of one aggregation period, starting at start (s)
+	*/
+	struct YieldBin
+	{
+		double start;
+		double energy;		// Wh
+		double insolation;	// Wh/m2
+	};
+
+	struct YieldResult
+	{
+		uint64_t records;
+		uint64_t gaps;				// Intervals skipped as data gaps (or out of order, before the current bin)
+		double duration;			// Integrated time (s)
+		double energy;				// Wh
+		double insolation;			// Wh/m2
+		double peak_power;			// W
+		double nominal_power;		// Pmax at the nominal conditions (W)
+		double performance_ratio;	// energy / (insolation / G_nominal * nominal_power)
+		double elapsed;				// Wall time of the run (s)
+
+		std::vector<YieldBin> bins;	// In time order, empty with a bin_sink
+	};
+
+	/*
+		Run a module over a weather file: the maximum power point of every record, solved in
+		chunks on a pool of threads while the next chunk is read, integrated (trapezoidal)
+		into energy.
+		cancel and progress may be nullptr. error is set when the file can't be read.
+	*/
+	YieldResult RunYield(const ModelParameters& params, const std::string& weather_path, const YieldOptions& options,
+		std::string* error = nullptr, std::atomic<bool>* cancel = nullptr, std::atomic<float>* progress = nullptr);
+
+	/*
+		Shared state of a yield run on its own thread, owned by the UI
+	*/
+	struct YieldStatus
+	{
+		std::atomic<bool> cancel{ false };
+		std::atomic<bool> running{ false };
+		std::atomic<float> progress{ 0 };
+
+		std::mutex result_mtx;
+		YieldResult result = {};
+		std::string error;
+	};
+
+	/*
+		RunYield for a thread, the result (or error) is stored in status
+	*/
+	void RunYieldJob(ModelParameters params, std::string weather_path, YieldOptions options, YieldStatus* status);
+}
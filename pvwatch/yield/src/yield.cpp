@@ -0,0 +1,533 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <math.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "../include/yield.h"
+
+// Size of the text read buffer
+#define WEATHER_BUFFER_SIZE (1 << 20)
+
+// Records a worker takes from a chunk at a time
+#define YIELD_BLOCK_RECORDS 256
+
+namespace
+{
+	struct WeatherFileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+	};
+
+	inline bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	inline bool IsSeparator(char c)
+	{
+		return c == ',' || c == ';' || c == '\t' || c == ' ';
+	}
+
+	// Days since 1970-01-01 of a civil date
+	int64_t DaysFromCivil(int64_t y, int64_t m, int64_t d)
+	{
+		y -= (m <= 2);
+		int64_t era = (y >= 0 ? y : y - 399) / 400;
+		int64_t yoe = y - era * 400;
+		int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+		int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + doe - 719468;
+	}
+
+	// Parse n digits, false if any isn't a digit
+	bool ParseDigits(const char* p, int n, int& value)
+	{
+		value = 0;
+		for (int i = 0; i < n; i++)
+		{
+			if (!IsDigit(p[i])) return false;
+			value = value * 10 + (p[i] - '0');
+		}
+		return true;
+	}
+
+	/*
+		"YYYY-MM-DD[T ]HH:MM[:SS[.fff]][Z]" to seconds since 1970, p is advanced past it
+	*/
+	bool ParseIsoTimestamp(const char*& p, const char* end, double& seconds)
+	{
+		int year, month, day, hour, minute;
+		if (end - p < 16 || p[4] != '-' || p[7] != '-' || (p[10] != 'T' && p[10] != ' ') || p[13] != ':') return false;
+		if (!ParseDigits(p, 4, year) || !ParseDigits(p + 5, 2, month) || !ParseDigits(p + 8, 2, day)) return false;
+		if (!ParseDigits(p + 11, 2, hour) || !ParseDigits(p + 14, 2, minute)) return false;
+
+		seconds = (double)DaysFromCivil(year, month, day) * 86400.0 + hour * 3600.0 + minute * 60.0;
+		p += 16;
+
+		if (p < end && *p == ':')
+		{
+			char* next;
+			seconds += strtod(p + 1, &next);
+			p = next;
+		}
+		if (p < end && *p == 'Z') p++;
+
+		return true;
+	}
+
+	/*
+		Size of an open file, 64 bit also where long is 32 bit (a site-year of text can pass 2 GB)
+	*/
+	uint64_t FileSize(FILE* file)
+	{
+#ifdef _WIN32
+		_fseeki64(file, 0, SEEK_END);
+		int64_t size = _ftelli64(file);
+		_fseeki64(file, 0, SEEK_SET);
+#else
+		fseeko(file, 0, SEEK_END);
+		int64_t size = (int64_t)ftello(file);
+		fseeko(file, 0, SEEK_SET);
+#endif
+		return (size > 0) ? (uint64_t)size : 0;
+	}
+
+	/*
+		Pool of threads that evaluate a chunk of records in blocks
+	*/
+	class ChunkWorkers
+	{
+	public:
+		typedef std::function<void(int worker, size_t begin, size_t end)> Work;
+
+		ChunkWorkers(int count, Work work) : work(work)
+		{
+			for (int i = 0; i < count; i++) this->threads.emplace_back(&ChunkWorkers::Loop, this, i);
+		}
+
+		~ChunkWorkers()
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mtx);
+				this->quit = true;
+			}
+			this->start_cv.notify_all();
+			for (std::thread& thread : this->threads) thread.join();
+		}
+
+		/*
+			Start the evaluation of count records, returns at once
+		*/
+		void Run(size_t count)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mtx);
+				this->count = count;
+				this->next = 0;
+				this->busy = (int)this->threads.size();
+				this->generation++;
+			}
+			this->start_cv.notify_all();
+		}
+
+		void Wait(void)
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->done_cv.wait(lock, [this]() { return this->busy == 0; });
+		}
+
+	private:
+		Work work;
+		std::vector<std::thread> threads;
+
+		std::mutex mtx;
+		std::condition_variable start_cv;
+		std::condition_variable done_cv;
+		uint64_t generation = 0;
+		size_t count = 0;
+		int busy = 0;
+		bool quit = false;
+
+		std::atomic<size_t> next{ 0 };
+
+		void Loop(int index)
+		{
+			uint64_t seen = 0;
+			while (true)
+			{
+				size_t total;
+				{
+					std::unique_lock<std::mutex> lock(this->mtx);
+					this->start_cv.wait(lock, [&]() { return this->quit || this->generation != seen; });
+					if (this->quit) return;
+					seen = this->generation;
+					total = this->count;
+				}
+
+				size_t begin;
+				while ((begin = this->next.fetch_add(YIELD_BLOCK_RECORDS)) < total)
+				{
+					this->work(index, begin, std::min(begin + YIELD_BLOCK_RECORDS, total));
+				}
+
+				std::lock_guard<std::mutex> lock(this->mtx);
+				if (--this->busy == 0) this->done_cv.notify_all();
+			}
+		}
+	};
+}
+
+PV::WeatherReader::WeatherReader()
+{
+	this->file = nullptr;
+	this->binary = false;
+	this->file_size = 0;
+	this->file_position = 0;
+	this->skipped_lines = 0;
+	this->begin = 0;
+	this->end = 0;
+	this->eof = false;
+}
+
+PV::WeatherReader::~WeatherReader()
+{
+	this->Close();
+}
+
+bool PV::WeatherReader::Open(const std::string& path)
+{
+	this->Close();
+
+	this->file = fopen(path.c_str(), "rb");
+	if (this->file == nullptr)
+	{
+		this->error = "Cannot open " + path;
+		return false;
+	}
+
+	this->file_size = FileSize(this->file);
+
+	WeatherFileHeader header;
+	if (fread(&header, sizeof(header), 1, this->file) == 1 && memcmp(header.magic, WEATHER_MAGIC, sizeof(header.magic)) == 0)
+	{
+		if (header.version != WEATHER_VERSION || header.record_size != sizeof(WeatherRecord))
+		{
+			this->error = "Unsupported weather file version";
+			this->Close();
+			return false;
+		}
+
+		this->binary = true;
+		this->file_position = sizeof(header);
+	}
+	else
+	{
+		this->binary = false;
+		fseek(this->file, 0, SEEK_SET);
+		this->buffer.resize(WEATHER_BUFFER_SIZE + 1);
+	}
+
+	this->error.clear();
+	return true;
+}
+
+void PV::WeatherReader::Close()
+{
+	if (this->file != nullptr) fclose(this->file);
+
+	this->file = nullptr;
+	this->binary = false;
+	this->file_size = 0;
+	this->file_position = 0;
+	this->skipped_lines = 0;
+	this->begin = 0;
+	this->end = 0;
+	this->eof = false;
+}
+
+double PV::WeatherReader::Progress() const
+{
+	return (this->file_size > 0) ? (double)this->file_position / (double)this->file_size : 1.0;
+}
+
+bool PV::WeatherReader::Fill()
+{
+	if (this->eof) return false;
+
+	// Keep the incomplete line at the start of the buffer
+	size_t left = this->end - this->begin;
+	if (left == WEATHER_BUFFER_SIZE)
+	{
+		// A line longer than the buffer can't be a weather record
+		this->skipped_lines++;
+		left = 0;
+	}
+	memmove(this->buffer.data(), this->buffer.data() + this->begin, left);
+
+	size_t n = fread(this->buffer.data() + left, 1, WEATHER_BUFFER_SIZE - left, this->file);
+	this->file_position += n;
+	this->begin = 0;
+	this->end = left + n;
+	if (n == 0) this->eof = true;
+
+	// strtod stops at the terminator, also on the last line without a newline
+	this->buffer[this->end] = '\0';
+
+	return n > 0;
+}
+
+bool PV::WeatherReader::ParseLine(const char* p, const char* line_end, WeatherRecord& record)
+{
+	while (p < line_end && IsSeparator(*p)) p++;
+	if (p == line_end) return false;
+
+	if (!IsDigit(*p) && *p != '-' && *p != '+' && *p != '.')
+	{
+		// Header or comment
+		return false;
+	}
+
+	if (!ParseIsoTimestamp(p, line_end, record.timestamp))
+	{
+		char* next;
+		record.timestamp = strtod(p, &next);
+		if (next == p) return false;
+		p = next;
+	}
+
+	double* values[2] = { &record.G, &record.T };
+	for (double* value : values)
+	{
+		while (p < line_end && IsSeparator(*p)) p++;
+
+		char* next;
+		*value = strtod(p, &next);
+		if (next == p || next > line_end) return false;
+		p = next;
+	}
+
+	return true;
+}
+
+size_t PV::WeatherReader::Read(WeatherRecord* out, size_t max_count)
+{
+	if (this->file == nullptr) return 0;
+
+	if (this->binary)
+	{
+		size_t n = fread(out, sizeof(WeatherRecord), max_count, this->file);
+		this->file_position += n * sizeof(WeatherRecord);
+		return n;
+	}
+
+	size_t count = 0;
+	while (count < max_count)
+	{
+		const char* data = this->buffer.data();
+		const char* newline = static_cast<const char*>(memchr(data + this->begin, '\n', this->end - this->begin));
+
+		if (newline == nullptr)
+		{
+			if (this->Fill()) continue;
+
+			// Last line without a newline
+			if (this->begin == this->end) break;
+			newline = data + this->end;
+		}
+
+		const char* line = data + this->begin;
+		const char* line_end = (newline > line && newline[-1] == '\r') ? newline - 1 : newline;
+
+		if (this->ParseLine(line, line_end, out[count])) count++;
+		else if (line_end > line && IsDigit(*line)) this->skipped_lines++;
+
+		this->begin = std::min((size_t)(newline - data) + 1, this->end);
+	}
+
+	return count;
+}
+
+PV::WeatherWriter::WeatherWriter()
+{
+	this->file = nullptr;
+}
+
+PV::WeatherWriter::~WeatherWriter()
+{
+	this->Close();
+}
+
+bool PV::WeatherWriter::Open(const std::string& path)
+{
+	this->Close();
+
+	this->file = fopen(path.c_str(), "wb");
+	if (this->file == nullptr) return false;
+
+	WeatherFileHeader header;
+	memcpy(header.magic, WEATHER_MAGIC, sizeof(header.magic));
+	header.version = WEATHER_VERSION;
+	header.record_size = sizeof(WeatherRecord);
+
+	return fwrite(&header, sizeof(header), 1, this->file) == 1;
+}
+
+bool PV::WeatherWriter::Write(const WeatherRecord* records, size_t count)
+{
+	return this->file != nullptr && fwrite(records, sizeof(WeatherRecord), count, this->file) == count;
+}
+
+void PV::WeatherWriter::Close()
+{
+	if (this->file != nullptr) fclose(this->file);
+	this->file = nullptr;
+}
+
+PV::YieldResult PV::RunYield(const ModelParameters& params, const std::string& weather_path, const YieldOptions& options,
+	std::string* error, std::atomic<bool>* cancel, std::atomic<float>* progress)
+{
+	auto wall_start = std::chrono::steady_clock::now();
+
+	YieldResult result = {};
+
+	WeatherReader reader;
+	if (!reader.Open(weather_path))
+	{
+		if (error != nullptr) *error = reader.Error();
+		return result;
+	}
+
+	int thread_count = (options.threads > 0) ? options.threads : (int)std::thread::hardware_concurrency();
+	thread_count = std::max(1, thread_count);
+
+	result.nominal_power = SolveMaxPowerPoint(params, G_nominal, T_nominal, options.tolerance).P;
+
+	// Two chunks: one evaluated by the workers while the next one is read
+	std::vector<WeatherRecord> records[2] = { std::vector<WeatherRecord>(YIELD_CHUNK_RECORDS), std::vector<WeatherRecord>(YIELD_CHUNK_RECORDS) };
+	std::vector<double> power(YIELD_CHUNK_RECORDS);
+	const WeatherRecord* job = nullptr;
+
+	double temperature_coefficient = (options.temperature == TemperatureInput::Ambient) ? (options.noct - 20.0) / 800.0 : 0.0;
+
+	ChunkWorkers workers(thread_count, [&](int, size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			double t_cell = job[i].T + temperature_coefficient * job[i].G;
+			power[i] = SolveMaxPowerPoint(params, job[i].G, t_cell, options.tolerance).P;
+		}
+	});
+
+	// Only the bin being integrated is kept, a closed one goes to the sink or the result
+	bool has_bin = false;
+	int64_t bin_index = 0;
+	YieldBin bin = {};
+	auto close_bin = [&]()
+	{
+		if (!has_bin) return;
+		if (options.bin_sink) options.bin_sink(bin);
+		else result.bins.push_back(bin);
+	};
+
+	bool has_previous = false;
+	WeatherRecord previous = {};
+	double previous_power = 0;
+
+	int current = 0;
+	size_t count = reader.Read(records[current].data(), YIELD_CHUNK_RECORDS);
+
+	while (count > 0 && !(cancel != nullptr && *cancel))
+	{
+		job = records[current].data();
+		workers.Run(count);
+
+		size_t next_count = reader.Read(records[current ^ 1].data(), YIELD_CHUNK_RECORDS);
+
+		workers.Wait();
+
+		// Trapezoidal integration, the interval belongs to the bin of its start
+		for (size_t i = 0; i < count; i++)
+		{
+			const WeatherRecord& record = job[i];
+
+			if (has_previous)
+			{
+				double dt = record.timestamp - previous.timestamp;
+				int64_t index = (int64_t)floor(previous.timestamp / options.period);
+
+				// An interval before the current bin comes from out of order records
+				if (dt > 0 && dt <= options.max_gap && !(has_bin && index < bin_index))
+				{
+					double energy = 0.5 * (previous_power + power[i]) * dt / 3600.0;
+					double insolation = 0.5 * (std::max(previous.G, 0.0) + std::max(record.G, 0.0)) * dt / 3600.0;
+
+					if (!has_bin || index > bin_index)
+					{
+						close_bin();
+						has_bin = true;
+						bin_index = index;
+						bin = {};
+						bin.start = index * options.period;
+					}
+
+					bin.energy += energy;
+					bin.insolation += insolation;
+
+					result.energy += energy;
+					result.insolation += insolation;
+					result.duration += dt;
+				}
+				else
+				{
+					result.gaps++;
+				}
+			}
+
+			result.peak_power = std::max(result.peak_power, power[i]);
+
+			previous = record;
+			previous_power = power[i];
+			has_previous = true;
+		}
+
+		result.records += count;
+		if (progress != nullptr) *progress = (float)reader.Progress();
+
+		current ^= 1;
+		count = next_count;
+	}
+
+	close_bin();
+
+	double reference_energy = result.insolation / G_nominal * result.nominal_power;
+	result.performance_ratio = (reference_energy > 0) ? result.energy / reference_energy : 0;
+
+	result.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+	if (error != nullptr) error->clear();
+	return result;
+}
+
+void PV::RunYieldJob(ModelParameters params, std::string weather_path, YieldOptions options, YieldStatus* status)
+{
+	status->running = true;
+	status->progress = 0;
+
+	std::string error;
+	YieldResult result = RunYield(params, weather_path, options, &error, &status->cancel, &status->progress);
+
+	{
+		std::lock_guard<std::mutex> lock(status->result_mtx);
+		status->result = result;
+		status->error = error;
+	}
+
+	status->running = false;
+}